@@ -0,0 +1,188 @@
+// Lexer throughput benchmark: flex's scanner versus the hand-written Lexer,
+// in MB/s over the same source.
+//
+// Lexes the files given, or else a generated source shaped like ours: mostly
+// indentation, comments and long string literals. Checks first that both
+// lexers give the same tokens, values, locations and errors; with --check,
+// does only that.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../small_lang.tab.h"
+#include "../small_lexer.hpp"
+
+int flexLex(YYSTYPE *, YYLTYPE *, yyscan_t);
+int yylex_init_extra(ParseContext *, yyscan_t *);
+struct yy_buffer_state *yy_scan_buffer(char *, size_t, yyscan_t);
+int yylex_destroy(yyscan_t);
+
+// The flex scanner reports through the parser's yyerror
+void yyerror(YYLTYPE *loc, yyscan_t, ParseContext *ctx, const char *msg) {
+    ctx->error(loc->first_line, loc->first_column, loc->last_line, loc->last_column, msg);
+}
+
+struct Token {
+    int kind;
+    YYLTYPE loc;
+    uint64_t value;
+};
+
+static uint64_t valueOf(int kind, YYSTYPE &v) {
+    uint64_t bits = 0;
+    switch (kind) {
+        case INT: return (uint32_t)v.ival;
+        case FLOAT: std::memcpy(&bits, &v.fval, sizeof(v.fval)); return bits;
+        case ID: return v.id.getId();
+        case STRING: return ((uint64_t)v.span.offset << 32) | v.span.length;
+        case CHAR: return (uint8_t)v.charlit;
+        case BOOL: return v.boollit;
+    }
+    return 0;
+}
+
+static ParseContext context(Source *source) {
+    ParseContext ctx;
+    ctx.source = source;
+    ctx.arena = NULL;
+    ctx.ast = NULL;
+    ctx.lexer = NULL;
+    ctx.line = 1;
+    ctx.column = 1;
+    return ctx;
+}
+
+// Lexes the whole source with one lexer, keeping the tokens if asked to.
+static size_t lexAll(Source *source, bool fast, std::vector<Token> *out, std::string &errors) {
+    ParseContext ctx = context(source);
+    Lexer lexer(&ctx);
+    yyscan_t scanner;
+    yylex_init_extra(&ctx, &scanner);
+    yy_scan_buffer(source->getBuffer(), source->getBufferSize(), scanner);
+
+    size_t n = 0;
+    YYSTYPE val;
+    YYLTYPE loc = YYLTYPE();
+    while (true) {
+        int kind = fast ? lexer.next(&val, &loc) : flexLex(&val, &loc, scanner);
+        if (kind == 0)
+            break;
+        n++;
+        if (out != NULL)
+            out->push_back({kind, loc, valueOf(kind, val)});
+    }
+    yylex_destroy(scanner);
+    errors = ctx.errors;
+    return n;
+}
+
+static bool same(const Token &a, const Token &b) {
+    return a.kind == b.kind && a.value == b.value
+        && a.loc.first_line == b.loc.first_line && a.loc.last_line == b.loc.last_line
+        && a.loc.first_column == b.loc.first_column && a.loc.last_column == b.loc.last_column;
+}
+
+static std::string generate(size_t bytes) {
+    const char *lines[] = {
+        "// A generated program, mostly comments, blanks and strings\n",
+        "        \n",
+        "name_%d = \"a long string literal that the generator emits for every record, number %d\"\n",
+        "    // indented comment about record %d, which is about as long as the line it describes\n",
+        "func f_%d x y = { if x < y then (x * %d) else (y - 0x%x) }\n",
+        "value_%d = [%d, -%d.5, 'c', '\\x41', true, (\\ a -> a + %d)]\n",
+        "\t\t\t\n",
+    };
+    std::string src;
+    char line[256];
+    srand(42);
+    for (int i = 0; src.size() < bytes; ++i) {
+        int n = snprintf(line, sizeof(line), lines[rand() % 7], i, i, i, i);
+        src.append(line, n);
+    }
+    return src;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+// Lexes it until a second has passed, and gives the rate.
+static double throughput(Source *source, bool fast) {
+    std::string errors;
+    int runs = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    do {
+        lexAll(source, fast, NULL, errors);
+        runs++;
+    } while (seconds_since(start) < 1.0);
+    return source->getSize() * (double)runs / seconds_since(start) / 1e6;
+}
+
+static bool check_only = false;
+
+static int bench(const std::string &name, Source *source) {
+    std::vector<Token> slow, fast;
+    std::string slow_errors, fast_errors;
+    lexAll(source, false, &slow, slow_errors);
+    lexAll(source, true, &fast, fast_errors);
+
+    size_t diff = 0;
+    while (diff < slow.size() && diff < fast.size() && same(slow[diff], fast[diff]))
+        diff++;
+    if (diff != slow.size() || diff != fast.size() || slow_errors != fast_errors) {
+        std::cout << name << ": lexers disagree at token " << diff << std::endl;
+        return 1;
+    }
+    if (check_only)
+        return 0;
+
+    double flex = throughput(source, false);
+    double simd = throughput(source, true);
+    std::cout << name << ": " << source->getSize() << " bytes, " << slow.size() << " tokens" << std::endl;
+    std::cout << "  flex:   " << flex << " MB/s" << std::endl;
+    std::cout << "  Lexer:  " << simd << " MB/s (" << simd / flex << "x)" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int first = 1;
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        check_only = true;
+        first = 2;
+    }
+
+    int failed = 0;
+    for (int i = first; i < argc; ++i) {
+        Source *source = Source::open(argv[i]);
+        if (source == NULL) {
+            std::cout << "Failed to open " << argv[i] << std::endl;
+            return 1;
+        }
+        failed += bench(argv[i], source);
+        delete source;
+    }
+    if (argc > first)
+        return failed == 0 ? 0 : 1;
+
+    char path[] = "/tmp/smol_lex_XXXXXX";
+    int fd = mkstemp(path);
+    std::string src = generate(16 << 20);
+    if (fd < 0 || write(fd, src.data(), src.size()) != (ssize_t)src.size()) {
+        std::cout << "Failed to write " << path << std::endl;
+        return 1;
+    }
+    close(fd);
+    Source *source = Source::open(path);
+    unlink(path);
+    failed = bench("generated", source);
+    delete source;
+    return failed;
+}
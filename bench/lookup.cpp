@@ -0,0 +1,96 @@
+// Variable-read microbenchmark: resolved (depth, slot) lookups through
+// EId::evaluate versus the string-keyed std::map Env they replaced.
+//
+// Builds a chain of nested scopes, binds the same names in a map and in
+// linked frames, and times reading every name repeatedly both ways.
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../small_lang_includes.h"
+#include "../small_values.hpp"
+
+typedef std::map<std::string, Value> MapEnv;
+
+// What EId::evaluate did before resolution: the env arrived by value and
+// every read was a string-keyed search.
+static Value map_lookup(MapEnv env, const std::string &id) {
+    return env.at(id);
+}
+
+// The search alone, without the copy.
+static Value map_find(MapEnv &env, const std::string &id) {
+    return env.at(id);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+int main(int argc, char **argv) {
+    int depth = 3;          // nested function scopes, as in small closures
+    int names = 6;          // bindings per scope
+    long reads = argc > 1 ? atol(argv[1]) : 2000000;
+
+    NodeArena arena;
+    std::vector<Scope*> scopes;
+    Env *env = NULL;
+    MapEnv map_env;
+    std::vector<std::string> ids;
+
+    for (int d = 0; d < depth; ++d) {
+        Scope *scope = new Scope(d == 0 ? NULL : scopes.back(), &arena);
+        scopes.push_back(scope);
+        for (int n = 0; n < names; ++n) {
+            std::string id = "v" + std::to_string(d) + "_" + std::to_string(n);
+            scope->declare(Symbol::intern(id));
+            ids.push_back(id);
+        }
+        env = new Env(env, scope->size());
+        for (int n = 0; n < names; ++n) {
+            Value v = Value::fromInt(d * names + n);
+            env->set(n + 1, v);
+            map_env.insert({ids[d * names + n], v});
+        }
+    }
+
+    std::vector<Expr*> exprs;
+    for (std::vector<std::string>::iterator it = ids.begin(); it != ids.end(); ++it) {
+        EId e(Symbol::intern(*it));
+        exprs.push_back(e.resolve(scopes.back()));
+    }
+
+    // The three loops must read the same values.
+    long sum_resolved = 0, sum_mapped = 0, sum_found = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i = 0; i < reads; ++i) {
+        sum_resolved += exprs[i % exprs.size()]->evaluate(env).asInt();
+    }
+    double resolved = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < reads; ++i) {
+        sum_mapped += map_lookup(map_env, ids[i % ids.size()]).asInt();
+    }
+    double mapped = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < reads; ++i) {
+        sum_found += map_find(map_env, ids[i % ids.size()]).asInt();
+    }
+    double found = seconds_since(start);
+
+    std::cout << "reads:          " << reads << " (" << depth << " scopes x "
+              << names << " names)" << std::endl;
+    std::cout << "resolved EId:   " << resolved * 1e9 / reads << " ns/read" << std::endl;
+    std::cout << "std::map Env:   " << mapped * 1e9 / reads << " ns/read (by value, as before)" << std::endl;
+    std::cout << "std::map::at:   " << found * 1e9 / reads << " ns/read (search only)" << std::endl;
+    std::cout << "speedup:        " << mapped / resolved << "x, "
+              << found / resolved << "x search only" << std::endl;
+
+    return sum_resolved == sum_mapped && sum_mapped == sum_found ? 0 : 1;
+}
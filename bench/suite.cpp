@@ -0,0 +1,543 @@
+// Benchmark suite: runs each workload phase by phase (lex, parse, fold and
+// evaluate) and reports the time per run of each, the heap allocations per
+// evaluation, and the peak heap and RSS, as text and optionally as JSON.
+// Given the JSON of an earlier run, it fails if anything got worse by more
+// than a threshold.
+//
+// Each workload runs in a child process of its own, so its peak RSS and its
+// heap aren't shared with the others. Each phase is repeated until it has
+// taken --min-time seconds in all, and ns/op is that time over the runs.
+// Parsing includes lexing; folding includes resolving, but not the parse
+// each run needs; evaluation runs the same folded AST every time, so
+// closures the JIT compiled on the first run stay compiled for the rest.
+//
+// Workloads are the files given, plus with --generate a program of about
+// that many megabytes, shaped like the ones we generate.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../small_lang.tab.h"
+#include "../small_lexer.hpp"
+
+int flexLex(YYSTYPE *, YYLTYPE *, yyscan_t);
+int yylex_init_extra(ParseContext *, yyscan_t *);
+struct yy_buffer_state *yy_scan_buffer(char *, size_t, yyscan_t);
+int yylex_destroy(yyscan_t);
+
+enum Phase {
+    Lex
+    ,Parse
+    ,Fold
+    ,Evaluate
+    ,Phases
+};
+
+static const char *PhaseNames[] = {"lex", "parse", "fold", "evaluate"};
+
+struct Timing {
+    double ns;
+    long runs;
+};
+
+// What a workload's child sends back; plain data, so it goes down a pipe as
+// it is.
+struct Measured {
+    bool ok;
+    char error[256];
+    size_t bytes;
+    size_t tokens;
+    Timing phases[Phases];
+    // Per evaluation
+    size_t allocations;
+    size_t allocated_bytes;
+    size_t peak_heap_bytes;
+};
+
+struct Workload {
+    std::string name;
+    std::string path;
+    Measured measured;
+    long peak_rss_kb;
+};
+
+static double min_time = 0.5;
+static Engine engine = Engine::Tree;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+// Calls run until the seconds it reports add up to min_time.
+template <typename F>
+static Timing repeat(F run) {
+    double total = 0;
+    long runs = 0;
+    do {
+        total += run();
+        runs++;
+    } while (total < min_time);
+    return {total * 1e9 / runs, runs};
+}
+
+// Lexes the whole source with whichever lexer the parser would use, and
+// returns the number of tokens.
+static size_t lexAll(Source *source) {
+    ParseContext ctx;
+    ctx.source = source;
+    ctx.arena = NULL;
+    ctx.ast = NULL;
+    ctx.lexer = NULL;
+    ctx.line = 1;
+    ctx.column = 1;
+    Lexer lexer(&ctx);
+    yyscan_t scanner;
+    yylex_init_extra(&ctx, &scanner);
+    yy_scan_buffer(source->getBuffer(), source->getBufferSize(), scanner);
+
+    size_t n = 0;
+    YYSTYPE val;
+    YYLTYPE loc = YYLTYPE();
+    while ((Lexer::enabled ? lexer.next(&val, &loc) : flexLex(&val, &loc, scanner)) != 0) {
+        n++;
+    }
+    yylex_destroy(scanner);
+    return n;
+}
+
+static AST *parse(const std::string &path) {
+    ParseResult parsed = parseFile(path);
+    if (parsed.ast == NULL) {
+        if (!parsed.errors.empty() && parsed.errors.back() == '\n')
+            parsed.errors.pop_back();
+        throw "Parsing failed: " + parsed.errors;
+    }
+    return parsed.ast;
+}
+
+static void measure(const std::string &path, Measured &m) {
+    Source *source = Source::open(path);
+    if (source == NULL)
+        throw "Failed to open " + path;
+    m.bytes = source->getSize();
+    m.tokens = lexAll(source);
+    m.phases[Lex] = repeat([&]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        lexAll(source);
+        return seconds_since(start);
+    });
+    delete source;
+
+    m.phases[Parse] = repeat([&]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        delete parse(path);
+        return seconds_since(start);
+    });
+
+    m.phases[Fold] = repeat([&]() {
+        AST *ast = parse(path);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ast->resolve();
+        ast->optimize();
+        double took = seconds_since(start);
+        delete ast;
+        return took;
+    });
+
+    AST *ast = parse(path);
+    ast->resolve();
+    ast->optimize();
+    GcStats before = Heap::instance.getStats();
+    m.phases[Evaluate] = repeat([&]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Env *env = ast->eval(engine);
+        double took = seconds_since(start);
+        Heap::instance.unpin(env);
+        return took;
+    });
+    GcStats after = Heap::instance.getStats();
+    long runs = m.phases[Evaluate].runs;
+    m.allocations = (after.objects + after.freed_objects - before.objects - before.freed_objects) / runs;
+    m.allocated_bytes = (after.bytes + after.freed_bytes - before.bytes - before.freed_bytes) / runs;
+    m.peak_heap_bytes = after.peak_bytes;
+    delete ast;
+}
+
+// Measures the workload in a child, which sends back what it found.
+static bool run(Workload &w) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+
+    if (pid == 0) {
+        close(fds[0]);
+        Measured m = Measured();
+        m.ok = true;
+        try {
+            measure(w.path, m);
+        } catch (const char *msg) {
+            m.ok = false;
+            snprintf(m.error, sizeof(m.error), "%s", msg);
+        } catch (std::string msg) {
+            m.ok = false;
+            snprintf(m.error, sizeof(m.error), "%s", msg.c_str());
+        }
+        ssize_t n = write(fds[1], &m, sizeof(m));
+        _exit(n == sizeof(m) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    size_t got = 0;
+    while (got < sizeof(w.measured)) {
+        ssize_t n = read(fds[0], (char*)&w.measured + got, sizeof(w.measured) - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    w.peak_rss_kb = usage.ru_maxrss;
+    if (got != sizeof(w.measured)) {
+        w.measured = Measured();
+        snprintf(w.measured.error, sizeof(w.measured.error), "Crashed");
+    }
+    return w.measured.ok;
+}
+
+static void report(const Workload &w) {
+    const Measured &m = w.measured;
+    std::cout << w.name << ": " << m.bytes << " bytes, " << m.tokens << " tokens" << std::endl;
+    for (int p = 0; p < Phases; ++p) {
+        std::cout << "  " << PhaseNames[p] << ": " << (long)m.phases[p].ns << " ns/op ("
+            << m.phases[p].runs << " runs)" << std::endl;
+    }
+    std::cout << "  " << m.allocations << " allocations (" << m.allocated_bytes
+        << " bytes) per evaluation" << std::endl;
+    std::cout << "  peak heap " << m.peak_heap_bytes << " bytes, peak RSS "
+        << w.peak_rss_kb << " KB" << std::endl;
+}
+
+static std::string quote(const std::string &s) {
+    std::string q = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"' || s[i] == '\\')
+            q += '\\';
+        q += s[i];
+    }
+    return q + "\"";
+}
+
+static std::string toJson(const std::vector<Workload> &workloads) {
+    std::stringstream out;
+    out << "{\n  \"workloads\": [";
+    bool first = true;
+    for (size_t i = 0; i < workloads.size(); ++i) {
+        const Workload &w = workloads[i];
+        const Measured &m = w.measured;
+        if (!m.ok)
+            continue;
+        out << (first ? "" : ",") << "\n    {\n"
+            << "      \"name\": " << quote(w.name) << ",\n"
+            << "      \"bytes\": " << m.bytes << ",\n"
+            << "      \"tokens\": " << m.tokens << ",\n"
+            << "      \"phases\": {";
+        for (int p = 0; p < Phases; ++p) {
+            out << (p > 0 ? "," : "") << "\n        " << quote(PhaseNames[p])
+                << ": {\"ns_per_op\": " << (long)m.phases[p].ns << ", \"runs\": " << m.phases[p].runs << "}";
+        }
+        out << "\n      },\n"
+            << "      \"allocations\": " << m.allocations << ",\n"
+            << "      \"allocated_bytes\": " << m.allocated_bytes << ",\n"
+            << "      \"peak_heap_bytes\": " << m.peak_heap_bytes << ",\n"
+            << "      \"peak_rss_kb\": " << w.peak_rss_kb << "\n"
+            << "    }";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// Just enough JSON to read back what toJson writes.
+struct Json {
+    std::vector<std::pair<std::string, Json> > fields;
+    std::vector<Json> items;
+    std::string string;
+    double number;
+
+    Json () {
+        number = 0;
+    }
+
+    const Json *get(const std::string &key) const {
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (fields[i].first == key)
+                return &fields[i].second;
+        }
+        return NULL;
+    }
+};
+
+struct JsonReader {
+    const std::string &text;
+    size_t pos;
+
+    void skip() {
+        while (pos < text.size() && isspace((unsigned char)text[pos]))
+            pos++;
+    }
+
+    bool eat(char c) {
+        skip();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    std::string string() {
+        if (!eat('"'))
+            throw std::string("Expected a string");
+        std::string s;
+        while (pos < text.size() && text[pos] != '"') {
+            if (text[pos] == '\\')
+                pos++;
+            s += text[pos++];
+        }
+        pos++;
+        return s;
+    }
+
+    Json value() {
+        Json v;
+        skip();
+        if (eat('{')) {
+            if (eat('}'))
+                return v;
+            do {
+                std::string key = string();
+                if (!eat(':'))
+                    throw std::string("Expected ':'");
+                v.fields.push_back(std::make_pair(key, value()));
+            } while (eat(','));
+            if (!eat('}'))
+                throw std::string("Expected '}'");
+        } else if (eat('[')) {
+            if (eat(']'))
+                return v;
+            do {
+                v.items.push_back(value());
+            } while (eat(','));
+            if (!eat(']'))
+                throw std::string("Expected ']'");
+        } else if (pos < text.size() && text[pos] == '"') {
+            v.string = string();
+        } else {
+            char *end;
+            v.number = strtod(text.c_str() + pos, &end);
+            if (end == text.c_str() + pos)
+                throw std::string("Expected a value");
+            pos = end - text.c_str();
+        }
+        return v;
+    }
+};
+
+static double number(const Json *j, const std::string &key) {
+    const Json *v = j == NULL ? NULL : j->get(key);
+    return v == NULL ? NAN : v->number;
+}
+
+// Prints how each number changed since the baseline for the workloads that
+// ran, and returns how many grew by more than threshold percent. Sizes count too, since an
+// allocation per call costs more on a busier heap than this run shows.
+static int compare(const std::vector<Workload> &workloads, const Json &baseline, double threshold) {
+    const Json *list = baseline.get("workloads");
+    if (list == NULL)
+        throw std::string("No workloads in the baseline");
+
+    int regressions = 0;
+    std::cout << "Against the baseline (threshold " << threshold << "%):" << std::endl;
+    for (std::vector<Workload>::const_iterator w = workloads.begin(); w != workloads.end(); ++w) {
+        if (!w->measured.ok)
+            continue;
+        const Json *base = NULL;
+        for (size_t i = 0; i < list->items.size(); ++i) {
+            const Json *name = list->items[i].get("name");
+            if (name != NULL && name->string == w->name)
+                base = &list->items[i];
+        }
+        if (base == NULL) {
+            std::cout << "  " << w->name << ": not in the baseline" << std::endl;
+            continue;
+        }
+
+        std::vector<std::pair<std::string, std::pair<double, double> > > numbers;
+        const Json *phases = base->get("phases");
+        for (int p = 0; p < Phases; ++p) {
+            numbers.push_back(std::make_pair(std::string(PhaseNames[p]) + " ns/op",
+                std::make_pair(number(phases == NULL ? NULL : phases->get(PhaseNames[p]), "ns_per_op"),
+                    w->measured.phases[p].ns)));
+        }
+        numbers.push_back(std::make_pair("allocations",
+            std::make_pair(number(base, "allocations"), (double)w->measured.allocations)));
+        numbers.push_back(std::make_pair("peak RSS",
+            std::make_pair(number(base, "peak_rss_kb"), (double)w->peak_rss_kb)));
+
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            double was = numbers[i].second.first, now = numbers[i].second.second;
+            if (std::isnan(was))
+                continue;
+            double change = was > 0 ? (now - was) * 100 / was : (now > 0 ? INFINITY : 0);
+            bool regressed = change > threshold;
+            regressions += regressed;
+            char line[256];
+            snprintf(line, sizeof(line), "%.0f -> %.0f (%+.1f%%)", was, now, change);
+            std::cout << "  " << w->name << " " << numbers[i].first << ": " << line
+                << (regressed ? " REGRESSED" : "") << std::endl;
+        }
+    }
+    return regressions;
+}
+
+// A program of about the given size, shaped like our generated ones: many
+// short records of bindings, strings, small functions and calls to them.
+static std::string generate(size_t bytes) {
+    const char *record =
+        "// record %d: a generated block of statements, about as long as a real one\n"
+        "v_%d = %d * (%d + %d) - %d\n"
+        "s_%d = \"a long string literal that the generator emits for every record, number %d\"\n"
+        "func f_%d x y = { if x < y then (x * %d) else (y - %d) }\n"
+        "l_%d = [%d, -%d.5, 'c', true, (\\ a -> a + %d)]\n"
+        "c_%d = f_%d(v_%d, %d)\n"
+        "\n";
+    std::string src;
+    char block[1024];
+    for (int i = 0; src.size() < bytes; ++i) {
+        int n = snprintf(block, sizeof(block), record, i, i, i % 97, i, i % 13, i % 7, i, i,
+            i, i % 11, i % 5, i, i, i, i % 3, i, i, i, i % 17);
+        src.append(block, n);
+    }
+    return src;
+}
+
+static bool readFile(const std::string &path, std::string &text) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::stringstream s;
+    s << in.rdbuf();
+    text = s.str();
+    return true;
+}
+
+static std::string nameOf(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+int main(int argc, char **argv) {
+    std::string json_path, baseline_path;
+    double threshold = 10;
+    double generate_mb = 0;
+    std::vector<Workload> workloads;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--min-time" && i + 1 < argc)
+            min_time = atof(argv[++i]);
+        else if (arg == "--generate" && i + 1 < argc)
+            generate_mb = atof(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (arg == "--threshold" && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (arg == "--vm")
+            engine = Engine::VM;
+        else if (arg == "--fast-lex")
+            Lexer::enabled = true;
+        else
+            workloads.push_back({nameOf(arg), arg, Measured(), 0});
+    }
+
+    char generated[] = "/tmp/smol_bench_XXXXXX";
+    if (generate_mb > 0) {
+        int fd = mkstemp(generated);
+        std::string src = generate(generate_mb * (1 << 20));
+        if (fd < 0 || write(fd, src.data(), src.size()) != (ssize_t)src.size()) {
+            std::cout << "Failed to write " << generated << std::endl;
+            return 1;
+        }
+        close(fd);
+        workloads.push_back({"generated", generated, Measured(), 0});
+    }
+
+    if (workloads.empty()) {
+        std::cout << "Usage: " << argv[0] << " [--min-time s] [--generate MB] [--vm] [--fast-lex]"
+            << " [--json out.json] [--baseline base.json [--threshold pct]] file.smol..." << std::endl;
+        return 1;
+    }
+
+    int failed = 0;
+    for (std::vector<Workload>::iterator it = workloads.begin(); it != workloads.end(); ++it) {
+        if (run(*it)) {
+            report(*it);
+        } else {
+            std::cout << it->name << ": " << it->measured.error << std::endl;
+            failed++;
+        }
+    }
+    if (generate_mb > 0)
+        unlink(generated);
+
+    if (!json_path.empty()) {
+        std::ofstream out(json_path);
+        out << toJson(workloads);
+        if (!out) {
+            std::cout << "Failed to write " << json_path << std::endl;
+            return 1;
+        }
+    }
+
+    if (!baseline_path.empty()) {
+        std::string text;
+        if (!readFile(baseline_path, text)) {
+            std::cout << "Failed to open " << baseline_path << std::endl;
+            return 1;
+        }
+        try {
+            JsonReader reader = {text, 0};
+            if (compare(workloads, reader.value(), threshold) > 0)
+                return 2;
+        } catch (std::string msg) {
+            std::cout << baseline_path << ": " << msg << std::endl;
+            return 1;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+// Runtime for programs compiled ahead of time (see IRGen in small_llvm.hpp).
+//
+// Values, operators and the heap are the interpreter's own, so a compiled
+// program computes and prints exactly what the interpreter would. This adds
+// closures over native code, the shadow stack compiled code keeps its frames
+// on, and the entry points it calls. Every entry point takes and returns
+// values as their bits.
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "small_values.hpp"
+#include "small_env.hpp"
+#include "small_ops.hpp"
+#include "small_heap.hpp"
+#include "small_builtins.hpp"
+
+// A lambda compiled to a function, and the frame it closed over. Its source
+// text is kept so it prints like the interpreter's closures.
+class VNative : public Object {
+    void *code;
+    int arity;
+    const char *text;
+    Env *env;
+
+    public:
+    VNative (void *c, int a, const char *t, Env *e) : Object(ObjKind::Closure) {
+        code = c;
+        arity = a;
+        text = t;
+        env = e;
+    }
+
+    virtual std::string toString() {
+        return text;
+    }
+
+    virtual void trace(Heap &heap) {
+        heap.mark(env);
+    }
+
+    virtual size_t footprint() {
+        return sizeof(VNative);
+    }
+
+    void *getCode() {
+        return code;
+    }
+
+    int getArity() {
+        return arity;
+    }
+
+    Env *getEnv() {
+        return env;
+    }
+};
+
+// Words of shadow stack; a program nesting deeper than this fails.
+static const size_t StackWords = 1 << 20;
+
+static uint64_t *stack_base;
+
+extern "C" {
+    uint64_t *smol_sp;
+    uint64_t *smol_stack_limit;
+}
+
+// Everything below smol_sp is live. A frame's word 1 is an Env rather than
+// a value; Env and Object both start with their HeapObject, so it is marked
+// the same way.
+class ShadowStack : public RootSet {
+    public:
+    virtual void markRoots(Heap &heap) {
+        for (uint64_t *p = stack_base; p < smol_sp; ++p) {
+            heap.mark(Value::fromBits(*p));
+        }
+    }
+};
+
+static ShadowStack shadow_stack;
+
+static VNative *native(uint64_t f) {
+    return Value::fromBits(f).as<VNative>();
+}
+
+static std::vector<Value> sequence(uint64_t *items, int32_t n) {
+    std::vector<Value> values;
+    for (int32_t i = 0; i < n; ++i) {
+        values.push_back(Value::fromBits(items[i]));
+    }
+    return values;
+}
+
+extern "C" {
+
+void smol_fail(const char *msg) __attribute__((noreturn));
+
+void smol_fail(const char *msg) {
+    std::cout << "Evaluation failed: " << msg << std::endl;
+    std::exit(3);
+}
+
+void smol_init() {
+    stack_base = new uint64_t[StackWords];
+    smol_sp = stack_base;
+    smol_stack_limit = stack_base + StackWords;
+    Heap::instance.addRootSet(&shadow_stack);
+}
+
+// The top-level frame, pinned for the life of the program
+Env *smol_globals(int32_t size) {
+    Env *env = Heap::instance.make<Env>((Env*)NULL, size);
+    Heap::instance.pin(env);
+    return env;
+}
+
+Env *smol_frame(uint64_t self, int32_t size) {
+    return Heap::instance.make<Env>(native(self)->getEnv(), size);
+}
+
+Env *smol_closure_env(uint64_t self) {
+    return native(self)->getEnv();
+}
+
+uint64_t smol_lookup(Env *env, int32_t depth, int32_t slot) {
+    return env->lookup(depth, slot).getBits();
+}
+
+void smol_assign(Env *env, int32_t slot, uint64_t v) {
+    if (!env->get(slot).isNull())
+        smol_fail("Variable already exists");
+    env->set(slot, Value::fromBits(v));
+}
+
+void smol_bind(Env *env, int32_t slot, uint64_t v) {
+    env->set(slot, Value::fromBits(v));
+}
+
+uint64_t smol_closure(void *code, int32_t arity, const char *text, Env *env) {
+    return Value::fromObject(Heap::instance.make<VNative>(code, arity, text, env)).getBits();
+}
+
+void *smol_callee(uint64_t f, int32_t nargs) {
+    Value v = Value::fromBits(f);
+    if (!v.is(ObjKind::Closure))
+        smol_fail("App: LHS did not eval to function");
+    if (native(f)->getArity() != nargs)
+        smol_fail("App: params and args length mismatch");
+    return native(f)->getCode();
+}
+
+uint64_t smol_string(const char *s, int64_t len) {
+    return Value::fromObject(Heap::instance.make<VString>(std::string(s, len))).getBits();
+}
+
+uint64_t smol_list(uint64_t *items, int32_t n) {
+    return Value::fromObject(Heap::instance.make<VList>(sequence(items, n))).getBits();
+}
+
+uint64_t smol_builtin(int32_t index, uint64_t *args, int32_t n) {
+    VBuiltin *builtin = VBuiltin::get(index);
+    if (builtin->getArity() != n)
+        smol_fail("App: params and args length mismatch");
+    std::vector<Value> values = sequence(args, n);
+    try {
+        return builtin->apply(values.data()).getBits();
+    } catch (const char *msg) {
+        smol_fail(msg);
+    } catch (std::string msg) {
+        smol_fail(msg.c_str());
+    }
+}
+
+uint64_t smol_tuple(uint64_t *items, int32_t n) {
+    return Value::fromObject(Heap::instance.make<VTuple>(sequence(items, n))).getBits();
+}
+
+uint64_t smol_op2(int32_t op, uint64_t l, uint64_t r) {
+    try {
+        return evalOp2((Op2)op, Value::fromBits(l), Value::fromBits(r)).getBits();
+    } catch (const char *msg) {
+        smol_fail(msg);
+    } catch (std::string msg) {
+        smol_fail(msg.c_str());
+    }
+}
+
+uint64_t smol_op1(int32_t op, uint64_t v) {
+    try {
+        return evalOp1((Op1)op, Value::fromBits(v)).getBits();
+    } catch (const char *msg) {
+        smol_fail(msg);
+    } catch (std::string msg) {
+        smol_fail(msg.c_str());
+    }
+}
+
+// Prints the bindings as the interpreter does, and gives the exit code.
+int32_t smol_finish(Env *env, const char **names, int32_t n) {
+    std::cout << "Evaluation completed." << std::endl;
+    for (int32_t i = 0; i < n; ++i) {
+        if (!env->get(i).isNull())
+            std::cout << names[i] << " = " << env->get(i).toString() << std::endl;
+    }
+    return 0;
+}
+
+}
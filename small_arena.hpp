@@ -0,0 +1,167 @@
+#ifndef SMALL_ARENA_HPP
+#define SMALL_ARENA_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "small_stats.hpp"
+
+// Owns every node of one parse. Nodes are bump-allocated out of large blocks
+// and destroyed together when the arena is, so constructing an AST costs one
+// allocation per node and nodes can point at each other freely without
+// anyone having to clone or delete children.
+//
+// Expression nodes are hash-consed: intern() returns the node it made
+// before from equal arguments, so each distinct subtree exists once, and
+// two subtrees are equal exactly when they're the same node.
+class NodeArena {
+    static const size_t BlockSize = 64 * 1024;
+
+    struct Dtor {
+        void (*fn)(void *);
+        void *obj;
+    };
+
+    std::vector<char*> blocks;
+    size_t used;
+    size_t capacity;
+    std::vector<Dtor> dtors;
+    // What intern() has made, by its type and arguments
+    std::unordered_map<std::string, void*> interned;
+    // With --stats, the nodes made, and how many more intern() was asked
+    // for that it already had, by type
+    std::unordered_map<std::type_index, AllocCount> made;
+    std::unordered_map<std::type_index, size_t> shared;
+
+    template <typename T>
+    static void destroy(void *p) {
+        static_cast<T*>(p)->~T();
+    }
+
+    void *allocate(size_t size, size_t align) {
+        size_t start = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || start + size > capacity) {
+            capacity = size > BlockSize ? size : BlockSize;
+            blocks.push_back((char*)std::malloc(capacity));
+            if (blocks.back() == NULL)
+                throw std::bad_alloc();
+            start = 0;
+        }
+        used = start + size;
+        return blocks.back() + start;
+    }
+
+    // Appends an argument to a key: scalars and pointers by their bytes, so
+    // children compare by address, and strings and vectors by contents.
+    template <typename T>
+    static void key(std::string &k, const T &v) {
+        static_assert(std::is_trivially_copyable<T>::value, "interned nodes take scalars, pointers, strings and vectors");
+        k.append((const char*)&v, sizeof(T));
+    }
+
+    static void key(std::string &k, std::string_view v) {
+        key(k, v.size());
+        k.append(v);
+    }
+
+    static void key(std::string &k, const std::string &v) {
+        key(k, std::string_view(v));
+    }
+
+    template <typename T>
+    static void key(std::string &k, const std::vector<T> &v) {
+        key(k, v.size());
+        for (typename std::vector<T>::const_iterator it = v.begin(); it != v.end(); ++it) {
+            key(k, *it);
+        }
+    }
+
+    public:
+    NodeArena () {
+        used = 0;
+        capacity = 0;
+    }
+
+    NodeArena (const NodeArena &) = delete;
+
+    NodeArena &operator=(const NodeArena &) = delete;
+
+    ~NodeArena() {
+        for (std::vector<Dtor>::reverse_iterator it = dtors.rbegin(); it != dtors.rend(); ++it) {
+            it->fn(it->obj);
+        }
+        for (std::vector<char*>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+            std::free(*it);
+        }
+    }
+
+    // Takes over every node of other, which is left empty. The block this
+    // arena is allocating from stays last, so it carries on filling it.
+    // Where both interned equal nodes, this arena's stays the one intern()
+    // returns.
+    void adopt(NodeArena *other) {
+        blocks.insert(blocks.begin(), other->blocks.begin(), other->blocks.end());
+        dtors.insert(dtors.end(), other->dtors.begin(), other->dtors.end());
+        interned.insert(other->interned.begin(), other->interned.end());
+        for (std::unordered_map<std::type_index, AllocCount>::iterator it = other->made.begin(); it != other->made.end(); ++it) {
+            made[it->first].count += it->second.count;
+            made[it->first].bytes += it->second.bytes;
+        }
+        for (std::unordered_map<std::type_index, size_t>::iterator it = other->shared.begin(); it != other->shared.end(); ++it) {
+            shared[it->first] += it->second;
+        }
+        other->blocks.clear();
+        other->dtors.clear();
+        other->interned.clear();
+        other->made.clear();
+        other->shared.clear();
+        other->used = 0;
+        other->capacity = 0;
+    }
+
+    template <typename T, typename... Args>
+    T *make(Args&&... args) {
+        T *node = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        dtors.push_back({&destroy<T>, node});
+        if (Stats::enabled)
+            made[std::type_index(typeid(T))].add(sizeof(T));
+        return node;
+    }
+
+    // Like make, but returns the node an earlier call made from equal
+    // arguments if there is one. Only for nodes that never change once
+    // made, and whose children were interned too.
+    template <typename T, typename... Args>
+    T *intern(Args&&... args) {
+        std::string k(typeid(T).name());
+        (key(k, args), ...);
+        std::unordered_map<std::string, void*>::iterator it = interned.find(k);
+        if (it != interned.end()) {
+            if (Stats::enabled)
+                shared[std::type_index(typeid(T))]++;
+            return static_cast<T*>(it->second);
+        }
+        T *node = make<T>(std::forward<Args>(args)...);
+        interned.emplace(std::move(k), node);
+        return node;
+    }
+
+    const std::unordered_map<std::type_index, AllocCount> &getMade() {
+        return made;
+    }
+
+    const std::unordered_map<std::type_index, size_t> &getShared() {
+        return shared;
+    }
+};
+
+#endif
@@ -9,38 +9,247 @@
 #include "small_ops.hpp"
 #include "small_values.hpp"
 #include "small_env.hpp"
+#include "small_scope.hpp"
+#include "small_arena.hpp"
+#include "small_bytecode.hpp"
+#include "small_vm.hpp"
+#include "small_heap.hpp"
+#include "small_fold.hpp"
+#include "small_llvm.hpp"
+#include "small_jit.hpp"
+#include "small_source.hpp"
+
+// Which evaluator runs the program
+enum class Engine {
+    Tree
+    ,VM
+};
 
 class AST {
-    Statement *root;
+    std::vector<Source*> sources;
+    NodeArena *arena;
+    Seq *root;
+    Scope *globals;
+    Proto *program;
+    // Bytecode that ran before the program was extended; the values it
+    // made may point into its constants
+    std::vector<Proto*> ran;
+    // Kept from optimize(), for the statements extend() adds
+    Folder *folder;
+    // See keepOpen
+    bool open;
+
+    // Runs stmts in env, the top-level frame.
+    void runTop(Seq *stmts, Proto *code, Env *env, Engine engine) {
+        if (engine == Engine::VM) {
+            VM vm;
+            vm.run(code, env);
+        } else {
+            stmts->evaluate(env);
+        }
+    }
 
-    Env env_eval(Env env) {
-        return root->evaluate(env);
+    // Compiles stmts as a top-level program.
+    Proto *compileTop(Seq *stmts) {
+        Proto *code = new Proto();
+        code->frame_size = globals->size();
+        Compiler c(code);
+        stmts->compile(&c);
+        c.emit(Opcode::End, 0);
+        return code;
     }
 
     public:
-        AST(Statement *r) {
-            root = r->clone();
+        // Takes ownership of the arena that r was built in, and of the source
+        // it was parsed from, which its string literals point into.
+        AST(Seq *r, NodeArena *a, Source *s) {
+            sources.push_back(s);
+            arena = a;
+            root = r;
+            globals = NULL;
+            program = NULL;
+            folder = NULL;
+            open = false;
         }
 
-        AST(const AST &other) {
-            root = other.root->clone();
-        }
+        AST(const AST &) = delete;
+
+        AST &operator=(const AST &) = delete;
 
         ~AST() {
-            delete root;
+            delete folder;
+            delete program;
+            for (std::vector<Proto*>::iterator it = ran.begin(); it != ran.end(); ++it) {
+                delete *it;
+            }
+            delete globals;
+            delete arena;
+            for (std::vector<Source*>::iterator it = sources.begin(); it != sources.end(); ++it) {
+                delete *it;
+            }
         }
 
-        AST *clone() {
-            return new AST(*this);
+        // Appends the statements of other, a program parsed from the text
+        // that follows this one's, and takes over its nodes and its source.
+        // Deletes other. Both must be fresh from the parser.
+        void append(AST *other) {
+            root->concat(other->root);
+            arena->adopt(other->arena);
+            sources.insert(sources.end(), other->sources.begin(), other->sources.end());
+            other->sources.clear();
+            delete other;
         }
 
         std::string toString() {
             return root->toString();
         }
 
-        Env eval() {
-            Env env;
-            return env_eval(env);
+        NodeArena *getArena() {
+            return arena;
+        }
+
+        // Makes the program the start of a session, which extend() adds
+        // statements to as they are entered: the top level stays open, so
+        // a name that nothing binds yet is given a slot for a later
+        // statement to bind, rather than left unbound. Call before resolve().
+        void keepOpen() {
+            open = true;
+        }
+
+        // Scope resolution: rewrites every identifier into frame coordinates.
+        // Must run before eval(); eval() runs it itself if it hasn't been.
+        void resolve() {
+            delete folder;
+            folder = NULL;
+            delete program;
+            program = NULL;
+            delete globals;
+            globals = new Scope(NULL, arena);
+            if (open)
+                globals->setOpen();
+            root->declare(globals);
+            root->resolve(globals);
+        }
+
+        // Folds constants and evaluates calls on constant arguments ahead of
+        // time. Runs after resolution, and before the program is compiled.
+        void optimize() {
+            if (globals == NULL)
+                resolve();
+            delete program;
+            program = NULL;
+            delete folder;
+            folder = new Folder(arena, globals->size());
+            root->fold(folder);
+        }
+
+        // The names of the top-level bindings, indexed by slot.
+        const std::vector<Symbol> &getGlobals() {
+            if (globals == NULL)
+                resolve();
+            return globals->getNames();
+        }
+
+        // Compiles the program to bytecode, once.
+        Proto *compile() {
+            if (globals == NULL)
+                resolve();
+            if (program == NULL)
+                program = compileTop(root);
+            return program;
+        }
+
+        // The program as a module of LLVM IR, for compiling to a native
+        // executable against the runtime; see IRGen.
+        std::string emitIR() {
+            if (globals == NULL)
+                resolve();
+            IRGen gen;
+            return gen.program(root, globals->getNames());
+        }
+
+        // Evaluates the program and returns its top-level frame, whose slots
+        // line up with getGlobals(). The frame is pinned so the collector
+        // keeps it; unpin it from the Heap once done with it.
+        Env *eval(Engine engine = Engine::Tree) {
+            if (globals == NULL)
+                resolve();
+            Env *env = Heap::instance.make<Env>((Env*)NULL, globals->size());
+            Heap::instance.pin(env);
+            try {
+                runTop(root, engine == Engine::VM ? compile() : NULL, env, engine);
+            } catch (...) {
+                Heap::instance.unpin(env);
+                throw;
+            }
+            return env;
+        }
+
+        // Evaluates the program in env, a pinned frame of at least
+        // getGlobals().size() slots, which keeps whatever was bound before
+        // an error.
+        void eval(Env *env, Engine engine) {
+            if (globals == NULL)
+                resolve();
+            try {
+                runTop(root, engine == Engine::VM ? compile() : NULL, env, engine);
+            } catch (...) {
+                forget(env);
+                throw;
+            }
+        }
+
+        // Runs more, statements entered after this program was evaluated in
+        // env, and appends them to it. They are resolved against its top
+        // level, which, with env, grows for the names they bind, and folded
+        // with everything already known if the program was optimized.
+        // Closures, their bytecode and their machine code carry over, so
+        // nothing that ran before is parsed or compiled again. Deletes more.
+        void extend(AST *more, Env *env, Engine engine) {
+            if (globals == NULL)
+                resolve();
+            Seq *stmts = more->root;
+            arena->adopt(more->arena);
+            sources.insert(sources.end(), more->sources.begin(), more->sources.end());
+            more->sources.clear();
+            delete more;
+
+            stmts->declare(globals);
+            stmts->resolve(globals);
+            env->grow(globals->size());
+            if (folder != NULL) {
+                folder->grow(globals->size());
+                stmts->fold(folder);
+            }
+            if (program != NULL)
+                ran.push_back(program);
+            program = NULL;
+
+            Proto *code = engine == Engine::VM ? compileTop(stmts) : NULL;
+            if (code != NULL)
+                ran.push_back(code);
+            try {
+                runTop(stmts, code, env, engine);
+            } catch (...) {
+                root->concat(stmts);
+                forget(env);
+                throw;
+            }
+            root->concat(stmts);
+        }
+
+        // Statements a failed run never reached may be bound in the folder;
+        // starts it again from what env does hold.
+        void forget(Env *env) {
+            if (folder == NULL)
+                return;
+            delete folder;
+            folder = new Folder(arena, globals->size());
+            for (int i = 1; i < env->size(); ++i) {
+                Expr *lit = env->get(i).isNull() ? NULL : folder->literal(env->get(i));
+                if (lit != NULL)
+                    folder->bind(i, lit);
+            }
         }
 };
 #endif
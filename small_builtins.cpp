@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "small_builtins.hpp"
+#include "small_list.hpp"
+#include "small_kernel.hpp"
+#include "small_expr.hpp"
+
+static const int Width = ListNode::Width;
+
+static void typeError(const char *name, Value v) {
+    throw std::string(name) + ": cannot apply to " + v.typeName();
+}
+
+static VList *listArg(const char *name, Value v) {
+    if (!v.is(ObjKind::List))
+        typeError(name, v);
+    return v.as<VList>();
+}
+
+static int intArg(const char *name, Value v) {
+    if (!v.isInt())
+        typeError(name, v);
+    return v.asInt();
+}
+
+// len(xs): how many values are in a list
+static Value len(Value *args) {
+    return Value::fromInt(listArg("len", args[0])->size());
+}
+
+// get(xs, i): the value at i, counting from 0
+static Value get(Value *args) {
+    VList *list = listArg("get", args[0]);
+    int i = intArg("get", args[1]);
+    if (i < 0 || (size_t)i >= list->size())
+        throw "get: index out of range";
+    return list->get(i);
+}
+
+// slice(xs, from, to): the values from from up to, but not including, to
+static Value slice(Value *args) {
+    VList *list = listArg("slice", args[0]);
+    int from = intArg("slice", args[1]);
+    int to = intArg("slice", args[2]);
+    if (from < 0 || to < from || (size_t)to > list->size())
+        throw "slice: index out of range";
+    return Value::fromObject(list->slice(from, to));
+}
+
+// A leaf's values as floats, in its own items if they are floats and in buf
+// if not. Throws if any isn't a number.
+static const float *floats(const char *name, ListLeaf *leaf, float *buf) {
+    if (leaf->elem == Elem::Float)
+        return leaf->as<float>()->items;
+    if (leaf->elem == Elem::Int) {
+        std::copy(leaf->as<int32_t>()->items, leaf->as<int32_t>()->items + leaf->count, buf);
+        return buf;
+    }
+    for (int i = 0; i < leaf->count; ++i) {
+        Value v = leaf->get(i);
+        if (!v.isNumber())
+            typeError(name, v);
+        buf[i] = v.toFloat();
+    }
+    return buf;
+}
+
+// sum(xs): the values added up. Ints give an int, wrapping like +; any
+// float makes it a float, with every value converted to float and added.
+static Value sum(Value *args) {
+    ListNode *root = listArg("sum", args[0])->getRoot();
+    if (root == NULL)
+        return Value::fromInt(0);
+
+    if (root->elem == Elem::Int) {
+        uint32_t total = 0;
+        forEachLeaf(root, [&](ListLeaf *leaf) {
+            total += (uint32_t)sumInts(leaf->as<int32_t>()->items, leaf->count);
+        });
+        return Value::fromInt((int32_t)total);
+    }
+
+    float total = 0;
+    forEachLeaf(root, [&](ListLeaf *leaf) {
+        float buf[Width];
+        total += sumFloats(floats("sum", leaf, buf), leaf->count);
+    });
+    return Value::fromFloat(total);
+}
+
+// dot(xs, ys): the sum of the products of their values, pairwise, with the
+// types of sum. The two trees needn't have the same shape, so their leaves
+// are walked together a run at a time.
+static Value dot(Value *args) {
+    VList *xs = listArg("dot", args[0]);
+    VList *ys = listArg("dot", args[1]);
+    if (xs->size() != ys->size())
+        throw "dot: lists differ in length";
+    if (xs->size() == 0)
+        return Value::fromInt(0);
+
+    std::vector<ListLeaf*> a, b;
+    forEachLeaf(xs->getRoot(), [&](ListLeaf *leaf) { a.push_back(leaf); });
+    forEachLeaf(ys->getRoot(), [&](ListLeaf *leaf) { b.push_back(leaf); });
+    bool ints = xs->getRoot()->elem == Elem::Int && ys->getRoot()->elem == Elem::Int;
+
+    uint32_t int_total = 0;
+    float float_total = 0;
+    size_t i = 0, j = 0;
+    int at_a = 0, at_b = 0;
+    while (i < a.size()) {
+        int n = std::min(a[i]->count - at_a, b[j]->count - at_b);
+        if (ints) {
+            int_total += (uint32_t)dotInts(a[i]->as<int32_t>()->items + at_a, b[j]->as<int32_t>()->items + at_b, n);
+        } else {
+            float buf_a[Width], buf_b[Width];
+            float_total += dotFloats(floats("dot", a[i], buf_a) + at_a, floats("dot", b[j], buf_b) + at_b, n);
+        }
+        at_a += n;
+        at_b += n;
+        if (at_a == a[i]->count) {
+            i++;
+            at_a = 0;
+        }
+        if (at_b == b[j]->count) {
+            j++;
+            at_b = 0;
+        }
+    }
+    if (ints)
+        return Value::fromInt((int32_t)int_total);
+    return Value::fromFloat(float_total);
+}
+
+// range(from, to): the ints from from up to, but not including, to
+static Value range(Value *args) {
+    int from = intArg("range", args[0]);
+    int to = intArg("range", args[1]);
+
+    Roots roots;
+    ListBuilder out(roots);
+    int32_t items[Width];
+    for (int64_t i = from; i < to; i += Width) {
+        int n = (int)std::min((int64_t)Width, to - i);
+        for (int k = 0; k < n; ++k) {
+            items[k] = (int32_t)(i + k);
+        }
+        out.add(items, n);
+    }
+    return Value::fromObject(Heap::instance.make<VList>(out.finish()));
+}
+
+// The Kernel of the function for map, filter or preduce, if it's a lambda
+// whose body compiles to one, or NULL for a builtin or any other lambda,
+// which EApp::apply calls a value at a time instead. Either takes arity
+// arguments.
+static Kernel *kernelArg(const char *name, Value f, int arity) {
+    if (!f.is(ObjKind::Closure) && !f.is(ObjKind::Builtin))
+        typeError(name, f);
+    int takes = f.is(ObjKind::Builtin) ? f.as<VBuiltin>()->getArity()
+        : (int)f.as<VClos>()->getLambda()->getParamSlots().size();
+    if (takes != arity)
+        throw "App: params and args length mismatch";
+    return f.is(ObjKind::Closure) ? f.as<VClos>()->getLambda()->getKernel() : NULL;
+}
+
+// map(f, xs): f of each value, in order. pmap(f, xs) is the same, with the
+// leaves of a lambda that has a Kernel spread over threads; any other
+// function runs on the caller's.
+static Value mapWith(const char *name, Value *args, bool parallel) {
+    Kernel *k = kernelArg(name, args[0], 1);
+    ListNode *root = listArg(name, args[1])->getRoot();
+
+    Roots roots;
+    ListBuilder out(roots);
+    if (k != NULL) {
+        k->map(args[0].as<VClos>()->getEnv(), root, out, parallel);
+    } else {
+        forEachLeaf(root, [&](ListLeaf *leaf) {
+            for (int i = 0; i < leaf->count; ++i) {
+                Value v = leaf->get(i);
+                out.add(EApp::apply(args[0], &v, 1));
+            }
+        });
+    }
+    return Value::fromObject(Heap::instance.make<VList>(out.finish()));
+}
+
+static Value map(Value *args) {
+    return mapWith("map", args, false);
+}
+
+static Value pmap(Value *args) {
+    return mapWith("pmap", args, true);
+}
+
+// filter(f, xs): the values f gives true for, in order. pfilter(f, xs) is
+// the same, spread over threads like pmap.
+static Value filterWith(const char *name, Value *args, bool parallel) {
+    Kernel *k = kernelArg(name, args[0], 1);
+    ListNode *root = listArg(name, args[1])->getRoot();
+
+    Roots roots;
+    ListBuilder out(roots);
+    if (k != NULL) {
+        k->filter(args[0].as<VClos>()->getEnv(), root, out, parallel);
+    } else {
+        forEachLeaf(root, [&](ListLeaf *leaf) {
+            for (int i = 0; i < leaf->count; ++i) {
+                Value v = leaf->get(i);
+                Value keep = EApp::apply(args[0], &v, 1);
+                if (!keep.isBool())
+                    throw "filter: predicate gave " + keep.typeName() + ", not bool";
+                if (keep.asBool())
+                    out.add(v);
+            }
+        });
+    }
+    return Value::fromObject(Heap::instance.make<VList>(out.finish()));
+}
+
+static Value filter(Value *args) {
+    return filterWith("filter", args, false);
+}
+
+static Value pfilter(Value *args) {
+    return filterWith("pfilter", args, true);
+}
+
+// preduce(f, xs): the values combined with f, a function of two arguments,
+// which should be associative; see Kernel::reduce for the order, which a
+// function without a Kernel is called in too, on the caller's thread.
+static Value preduce(Value *args) {
+    Kernel *k = kernelArg("preduce", args[0], 2);
+    ListNode *root = listArg("preduce", args[1])->getRoot();
+    if (root == NULL)
+        throw "preduce: empty list";
+    if (k != NULL)
+        return k->reduce(args[0].as<VClos>()->getEnv(), root, true);
+
+    Roots roots;
+    Value total;
+    bool first = true;
+    forEachLeaf(root, [&](ListLeaf *leaf) {
+        Value values[Width];
+        int n = leaf->count;
+        leaf->read(0, n, values);
+        while (n > 1) {
+            int m = n / 2;
+            for (int i = 0; i < m; ++i) {
+                Value pair[2] = {values[2 * i], values[2 * i + 1]};
+                values[i] = EApp::apply(args[0], pair, 2);
+                roots.push(values[i]);
+            }
+            if (n % 2 == 1)
+                values[m] = values[n - 1];
+            n = m + n % 2;
+        }
+        if (first) {
+            total = values[0];
+            first = false;
+        } else {
+            Value pair[2] = {total, values[0]};
+            total = EApp::apply(args[0], pair, 2);
+        }
+        roots.push(total);
+    });
+    return total;
+}
+
+static VBuiltin builtins[] = {
+    VBuiltin("len", 1, len, true, true),
+    VBuiltin("get", 2, get, true, true),
+    VBuiltin("slice", 3, slice, true, true),
+    VBuiltin("sum", 1, sum),
+    VBuiltin("dot", 2, dot),
+    VBuiltin("range", 2, range),
+    VBuiltin("map", 2, map, false),
+    VBuiltin("filter", 2, filter, false),
+    VBuiltin("pmap", 2, pmap, false),
+    VBuiltin("pfilter", 2, pfilter, false),
+    VBuiltin("preduce", 2, preduce, false),
+};
+
+static const int Count = sizeof(builtins) / sizeof(builtins[0]);
+
+int VBuiltin::getIndex() {
+    return this - builtins;
+}
+
+VBuiltin *VBuiltin::find(Symbol name) {
+    for (int i = 0; i < Count; ++i) {
+        if (builtins[i].name == name.getName())
+            return &builtins[i];
+    }
+    return NULL;
+}
+
+VBuiltin *VBuiltin::get(int index) {
+    return &builtins[index];
+}
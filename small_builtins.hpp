@@ -0,0 +1,76 @@
+#ifndef SMALL_BUILTINS_HPP
+#define SMALL_BUILTINS_HPP
+
+#include <string>
+
+#include "small_symbol.hpp"
+#include "small_values.hpp"
+
+// A function the language provides. A name the program never binds refers
+// to the builtin of that name, if there is one, so a program can still
+// define its own len or get.
+//
+// Builtins are made once, outside the heap, and called with their arguments
+// in an array: by EApp and the VM directly, and through the runtime by
+// compiled code. map, filter and their parallel versions run a lambda's
+// Kernel, which compiled closures don't have, so they're only for the
+// interpreter.
+class VBuiltin : public Object {
+    std::string name;
+    int arity;
+    Value (*fn)(Value *args);
+    bool native;
+    bool bounded;
+
+    public:
+    VBuiltin (const char *n, int a, Value (*f)(Value *), bool nat = true, bool bound = false) : Object(ObjKind::Builtin) {
+        name = n;
+        arity = a;
+        fn = f;
+        native = nat;
+        bounded = bound;
+    }
+
+    virtual std::string toString() {
+        return "<builtin " + name + ">";
+    }
+
+    virtual size_t footprint() {
+        return sizeof(VBuiltin);
+    }
+
+    const std::string &getName() {
+        return name;
+    }
+
+    int getArity() {
+        return arity;
+    }
+
+    // Whether compiled code can call it
+    bool isNative() {
+        return native;
+    }
+
+    // Whether its work is bounded whatever the arguments, so the folder
+    // can run it ahead of time
+    bool isBounded() {
+        return bounded;
+    }
+
+    // Its place in the table, which compiled code calls it by.
+    int getIndex();
+
+    // Runs it on arity arguments. Throws, like an operator, if they're the
+    // wrong types.
+    Value apply(Value *args) {
+        return fn(args);
+    }
+
+    // The builtin called name, or NULL if there isn't one.
+    static VBuiltin *find(Symbol name);
+
+    static VBuiltin *get(int index);
+};
+
+#endif
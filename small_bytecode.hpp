@@ -0,0 +1,172 @@
+#ifndef SMALL_BYTECODE_HPP
+#define SMALL_BYTECODE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_ops.hpp"
+#include "small_values.hpp"
+
+// Instructions are a flat stream of 32-bit words: the opcode, then its
+// operands. Comments give the operands and the stack effect. A name operand
+// is a Symbol id, kept only to report errors.
+enum class Opcode : int32_t {
+    Const           // k             -> constants[k]
+    ,LoadLocal      // slot name     -> env[slot]
+    ,Load           // depth slot name -> the binding at (depth, slot)
+    ,LoadUnbound    // name          -> (throws)
+    ,Store          // slot          v ->
+    ,LoadSlot       // slot name     -> locals[slot], for stack frames
+    ,StoreSlot      // slot          v ->
+    ,MakeList       // n             v1..vn -> list
+    ,MakeTuple      // n             v1..vn -> tuple
+    ,Closure        // k             -> closure over lambdas[k]
+    ,Call           // n             f a1..an -> result
+    ,TailCall       // n             f a1..an -> (replaces the current call)
+    ,Return         //               v ->
+    ,End            //               (falls off the end of a body)
+    ,Jump           // target
+    ,JumpIfFalse    // target msg    c ->
+    ,ShortCircuit   // op target     l -> l, jumping if l decides op
+
+    // Binary operators, in Op2 order:  l r -> l op r
+    ,Add
+    ,Sub
+    ,Mul
+    ,Div
+    ,Mod
+    ,LAnd
+    ,LOr
+    ,Lt
+    ,Lte
+    ,Gt
+    ,Gte
+    ,Eq
+
+    // Unary operators, in Op1 order:  v -> op v
+    ,Neg
+    ,LNot
+};
+
+inline Opcode opcodeFor(Op2 op) {
+    return (Opcode)((int32_t)Opcode::Add + (int32_t)op);
+}
+
+inline Opcode opcodeFor(Op1 op) {
+    return (Opcode)((int32_t)Opcode::Neg + (int32_t)op);
+}
+
+// A compiled function body (or the top-level program).
+class Proto {
+    public:
+    std::vector<int32_t> code;
+    std::vector<Value> constants;
+    // Messages, only needed to report errors
+    std::vector<std::string> strings;
+    std::vector<ELambda*> lambdas;
+
+    std::vector<int> param_slots;
+    // The first slot after the params
+    int first_local;
+    int frame_size;
+    // See ELambda::isCaptured. Frames that can't be captured live on the VM
+    // stack instead of in a heap-allocated Env.
+    bool captured;
+    int max_stack;
+
+    Proto () {
+        first_local = 1;
+        frame_size = 0;
+        captured = true;
+        max_stack = 0;
+    }
+
+    ~Proto();
+};
+
+// Emits code into a Proto, keeping track of how deep the operand stack gets.
+class Compiler {
+    Proto *proto;
+    int depth;
+
+    void adjust(int effect) {
+        depth += effect;
+        if (depth > proto->max_stack)
+            proto->max_stack = depth;
+    }
+
+    public:
+    Compiler (Proto *p) {
+        proto = p;
+        depth = 0;
+    }
+
+    Proto *getProto() {
+        return proto;
+    }
+
+    int getDepth() {
+        return depth;
+    }
+
+    // Branches leave the stack at different depths while they are being
+    // compiled; the caller resets it where they join.
+    void setDepth(int d) {
+        depth = d;
+    }
+
+    void emit(Opcode op, int effect) {
+        proto->code.push_back((int32_t)op);
+        adjust(effect);
+    }
+
+    void emit(Opcode op, int32_t a, int effect) {
+        emit(op, effect);
+        proto->code.push_back(a);
+    }
+
+    void emit(Opcode op, int32_t a, int32_t b, int effect) {
+        emit(op, a, effect);
+        proto->code.push_back(b);
+    }
+
+    void emit(Opcode op, int32_t a, int32_t b, int32_t c, int effect) {
+        emit(op, a, b, effect);
+        proto->code.push_back(c);
+    }
+
+    // Whether this body's own bindings live on the VM stack. If so, its Env
+    // is the one it closed over, so every other depth is one less.
+    bool stackLocals() {
+        return !proto->captured;
+    }
+
+    // The index of the next instruction
+    int here() {
+        return proto->code.size();
+    }
+
+    // Points the jump operand at code[at] to the next instruction
+    void patch(int at) {
+        proto->code[at] = here();
+    }
+
+    int addConstant(Value v) {
+        proto->constants.push_back(v);
+        return proto->constants.size() - 1;
+    }
+
+    int addString(std::string s) {
+        proto->strings.push_back(s);
+        return proto->strings.size() - 1;
+    }
+
+    int addLambda(ELambda *l) {
+        proto->lambdas.push_back(l);
+        return proto->lambdas.size() - 1;
+    }
+};
+
+#endif
@@ -2,11 +2,84 @@
 #define SMALL_ENV_HPP
 
 #include <string>
-#include <map>
+#include <vector>
 
 #include "small_lang_forwards.h"
+#include "small_values.hpp"
 
-typedef std::string Id_t;
-typedef std::map<Id_t, Value*> Env;
+// One scope's bindings, indexed by the slots the resolver hands out, plus a
+// link to the enclosing scope. Slot 0 always holds the scope's return value.
+//
+// A frame is allocated once per call and shared, not copied: statements
+// bind into it in place, and closures keep a pointer to the frame they were
+// created in, so they see bindings made after them (which is what makes
+// recursion work).
+//
+// Frames that a closure can capture are made through the Heap and collected
+// like any other object; the rest are freed by whoever made them, when the
+// call returns.
+class Env : public HeapObject {
+    Env *parent;
+    std::vector<Value> slots;
+
+    public:
+    Env (Env *p, int size) : slots(size) {
+        parent = p;
+    }
+
+    // Makes a spent frame good as new, for a call that never escapes.
+    void reset(Env *p, int size) {
+        parent = p;
+        slots.assign(size, Value());
+    }
+
+    // Adds null slots up to size, for a top level that more statements are
+    // added to; see AST::extend. The heap keeps counting the frame at the
+    // size it was made.
+    void grow(int size) {
+        if (size > (int)slots.size())
+            slots.resize(size);
+    }
+
+    Env *getParent() {
+        return parent;
+    }
+
+    int size() {
+        return slots.size();
+    }
+
+    Value get(int slot) {
+        return slots[slot];
+    }
+
+    void set(int slot, Value v) {
+        slots[slot] = v;
+        Heap::instance.shade(v);
+    }
+
+    // The binding at (depth, slot), as computed by the resolver.
+    Value lookup(int depth, int slot) {
+        Env *env = this;
+        while (depth-- > 0)
+            env = env->parent;
+        return env->slots[slot];
+    }
+
+    bool hasReturned() {
+        return !slots[0].isNull();
+    }
+
+    virtual void trace(Heap &heap) {
+        heap.mark(parent);
+        for (std::vector<Value>::iterator it = slots.begin(); it != slots.end(); ++it) {
+            heap.mark(*it);
+        }
+    }
+
+    virtual size_t footprint() {
+        return sizeof(Env) + slots.capacity() * sizeof(Value);
+    }
+};
 
 #endif
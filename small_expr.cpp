@@ -1,118 +1,227 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <utility>
 
 #include "small_expr.hpp"
 #include "small_values.hpp"
 #include "small_env.hpp"
-
-EId::EId (std::string name) {
+#include "small_scope.hpp"
+#include "small_stmt.hpp"
+#include "small_ops.hpp"
+#include "small_bytecode.hpp"
+#include "small_fold.hpp"
+#include "small_heap.hpp"
+#include "small_llvm.hpp"
+#include "small_jit.hpp"
+#include "small_builtins.hpp"
+#include "small_kernel.hpp"
+#include "small_memo.hpp"
+#include "small_profile.hpp"
+#include "small_stats.hpp"
+
+JitType Expr::jit(Jit *) {
+    return JitType::None;
+}
+
+bool Expr::kernel(Kernel *k) {
+    Value v;
+    return constant(v) && k->constant(v);
+}
+
+EId::EId (Symbol name) {
     id = name;
+    depth = -1;
+    slot = 0;
+    builtin = NULL;
 }
 
-EId::EId (const char* name) {
-    id = std::string(name);
+EId::EId (Symbol name, int d, int s, VBuiltin *b) {
+    id = name;
+    depth = d;
+    slot = s;
+    builtin = b;
 }
 
-EId::EId (const EId &other) {
-    id = other.id;
+std::string EId::toString() {
+    return id.getName();
+}
+
+Value EId::evaluate(Env *env) {
+    if (builtin != NULL)
+        return Value::fromObject(builtin);
+    if (depth < 0)
+        throw "Unbound variable: " + id.getName();
+
+    Value v = env->lookup(depth, slot);
+    if (v.isNull())
+        throw "Variable used before assignment: " + id.getName();
+    return v;
+}
+
+Expr *EId::resolve(Scope *scope) {
+    int d, s = 0;
+    VBuiltin *b = NULL;
+    if (!scope->lookup(id, d, s)) {
+        d = -1;
+        s = 0;
+        b = VBuiltin::find(id);
+        if (b == NULL)
+            scope->bindLate(id, d, s);
+    }
+    return scope->getArena()->intern<EId>(id, d, s, b);
 }
 
-EId::~EId() {}
+void EId::compile(Compiler *c) {
+    if (builtin != NULL) {
+        c->emit(Opcode::Const, c->addConstant(Value::fromObject(builtin)), 1);
+        return;
+    }
+    if (depth < 0) {
+        c->emit(Opcode::LoadUnbound, id.getId(), 1);
+        return;
+    }
 
-Expr *EId::clone() {
-    return new EId(*this);
+    if (c->stackLocals() && depth == 0) {
+        c->emit(Opcode::LoadSlot, slot, id.getId(), 1);
+        return;
+    }
+
+    int d = c->stackLocals() ? depth - 1 : depth;
+    if (d == 0)
+        c->emit(Opcode::LoadLocal, slot, id.getId(), 1);
+    else
+        c->emit(Opcode::Load, d, slot, id.getId(), 1);
 }
 
-std::string EId::toString() {
-    return id;
+// Compiled code only calls builtins by name; see EApp::emitIR
+std::string EId::emitIR(IRGen *g) {
+    if (builtin != NULL) {
+        g->reject("builtin " + id.getName() + " used as a value");
+        return "0";
+    }
+    if (depth < 0) {
+        g->fail("Unbound variable: " + id.getName());
+        return "0";
+    }
+
+    std::string v = g->lookup(depth, slot);
+    std::string unbound = g->reg();
+    g->emit(unbound + " = icmp eq i64 " + v + ", 0");
+    g->failIf(unbound, "Variable used before assignment: " + id.getName());
+    return v;
 }
 
-Value *EId::evaluate(Env env) {
-    return env.at(id);
+JitType EId::jit(Jit *j) {
+    if (depth < 0)
+        return JitType::None;
+    return j->load(depth, slot);
 }
 
+bool EId::jitSelf(Jit *j) {
+    return depth >= 0 && j->isSelf(depth, slot);
+}
 
-EInt::EInt (int v) {
-    value = v;
+bool EId::kernel(Kernel *k) {
+    return depth >= 0 && k->load(depth, slot, id);
 }
 
-EInt::EInt (const EInt &other) {
-    value = other.value;
+// A top-level name bound to a literal before this point reads as that literal
+Expr *EId::fold(Folder *f) {
+    if (depth < 0 || !f->isGlobal(depth))
+        return this;
+    Expr *lit = f->literal(f->global(slot));
+    return lit != NULL ? lit : this;
 }
 
-EInt::~EInt() {}
 
-Expr *EInt::clone() {
-    return new EInt(*this);
+EInt::EInt (int v) {
+    value = v;
 }
 
 std::string EInt::toString() {
     return std::to_string(value);
 }
 
-Value *EInt::evaluate(Env env) {
-    return new VInt(value);
+Value EInt::evaluate(Env *env) {
+    return Value::fromInt(value);
 }
 
+void EInt::compile(Compiler *c) {
+    c->emit(Opcode::Const, c->addConstant(Value::fromInt(value)), 1);
+}
 
-EFloat::EFloat (float v) {
-    value = v;
+std::string EInt::emitIR(IRGen *g) {
+    return IRGen::word(Value::fromInt(value));
+}
+
+JitType EInt::jit(Jit *j) {
+    return j->constant(Value::fromInt(value));
 }
 
-EFloat::EFloat (const EFloat &other) {
-    value = other.value;
+bool EInt::constant(Value &v) {
+    v = Value::fromInt(value);
+    return true;
 }
 
-EFloat::~EFloat() {}
 
-Expr *EFloat::clone() {
-    return new EFloat(*this);
+EFloat::EFloat (float v) {
+    value = v;
 }
 
 std::string EFloat::toString() {
     return std::to_string(value);
 }
 
-Value *EFloat::evaluate(Env env) {
-    return new VFloat(value);
+Value EFloat::evaluate(Env *env) {
+    return Value::fromFloat(value);
 }
 
+void EFloat::compile(Compiler *c) {
+    c->emit(Opcode::Const, c->addConstant(Value::fromFloat(value)), 1);
+}
 
-EBool::EBool (bool b) {
-    value = b;
+std::string EFloat::emitIR(IRGen *g) {
+    return IRGen::word(Value::fromFloat(value));
 }
 
-EBool::EBool (const EBool &other) {
-    value = other.value;
+bool EFloat::constant(Value &v) {
+    v = Value::fromFloat(value);
+    return true;
 }
 
-EBool::~EBool() {}
 
-Expr *EBool::clone() {
-    return new EBool(*this);
+EBool::EBool (bool b) {
+    value = b;
 }
 
 std::string EBool::toString() {
     return value ? "true" : "false";
 }
 
-Value *EBool::evaluate(Env env) {
-    return new VBool(value);
+Value EBool::evaluate(Env *env) {
+    return Value::fromBool(value);
 }
 
-EChar::EChar (char c) {
-    value = c;
+void EBool::compile(Compiler *c) {
+    c->emit(Opcode::Const, c->addConstant(Value::fromBool(value)), 1);
 }
 
-EChar::EChar (const EChar &other) {
-    value = other.value;
+std::string EBool::emitIR(IRGen *g) {
+    return IRGen::word(Value::fromBool(value));
 }
 
-EChar::~EChar() {}
+JitType EBool::jit(Jit *j) {
+    return j->constant(Value::fromBool(value));
+}
 
-Expr *EChar::clone() {
-    return new EChar(*this);
+bool EBool::constant(Value &v) {
+    v = Value::fromBool(value);
+    return true;
+}
+
+EChar::EChar (char c) {
+    value = c;
 }
 
 // TODO: Print 'c', '\xNN', '\'' depending!
@@ -120,60 +229,68 @@ std::string EChar::toString() {
     return std::string(1, value);
 }
 
-Value *EChar::evaluate(Env env) {
-    return new VChar(value);
+Value EChar::evaluate(Env *env) {
+    return Value::fromChar(value);
 }
 
+void EChar::compile(Compiler *c) {
+    c->emit(Opcode::Const, c->addConstant(Value::fromChar(value)), 1);
+}
 
-EString::EString (std::string v) {
+std::string EChar::emitIR(IRGen *g) {
+    return IRGen::word(Value::fromChar(value));
+}
+
+bool EChar::constant(Value &v) {
+    v = Value::fromChar(value);
+    return true;
+}
+
+
+EString::EString (std::string_view v) {
     value = v;
 }
 
-EString::EString (const char* str) {
-    value = std::string(str);
+EString::EString (std::string v) {
+    owned = v;
+    value = owned;
 }
 
-EString::EString (const EString &other) {
-    value = other.value;
+std::string EString::toString() {
+    return std::string(value);
 }
 
-EString::~EString() {}
+Value EString::evaluate(Env *env) {
+    return Value::fromObject(Heap::instance.make<VString>(value));
+}
 
-Expr *EString::clone() {
-    return new EString(*this);
+void EString::compile(Compiler *c) {
+    c->emit(Opcode::Const, c->addConstant(Value::fromObject(new VString(value))), 1);
 }
 
-std::string EString::toString() {
-    return value;
+std::string EString::emitIR(IRGen *g) {
+    std::string v = g->reg();
+    g->emit(v + " = call i64 @smol_string(i8* " + g->constant(std::string(value)) +
+        ", i64 " + std::to_string(value.size()) + ")");
+    return v;
 }
 
-Value *EString::evaluate(Env env) {
-    return new VString(value);
+bool EString::constant(Value &v) {
+    v = evaluate(NULL);
+    return true;
 }
 
 
 EList::EList () {}
 
 EList::EList (std::vector<Expr*> l) {
-    value = std::vector<Expr*>(l);
+    value = l;
 }
 
 EList::EList (Expr *e) {
     value.push_back(e);
 }
 
-EList::EList (const EList &other) {
-    value = std::vector<Expr*>(other.value);
-}
-
-EList::~EList() {
-    delete &value;
-}
-
-Expr *EList::clone() {
-    return new EList(*this);
-}
-
 std::string EList::toString() {
     std::stringstream str;
     str << "[";
@@ -187,33 +304,65 @@ std::string EList::toString() {
     return str.str();
 }
 
-Value *EList::evaluate(Env env) {
-    std::vector<Value*> vlist;
+Value EList::evaluate(Env *env) {
+    Roots roots;
+    std::vector<Value> vlist;
     for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
         vlist.push_back((*it)->evaluate(env));
+        roots.push(vlist.back());
     }
-    return new VList(vlist);
+    return Value::fromObject(Heap::instance.make<VList>(vlist));
 }
 
+Expr *EList::resolve(Scope *scope) {
+    std::vector<Expr*> items;
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        items.push_back((*it)->resolve(scope));
+    }
+    return scope->getArena()->intern<EList>(items);
+}
 
-ETuple::ETuple() { size = 0; }
-
-ETuple::ETuple (std::vector<Expr*> l) {
-    value = std::vector<Expr*>(l);
-    size = l.size();
+void EList::compile(Compiler *c) {
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        (*it)->compile(c);
+    }
+    c->emit(Opcode::MakeList, value.size(), 1 - (int)value.size());
 }
 
-ETuple::ETuple (const ETuple &other) {
-    value = other.value;
-    size = other.size;
+// The items go in adjacent temporaries, which the runtime reads them from
+std::string EList::emitIR(IRGen *g) {
+    int first = -1;
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        std::string item = (*it)->emitIR(g);
+        int t = g->pushTemp();
+        g->store(t, item);
+        if (first < 0)
+            first = t;
+    }
+
+    std::string items = first < 0 ? "null" : g->temp(first);
+    std::string v = g->reg();
+    g->emit(v + " = call i64 @smol_list(i64* " + items + ", i32 " + std::to_string(value.size()) + ")");
+    g->popTemps(value.size());
+    return v;
 }
 
-ETuple::~ETuple() {
-    delete &value;
+Expr *EList::fold(Folder *f) {
+    std::vector<Expr*> items;
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        items.push_back(f->fold(*it));
+    }
+    if (items == value)
+        return this;
+    return f->getArena()->intern<EList>(items);
 }
 
-Expr *ETuple::clone() {
-    return new ETuple(*this);
+
+ETuple::ETuple() { size = 0; }
+
+ETuple::ETuple (std::vector<Expr*> l) {
+    value = l;
+    size = l.size();
 }
 
 std::string ETuple::toString() {
@@ -228,121 +377,436 @@ std::string ETuple::toString() {
     return str.str();
 }
 
-Value *ETuple::evaluate(Env env) {
-    std::vector<Value*> vlist;
+Value ETuple::evaluate(Env *env) {
+    Roots roots;
+    std::vector<Value> vlist;
     for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
         vlist.push_back((*it)->evaluate(env));
+        roots.push(vlist.back());
     }
-    return new VList(vlist);
+    return Value::fromObject(Heap::instance.make<VTuple>(vlist));
 }
 
+Expr *ETuple::resolve(Scope *scope) {
+    std::vector<Expr*> items;
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        items.push_back((*it)->resolve(scope));
+    }
+    return scope->getArena()->intern<ETuple>(items);
+}
 
-EOp2::EOp2 (Op2 o, Expr *l, Expr *r) {
-    op = o;
-    left = l->clone();
-    right = r->clone();
+void ETuple::compile(Compiler *c) {
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        (*it)->compile(c);
+    }
+    c->emit(Opcode::MakeTuple, value.size(), 1 - (int)value.size());
 }
 
-EOp2::EOp2 (const EOp2 &other) {
-    op = other.op;
-    left = other.left->clone();
-    right = other.right->clone();
+std::string ETuple::emitIR(IRGen *g) {
+    int first = -1;
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        std::string item = (*it)->emitIR(g);
+        int t = g->pushTemp();
+        g->store(t, item);
+        if (first < 0)
+            first = t;
+    }
+
+    std::string items = first < 0 ? "null" : g->temp(first);
+    std::string v = g->reg();
+    g->emit(v + " = call i64 @smol_tuple(i64* " + items + ", i32 " + std::to_string(value.size()) + ")");
+    g->popTemps(value.size());
+    return v;
 }
 
-EOp2::~EOp2() {
-    delete left;
-    delete right;
+Expr *ETuple::fold(Folder *f) {
+    std::vector<Expr*> items;
+    for (std::vector<Expr*>::iterator it = value.begin(); it != value.end(); ++it) {
+        items.push_back(f->fold(*it));
+    }
+    if (items == value)
+        return this;
+    return f->getArena()->intern<ETuple>(items);
 }
 
-Expr *EOp2::clone() {
-    return new EOp2(*this);
+
+EOp2::EOp2 (Op2 o, Expr *l, Expr *r) : cache(OpCache::Uninit) {
+    op = o;
+    left = l;
+    right = r;
 }
 
 std::string EOp2::toString() {
     return left->toString() + Op2Strings[(int)op] + right->toString();
 }
 
+Value EOp2::evaluate(Env *env) {
+    Value l = left->evaluate(env);
 
-EOp1::EOp1 (Op1 o, Expr *x) {
-    op = o;
-    e = x->clone();
+    // && and || only evaluate the right side when they have to
+    if ((op == Op2::LAnd || op == Op2::LOr) && l.isBool()) {
+        if (l.asBool() == (op == Op2::LOr))
+            return l;
+    }
+
+    Value r, res;
+    if (!l.isObject()) {
+        r = right->evaluate(env);
+    } else {
+        // l has to survive anything the right side allocates
+        Roots roots;
+        roots.push(l);
+        r = right->evaluate(env);
+    }
+
+    switch (cache.load(std::memory_order_relaxed)) {
+        case OpCache::Int:
+            if (l.isInt() && r.isInt() && intOp2(op, l.asInt(), r.asInt(), res))
+                return res;
+            break;
+        case OpCache::Float:
+            if ((l.isFloat() || r.isFloat()) && l.isNumber() && r.isNumber() &&
+                    floatOp2(op, l.toFloat(), r.toFloat(), res))
+                return res;
+            break;
+        case OpCache::Bool:
+            if (l.isBool() && r.isBool() && boolOp2(op, l.asBool(), r.asBool(), res))
+                return res;
+            break;
+        case OpCache::String:
+            if (l.is(ObjKind::String) && r.is(ObjKind::String) &&
+                    stringOp2(op, l.as<VString>(), r.as<VString>(), res))
+                return res;
+            break;
+        case OpCache::Generic:
+            return evalOp2(op, l, r);
+        case OpCache::Uninit:
+            break;
+    }
+    return miss(l, r);
+}
+
+// The operands didn't fit the cache: specialize on them if this is the
+// node's first evaluation, otherwise give up on specializing. Operands that
+// fit but failed (like a division by zero) leave the cache as it is.
+Value EOp2::miss(Value l, Value r) {
+    OpCache seen = classifyOp2(op, l, r);
+    OpCache current = cache.load(std::memory_order_relaxed);
+    if (current == OpCache::Uninit)
+        cache.store(seen, std::memory_order_relaxed);
+    else if (current != seen)
+        cache.store(OpCache::Generic, std::memory_order_relaxed);
+    return evalOp2(op, l, r);
 }
 
-EOp1::EOp1 (const EOp1 &other) {
-    op = other.op;
-    e = other.e->clone();
+Expr *EOp2::resolve(Scope *scope) {
+    Expr *l = left->resolve(scope);
+    Expr *r = right->resolve(scope);
+    return scope->getArena()->intern<EOp2>(op, l, r);
 }
 
-EOp1::~EOp1() {
-    delete e;
+void EOp2::compile(Compiler *c) {
+    left->compile(c);
+
+    int skip = -1;
+    if (op == Op2::LAnd || op == Op2::LOr) {
+        c->emit(Opcode::ShortCircuit, (int32_t)op, 0, 0);
+        skip = c->here() - 1;
+    }
+
+    right->compile(c);
+    c->emit(opcodeFor(op), -1);
+
+    if (skip >= 0)
+        c->patch(skip);
 }
 
-Expr *EOp1::clone() {
-    return new EOp1(*this);
+std::string EOp2::emitIR(IRGen *g) {
+    std::string l = left->emitIR(g);
+    std::vector<std::pair<std::string, std::string> > in;
+    std::string done;
+
+    // && and || only evaluate the right side when they have to
+    if (op == Op2::LAnd || op == Op2::LOr) {
+        std::string decided = g->reg(), rest = g->label();
+        done = g->label();
+        g->emit(decided + " = icmp eq i64 " + l + ", " + IRGen::word(Value::fromBool(op == Op2::LOr)));
+        in.push_back(std::make_pair(l, g->currentBlock()));
+        g->branch(decided, done, rest);
+        g->block(rest);
+    }
+
+    int t = g->pushTemp();
+    g->store(t, l);
+    std::string r = right->emitIR(g);
+    g->popTemps(1);
+    std::string res = g->op2(op, l, r);
+    if (done.empty())
+        return res;
+
+    in.push_back(std::make_pair(res, g->currentBlock()));
+    g->jump(done);
+    g->block(done);
+    return g->phi(in);
+}
+
+JitType EOp2::jit(Jit *j) {
+    JitType l = left->jit(j);
+
+    // && and || jump over the right side when the left decides
+    if (op == Op2::LAnd || op == Op2::LOr) {
+        if (l != JitType::Bool)
+            return JitType::None;
+        int done = j->label();
+        if (op == Op2::LAnd)
+            j->jumpIfFalse(done);
+        else
+            j->jumpIfTrue(done);
+        JitType r = right->jit(j);
+        j->bind(done);
+        return r == JitType::Bool ? r : JitType::None;
+    }
+
+    if (l == JitType::None)
+        return JitType::None;
+    j->push();
+    JitType r = right->jit(j);
+    if (r == JitType::None)
+        return JitType::None;
+    j->popRight();
+    return j->op2(op, l, r);
+}
+
+bool EOp2::kernel(Kernel *k) {
+    if (!left->kernel(k))
+        return false;
+
+    int done = -1;
+    if (op == Op2::LAnd || op == Op2::LOr)
+        done = k->shortCircuit(op);
+    if (!right->kernel(k))
+        return false;
+    k->op2(op);
+    if (done >= 0)
+        k->patch(done);
+    return true;
+}
+
+// The right side of && and || might not be evaluated
+Expr *EOp2::fold(Folder *f) {
+    Expr *l = f->fold(left);
+    bool branch = op == Op2::LAnd || op == Op2::LOr;
+    if (branch)
+        f->enterBranch();
+    Expr *r = f->fold(right);
+    if (branch)
+        f->leaveBranch();
+    Expr *folded = f->foldOp2(op, l, r);
+    if (folded != NULL)
+        return folded;
+    if (l == left && r == right)
+        return this;
+    return f->getArena()->intern<EOp2>(op, l, r);
+}
+
+
+EOp1::EOp1 (Op1 o, Expr *x) : cache(OpCache::Uninit) {
+    op = o;
+    e = x;
 }
 
 std::string EOp1::toString() {
     return Op1Strings[(int)op] + e->toString();
 }
 
-Value *EOp1::evaluate(Env env) {
+Value EOp1::evaluate(Env *env) {
+    Value v = e->evaluate(env);
+    switch (cache.load(std::memory_order_relaxed)) {
+        case OpCache::Int:
+            if (v.isInt())
+                return Value::fromInt((int32_t)(0u - (uint32_t)v.asInt()));
+            break;
+        case OpCache::Float:
+            if (v.isFloat())
+                return Value::fromFloat(-v.asFloat());
+            break;
+        case OpCache::Bool:
+            if (v.isBool())
+                return Value::fromBool(!v.asBool());
+            break;
+        case OpCache::Generic:
+            return evalOp1(op, v);
+        default:
+            break;
+    }
+    return miss(v);
+}
 
+Value EOp1::miss(Value v) {
+    OpCache seen = classifyOp1(op, v);
+    OpCache current = cache.load(std::memory_order_relaxed);
+    if (current == OpCache::Uninit)
+        cache.store(seen, std::memory_order_relaxed);
+    else if (current != seen)
+        cache.store(OpCache::Generic, std::memory_order_relaxed);
+    return evalOp1(op, v);
 }
 
+Expr *EOp1::resolve(Scope *scope) {
+    return scope->getArena()->intern<EOp1>(op, e->resolve(scope));
+}
 
-ELambda::ELambda (std::vector<char*> ids, Statement *b) {
-    for (std::vector<char*>::iterator it = ids.begin(); it != ids.end(); ++it) {
-        params.push_back(std::string(*it));
-    }
-    body = b->clone();
+void EOp1::compile(Compiler *c) {
+    e->compile(c);
+    c->emit(opcodeFor(op), 0);
 }
 
-ELambda::ELambda (const ELambda &other) {
-    params = std::vector<std::string>(other.params);
-    body = other.body->clone();
+std::string EOp1::emitIR(IRGen *g) {
+    return g->op1(op, e->emitIR(g));
 }
 
-ELambda::~ELambda() {
-    delete &params;
-    delete body;
+JitType EOp1::jit(Jit *j) {
+    JitType t = e->jit(j);
+    if (t == JitType::None)
+        return JitType::None;
+    return j->op1(op, t);
+}
+
+bool EOp1::kernel(Kernel *k) {
+    if (!e->kernel(k))
+        return false;
+    k->op1(op);
+    return true;
+}
+
+Expr *EOp1::fold(Folder *f) {
+    Expr *x = f->fold(e);
+    Expr *folded = f->foldOp1(op, x);
+    if (folded != NULL)
+        return folded;
+    if (x == e)
+        return this;
+    return f->getArena()->intern<EOp1>(op, x);
+}
+
+
+ELambda::ELambda (std::vector<Symbol> ids, Statement *b, int l, int c) {
+    params = ids;
+    body = b;
+    frame_size = 0;
+    captured = true;
+    proto = NULL;
+    kernel = NULL;
+    kernel_compiled = false;
+    line = l;
+    column = c;
+    named = false;
+}
+
+ELambda::ELambda (Symbol n, std::vector<Symbol> ids, Statement *b, int l, int c) : ELambda(ids, b, l, c) {
+    name = n;
+    named = true;
 }
 
-Expr *ELambda::clone() {
-    return new ELambda(*this);
+ELambda::~ELambda() {
+    delete proto;
+    delete kernel;
 }
 
 std::string ELambda::toString() {
     std::stringstream str;
     str << "(\\ ";
-    for (std::vector<std::string>::iterator it = params.begin(); it != params.end(); ++it) {
-        str << *it << " ";
+    for (std::vector<Symbol>::iterator it = params.begin(); it != params.end(); ++it) {
+        str << it->getName() << " ";
     }
     str << "-> " << body->toString() << ")";
     return str.str();
 }
 
-Value *ELambda::evaluate(Env env) {
-    return new VClos(*this, env);
+Value ELambda::evaluate(Env *env) {
+    return Value::fromObject(Heap::instance.make<VClos>(this, env));
 }
 
+// The body gets a fresh scope: slot 0 is the return value, then the params,
+// then every name the body assigns. Names are declared before the body is
+// resolved so functions can refer to themselves and to later locals. A
+// lambda is never shared, so it's resolved where it is.
+Expr *ELambda::resolve(Scope *scope) {
+    Scope inner(scope);
 
-EApp::EApp (Expr *f, std::vector<Expr*> as) {
-    func = f->clone();
-    args = std::vector<Expr*>(as);
+    param_slots.clear();
+    for (std::vector<Symbol>::iterator it = params.begin(); it != params.end(); ++it) {
+        param_slots.push_back(inner.declare(*it));
+    }
+
+    body->declare(&inner);
+    body->resolve(&inner);
+    body->markTail(scope->getArena());
+    frame_size = inner.size();
+    captured = inner.isCaptured();
+    return this;
 }
 
-EApp::EApp (const EApp &other) {
-    func = other.func->clone();
-    args = std::vector<Expr*>(other.args);
+void ELambda::compile(Compiler *c) {
+    getProto();
+    c->emit(Opcode::Closure, c->addLambda(this), 1);
 }
 
-EApp::~EApp() {
-    delete func;
-    delete &args;
+std::string ELambda::emitIR(IRGen *g) {
+    return g->closure(g->lambda(this), params.size(), toString());
 }
 
-Expr *EApp::clone() {
-    return new EApp(*this);
+Expr *ELambda::fold(Folder *f) {
+    f->enter(this);
+    body->fold(f);
+    f->leave();
+    return this;
+}
+
+std::string ELambda::getName() {
+    if (named)
+        return name.getName();
+    return "lambda@" + std::to_string(line) + ":" + std::to_string(column);
+}
+
+Proto *ELambda::getProto() {
+    if (proto != NULL)
+        return proto;
+
+    proto = new Proto();
+    proto->param_slots = param_slots;
+    for (std::vector<int>::iterator it = param_slots.begin(); it != param_slots.end(); ++it) {
+        if (*it >= proto->first_local)
+            proto->first_local = *it + 1;
+    }
+    proto->frame_size = frame_size;
+    proto->captured = captured;
+
+    Compiler body_compiler(proto);
+    body->compile(&body_compiler);
+    body_compiler.emit(Opcode::End, 0);
+    return proto;
+}
+
+Kernel *ELambda::getKernel() {
+    if (!kernel_compiled) {
+        kernel = Kernel::compile(this);
+        kernel_compiled = true;
+    }
+    return kernel;
+}
+
+
+EApp::EApp (Expr *f, std::vector<Expr*> as) {
+    func = f;
+    args = as;
+    tail = false;
+}
+
+EApp::EApp (Expr *f, std::vector<Expr*> as, bool t) {
+    func = f;
+    args = as;
+    tail = t;
 }
 
 std::string EApp::toString() {
@@ -357,58 +821,372 @@ std::string EApp::toString() {
     return str.str();
 }
 
-Value *EApp::evaluate(Env env) {
-    // Get the evaluated lambda
-    VClos *clos = dynamic_cast<VClos*>(func->evaluate(env));
+int EApp::call_budget = -1;
 
-    if (clos == NULL)
-        throw "App: LHS did not eval to function";
+// A tail call on its way back to the trampoline in EApp::call: the closure,
+// and its frame with the arguments already bound. A spent frame is kept too,
+// so a loop written as tail recursion allocates nothing per iteration.
+struct PendingCall {
+    VClos *clos;
+    Env *frame;
+    Env *spare;
+};
+
+static thread_local PendingCall pending = {NULL, NULL, NULL};
+
+// Done with a frame nothing can have captured
+static void recycle(Env *frame) {
+    if (pending.spare == NULL)
+        pending.spare = frame;
+    else
+        delete frame;
+}
+
+// Recycles the frame of a call to a lambda that can't be captured, however
+// the call ends, unless it's released first. Frames that can be captured
+// belong to the heap.
+class OwnedFrame {
+    Env *frame;
+
+    public:
+    OwnedFrame (ELambda *lambda, Env *f) {
+        frame = lambda->isCaptured() ? NULL : f;
+    }
+
+    ~OwnedFrame() {
+        if (frame != NULL)
+            recycle(frame);
+    }
+
+    OwnedFrame (const OwnedFrame &) = delete;
+
+    OwnedFrame &operator=(const OwnedFrame &) = delete;
+
+    // Recycles the frame now, and owns f instead.
+    void replace(ELambda *lambda, Env *f) {
+        if (frame != NULL)
+            recycle(frame);
+        frame = lambda->isCaptured() ? NULL : f;
+    }
 
-    std::vector<std::string> params = clos->getLambda()->getParams();
+    // Hands the frame on, to whoever makes the call.
+    void release() {
+        frame = NULL;
+    }
+};
+
+// Counts a call against the budget, if there is one.
+static void charge() {
+    if (EApp::call_budget >= 0) {
+        if (EApp::call_budget == 0)
+            throw "App: call budget exhausted";
+        EApp::call_budget--;
+    }
+}
 
-    // Add the param => arg mapping to the env
-    if (params.length != args.length)
+// The closure f is, or NULL for a builtin, once it's checked to take n
+// arguments. The folder only runs builtins whose work is bounded.
+static VClos *callable(Value f, size_t n) {
+    if (f.is(ObjKind::Builtin)) {
+        if (f.as<VBuiltin>()->getArity() != (int)n)
+            throw "App: params and args length mismatch";
+        if (EApp::call_budget >= 0 && !f.as<VBuiltin>()->isBounded())
+            throw "App: builtin left for runtime";
+        return NULL;
+    }
+    if (!f.is(ObjKind::Closure))
+        throw "App: LHS did not eval to function";
+
+    VClos *clos = f.as<VClos>();
+    if (clos->getLambda()->getParamSlots().size() != n)
         throw "App: params and args length mismatch";
+    return clos;
+}
 
-    std::vector<std::string>::iterator params_iter = params.begin();
-    std::vector<Expr*>::iterator args_iter = args.begin();
+// Evaluates the function and checks it takes this many arguments.
+VClos *EApp::callee(Env *env, Value &f) {
+    charge();
+    f = func->evaluate(env);
+    return callable(f, args.size());
+}
 
-    Env env_copy = env;
+// A builtin runs straight away, in tail position too.
+Value EApp::callBuiltin(Env *env, Value f) {
+    Roots roots;
+    std::vector<Value> values;
+    for (std::vector<Expr*>::iterator it = args.begin(); it != args.end(); ++it) {
+        values.push_back((*it)->evaluate(env));
+        roots.push(values.back());
+    }
+    return f.as<VBuiltin>()->apply(values.data());
+}
+
+// The callee's frame hangs off the env it closed over. Only a frame a
+// closure might keep needs collecting; any other is freed or reused once
+// the call is done with it.
+Env *EApp::newFrame(VClos *clos) {
+    ELambda *lambda = clos->getLambda();
+    if (lambda->isCaptured())
+        return Heap::instance.make<Env>(clos->getEnv(), lambda->getFrameSize());
+
+    if (pending.spare != NULL) {
+        Env *frame = pending.spare;
+        pending.spare = NULL;
+        frame->reset(clos->getEnv(), lambda->getFrameSize());
+        if (Stats::enabled)
+            Stats::instance.frame(frame->footprint(), true);
+        return frame;
+    }
+    Env *frame = new Env(clos->getEnv(), lambda->getFrameSize());
+    if (Stats::enabled)
+        Stats::instance.frame(frame->footprint(), false);
+    return frame;
+}
+
+Value EApp::evaluate(Env *env) {
+    return tail ? tailCall(env) : call(env);
+}
+
+// The closure and frame are rooted here only while the arguments are bound:
+// run() may replace the frame, so from then on it must be its only root.
+Value EApp::call(Env *env) {
+    VClos *clos;
+    Env *frame;
+    {
+        Roots roots;
+        Value f;
+        clos = callee(env, f);
+        if (clos == NULL)
+            return callBuiltin(env, f);
+        roots.push(f);
+
+        const std::vector<int> &slots = clos->getLambda()->getParamSlots();
+        frame = newFrame(clos);
+        OwnedFrame owned(clos->getLambda(), frame);
+        roots.push(frame);
+
+        for (size_t i = 0; i < args.size(); ++i) {
+            frame->set(slots[i], args[i]->evaluate(env));
+        }
+        owned.release();
+    }
+    return run(clos, frame);
+}
 
-    while(args_iter != args.end() && params_iter != params.end()) {
-        env_copy.insert({*paramsiter, (*args_iter)->evaluate(env)});
-        ++args_iter;
-        ++params_iter;
+Value EApp::apply(Value f, Value *values, size_t n) {
+    charge();
+    VClos *clos = callable(f, n);
+    if (clos == NULL)
+        return f.as<VBuiltin>()->apply(values);
+
+    // Binding doesn't allocate, so f need only be rooted while the frame
+    // is made
+    Env *frame;
+    {
+        Roots roots;
+        roots.push(f);
+        frame = newFrame(clos);
+    }
+    const std::vector<int> &slots = clos->getLambda()->getParamSlots();
+    for (size_t i = 0; i < n; ++i) {
+        frame->set(slots[i], values[i]);
+    }
+    return run(clos, frame);
+}
+
+// Runs the body of clos in frame, which has the arguments bound and which
+// this takes over, and the calls it ends in. Nothing else may root frame,
+// since a tail call replaces it.
+Value EApp::run(VClos *clos, Env *frame) {
+    Roots roots;
+    ELambda *lambda = clos->getLambda();
+    const std::vector<int> &slots = lambda->getParamSlots();
+    OwnedFrame owned(lambda, frame);
+    size_t clos_root = Heap::instance.height();
+    roots.push(clos);
+    size_t frame_root = Heap::instance.height();
+    roots.push(frame);
+
+    // With --profile, the call is timed from here until it's done
+    bool profile = Profiler::enabled && call_budget < 0;
+    ProfileScope profiled(profile, lambda);
+
+    // With --memo, a call made before is answered from the memo. Compiled
+    // code calls itself without coming back here, so then nothing runs
+    // compiled.
+    bool memo = Memo::enabled && call_budget < 0;
+    VClos *memo_clos = clos;
+    std::vector<Value> memo_args;
+    if (memo) {
+        // Rooted apart from the frame, which a tail call replaces
+        roots.push(memo_clos);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            memo_args.push_back(frame->get(slots[i]));
+            roots.push(memo_args.back());
+        }
+        Value res;
+        if (Memo::instance.find(clos, memo_args, res))
+            return res;
     }
 
-    Env res_env = body->evaluate(env_copy);
+    // A body that ends in a tail call comes back here with the next call
+    // instead of making it, so tail recursion runs in constant stack. Hot
+    // closures run compiled, unless the folder is counting calls.
+    Value res;
+    while (true) {
+        res = Value();
+        if (Jit::enabled && call_budget < 0 && !memo && !profile)
+            res = Jit::enter(clos, frame);
+        if (res.isNull()) {
+            lambda->getBody()->evaluate(frame);
+            res = frame->get(0);
+        }
+        if (!res.isTailCall())
+            break;
+
+        clos = pending.clos;
+        lambda = clos->getLambda();
+        frame = pending.frame;
+        owned.replace(lambda, frame);
+        if (profile)
+            Profiler::instance.replace(lambda);
+        Heap::instance.setRoot(clos_root, clos);
+        Heap::instance.setRoot(frame_root, frame);
+    }
 
-    if (res_env.count("return") == 0)
+    if (res.isNull())
         throw "App: Function had no return statement";
 
-    return res_env["return"];
+    if (memo)
+        Memo::instance.insert(memo_clos, memo_args, res);
+    return res;
 }
 
-EIf::EIf (Expr *c, Expr *t, Expr *f) {
-    cond = c->clone();
-    true_body = t->clone();
-    false_body = f->clone();
+// Evaluates the callee and arguments here, in the frame that is ending, and
+// leaves the new frame for the trampoline running this body.
+Value EApp::tailCall(Env *env) {
+    Roots roots;
+    Value f;
+    VClos *clos = callee(env, f);
+    if (clos == NULL)
+        return callBuiltin(env, f);
+    roots.push(f);
+
+    const std::vector<int> &slots = clos->getLambda()->getParamSlots();
+    Env *frame = newFrame(clos);
+    OwnedFrame owned(clos->getLambda(), frame);
+    roots.push(frame);
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        frame->set(slots[i], args[i]->evaluate(env));
+    }
+
+    pending.clos = clos;
+    pending.frame = frame;
+    owned.release();
+    return Value::tailCall();
 }
 
-EIf::EIf (const EIf &other) {
-    cond = other.cond->clone();
-    true_body = other.true_body->clone();
-    false_body = other.false_body->clone();
+Expr *EApp::resolve(Scope *scope) {
+    Expr *f = func->resolve(scope);
+    std::vector<Expr*> as;
+    for (std::vector<Expr*>::iterator it = args.begin(); it != args.end(); ++it) {
+        as.push_back((*it)->resolve(scope));
+    }
+    return scope->getArena()->intern<EApp>(f, as, tail);
 }
 
-EIf::~EIf() {
-    delete cond;
-    delete true_body;
-    delete false_body;
+void EApp::compile(Compiler *c) {
+    func->compile(c);
+    for (std::vector<Expr*>::iterator it = args.begin(); it != args.end(); ++it) {
+        (*it)->compile(c);
+    }
+    c->emit(tail ? Opcode::TailCall : Opcode::Call, args.size(), -(int)args.size());
+}
+
+// The callee and arguments are kept in temporaries until the call, since
+// evaluating each argument may allocate. A builtin's arguments go in
+// adjacent ones, like a list's items, and the runtime calls it on them.
+std::string EApp::emitIR(IRGen *g) {
+    EId *id = dynamic_cast<EId*>(func);
+    if (id != NULL && id->getBuiltin() != NULL) {
+        if (!id->getBuiltin()->isNative()) {
+            g->reject("builtin " + id->getBuiltin()->getName() + " needs the interpreter");
+            return "0";
+        }
+        int first = -1;
+        for (std::vector<Expr*>::iterator it = args.begin(); it != args.end(); ++it) {
+            std::string arg = (*it)->emitIR(g);
+            int t = g->pushTemp();
+            g->store(t, arg);
+            if (first < 0)
+                first = t;
+        }
+
+        std::string argv = first < 0 ? "null" : g->temp(first);
+        std::string v = g->reg();
+        g->emit(v + " = call i64 @smol_builtin(i32 " + std::to_string(id->getBuiltin()->getIndex()) +
+            ", i64* " + argv + ", i32 " + std::to_string(args.size()) + ")");
+        g->popTemps(args.size());
+        return v;
+    }
+
+    std::string f = func->emitIR(g);
+    g->store(g->pushTemp(), f);
+    std::string code = g->callee(f, args.size());
+
+    std::string list = "i64 " + f;
+    for (std::vector<Expr*>::iterator it = args.begin(); it != args.end(); ++it) {
+        std::string arg = (*it)->emitIR(g);
+        g->store(g->pushTemp(), arg);
+        list += ", i64 " + arg;
+    }
+
+    std::string res = "0";
+    if (tail && !g->atTopLevel())
+        g->tailCall(code, list);
+    else
+        res = g->call(code, list);
+    g->popTemps(args.size() + 1);
+    return res;
+}
+
+// Only calls to the closure being compiled, with the types it was compiled for
+JitType EApp::jit(Jit *j) {
+    if (!func->jitSelf(j) || (int)args.size() != j->arity())
+        return JitType::None;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i]->jit(j) != j->paramType(i))
+            return JitType::None;
+        j->push();
+    }
+    return j->call(tail);
 }
 
-Expr *EIf::clone() {
-    return new EIf(*this);
+Expr *EApp::markTail(NodeArena *arena) {
+    if (tail)
+        return this;
+    return arena->intern<EApp>(func, args, true);
+}
+
+Expr *EApp::fold(Folder *f) {
+    Expr *fn = f->fold(func);
+    std::vector<Expr*> as;
+    for (std::vector<Expr*>::iterator it = args.begin(); it != args.end(); ++it) {
+        as.push_back(f->fold(*it));
+    }
+    EApp *app = this;
+    if (fn != func || as != args)
+        app = f->getArena()->intern<EApp>(fn, as, tail);
+    Expr *folded = f->foldApp(app);
+    return folded != NULL ? folded : app;
+}
+
+EIf::EIf (Expr *c, Expr *t, Expr *f) {
+    cond = c;
+    true_body = t;
+    false_body = f;
 }
 
 std::string EIf::toString() {
@@ -417,14 +1195,120 @@ std::string EIf::toString() {
         " else " + false_body->toString();
 }
 
-Value *EIf::evaluate(Env env) {
-    VBool *c = dynamic_cast<VBool*>(cond->evaluate(env));
+Value EIf::evaluate(Env *env) {
+    Value c = cond->evaluate(env);
 
-    if (c == NULL)
+    if (!c.isBool())
         throw ("This language is NOT \"truthy\", and If-cond did not evaluate to bool: " + cond->toString());
 
-    if (c->getValue())
+    if (c.asBool())
         return true_body->evaluate(env);
     else
         return false_body->evaluate(env);
 }
+
+Expr *EIf::resolve(Scope *scope) {
+    Expr *c = cond->resolve(scope);
+    Expr *t = true_body->resolve(scope);
+    Expr *f = false_body->resolve(scope);
+    return scope->getArena()->intern<EIf>(c, t, f);
+}
+
+void EIf::compile(Compiler *c) {
+    cond->compile(c);
+    int msg = c->addString("This language is NOT \"truthy\", and If-cond did not evaluate to bool: " + cond->toString());
+    c->emit(Opcode::JumpIfFalse, 0, msg, -1);
+    int to_false = c->here() - 2;
+
+    int depth = c->getDepth();
+    true_body->compile(c);
+    c->emit(Opcode::Jump, 0, 0);
+    int to_end = c->here() - 1;
+
+    c->patch(to_false);
+    c->setDepth(depth);
+    false_body->compile(c);
+    c->patch(to_end);
+}
+
+// A branch that ended in a tail call has already returned, and doesn't
+// reach the join.
+std::string EIf::emitIR(IRGen *g) {
+    std::string c = g->truth(cond->emitIR(g),
+        "This language is NOT \"truthy\", and If-cond did not evaluate to bool: " + cond->toString());
+    std::string t = g->label(), f = g->label(), done = g->label();
+    g->branch(c, t, f);
+
+    std::vector<std::pair<std::string, std::string> > in;
+    g->block(t);
+    std::string tv = true_body->emitIR(g);
+    if (!g->isTerminated()) {
+        in.push_back(std::make_pair(tv, g->currentBlock()));
+        g->jump(done);
+    }
+
+    g->block(f);
+    std::string fv = false_body->emitIR(g);
+    if (!g->isTerminated()) {
+        in.push_back(std::make_pair(fv, g->currentBlock()));
+        g->jump(done);
+    }
+
+    if (in.empty())
+        return "0";
+    g->block(done);
+    return g->phi(in);
+}
+
+JitType EIf::jit(Jit *j) {
+    if (cond->jit(j) != JitType::Bool)
+        return JitType::None;
+
+    int other = j->label(), done = j->label();
+    j->jumpIfFalse(other);
+    JitType t = true_body->jit(j);
+    j->jump(done);
+    j->bind(other);
+    JitType f = false_body->jit(j);
+    j->bind(done);
+    return t == f ? t : JitType::None;
+}
+
+bool EIf::kernel(Kernel *k) {
+    if (!cond->kernel(k))
+        return false;
+    int other = k->branch("This language is NOT \"truthy\", and If-cond did not evaluate to bool: " + cond->toString());
+    if (!true_body->kernel(k))
+        return false;
+    int done = k->jump();
+    k->patch(other);
+    if (!false_body->kernel(k))
+        return false;
+    k->patch(done);
+    k->select();
+    return true;
+}
+
+// Only a literal condition says which branch runs
+Expr *EIf::fold(Folder *f) {
+    Expr *c = f->fold(cond);
+    Value v;
+    if (c->constant(v) && v.isBool())
+        return f->fold(v.asBool() ? true_body : false_body);
+
+    f->enterBranch();
+    Expr *t = f->fold(true_body);
+    Expr *e = f->fold(false_body);
+    f->leaveBranch();
+    if (c == cond && t == true_body && e == false_body)
+        return this;
+    return f->getArena()->intern<EIf>(c, t, e);
+}
+
+Expr *EIf::markTail(NodeArena *arena) {
+    Expr *t = true_body->markTail(arena);
+    Expr *f = false_body->markTail(arena);
+    if (t == true_body && f == false_body)
+        return this;
+    return arena->intern<EIf>(cond, t, f);
+}
@@ -1,13 +1,16 @@
 #ifndef SMALL_EXPR_HPP
 #define SMALL_EXPR_HPP
 
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "small_lang_forwards.h"
 #include "small_ops.hpp"
 #include "small_stmt.hpp"
 #include "small_env.hpp"
+#include "small_symbol.hpp"
 
 class Statement;
 
@@ -15,30 +18,91 @@ class Expr {
 	public:
     virtual ~Expr() {}
 
-    virtual Expr *clone() = 0;
-
     virtual std::string toString() = 0;
 
-    virtual Value *evaluate(Env) = 0;
+    virtual Value evaluate(Env *) = 0;
+
+    // Returns the node to use in place of this one once identifiers are
+    // bound to frame coordinates. Nodes are shared (see NodeArena::intern),
+    // so one with children gives a new node rather than changing itself.
+    // Literals have nothing to bind.
+    virtual Expr *resolve(Scope *) {
+        return this;
+    }
+
+    // Emits bytecode that leaves the expression's value on the stack.
+    virtual void compile(Compiler *) = 0;
+
+    // Emits LLVM IR computing the expression, and returns the i64 operand
+    // that holds its value.
+    virtual std::string emitIR(IRGen *) = 0;
+
+    // Returns the node to use in place of this one after constant folding:
+    // a literal, one of the children, or this node with its children folded,
+    // which is a new one if any of them changed. Children are folded through
+    // Folder::fold.
+    virtual Expr *fold(Folder *) {
+        return this;
+    }
+
+    // Literals give their value here.
+    virtual bool constant(Value &) {
+        return false;
+    }
+
+    // Returns the node to use as the result of a function body. Calls in
+    // tail position don't return to their caller, they replace it.
+    virtual Expr *markTail(NodeArena *) {
+        return this;
+    }
+
+    // Emits machine code for the expression and returns its type; see Jit.
+    // Nodes without a template give None, and keep the lambda interpreted.
+    virtual JitType jit(Jit *);
+
+    // Whether the expression names the closure being compiled.
+    virtual bool jitSelf(Jit *) {
+        return false;
+    }
+
+    // Adds the expression to a lambda's Kernel, or returns false if it
+    // can't be run over lanes. Literals are constants.
+    virtual bool kernel(Kernel *);
 };
 
 class EId : public Expr {
-    std::string id;
+    Symbol id;
+    // Filled in by resolve(); depth is -1 while the name is unbound, and
+    // then builtin is what it names, if anything.
+    int depth, slot;
+    VBuiltin *builtin;
 
     public:
-    EId (std::string);
+    EId (Symbol);
 
-    EId (const char*);
+    EId (Symbol, int depth, int slot, VBuiltin *);
 
-    EId (const EId &);
+    virtual std::string toString();
 
-    virtual ~EId();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
+
+    virtual JitType jit(Jit *);
 
-    virtual Value *evaluate(Env);
+    virtual bool jitSelf(Jit *);
+
+    virtual bool kernel(Kernel *);
+
+    virtual Expr *resolve(Scope *);
+
+    virtual Expr *fold(Folder *);
+
+    VBuiltin *getBuiltin() {
+        return builtin;
+    }
 };
 
 class EInt : public Expr {
@@ -47,15 +111,17 @@ class EInt : public Expr {
     public:
     EInt (int);
 
-    EInt (const EInt &);
+    virtual std::string toString();
 
-    virtual ~EInt();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
+
+    virtual JitType jit(Jit *);
 
-    virtual Value *evaluate(Env);
+    virtual bool constant(Value &);
 };
 
 class EFloat : public Expr {
@@ -64,15 +130,15 @@ class EFloat : public Expr {
     public:
     EFloat (float);
 
-    EFloat (const EFloat &);
+    virtual std::string toString();
 
-    virtual ~EFloat();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
 
-    virtual Value *evaluate(Env);
+    virtual bool constant(Value &);
 };
 
 class EBool : public Expr {
@@ -81,15 +147,17 @@ class EBool : public Expr {
     public:
     EBool (bool);
 
-    EBool (const EBool &);
+    virtual std::string toString();
+
+    virtual Value evaluate(Env *);
 
-    virtual ~EBool();
+    virtual void compile(Compiler *);
 
-    virtual Expr *clone();
+    virtual std::string emitIR(IRGen *);
 
-    virtual std::string toString();
+    virtual JitType jit(Jit *);
 
-    virtual Value *evaluate(Env);
+    virtual bool constant(Value &);
 };
 
 class EChar : public Expr {
@@ -98,34 +166,37 @@ class EChar : public Expr {
     public:
     EChar (char);
 
-    EChar (const EChar &);
+    virtual std::string toString();
 
-    virtual ~EChar();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
 
-    virtual Value *evaluate(Env);
+    virtual bool constant(Value &);
 };
 
+// A string literal from the source points into it; one made by folding
+// keeps its own copy.
 class EString : public Expr {
-    std::string value;
+    std::string_view value;
+    std::string owned;
 
     public:
-    EString (std::string);
+    EString (std::string_view);
 
-    EString (const char*);
+    EString (std::string);
 
-    EString (const EString &);
+    virtual std::string toString();
 
-    virtual ~EString();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
 
-    virtual Value *evaluate(Env);
+    virtual bool constant(Value &);
 };
 
 class EList : public Expr {
@@ -138,15 +209,17 @@ class EList : public Expr {
 
     EList (Expr *e);
 
-    EList (const EList &);
+    virtual std::string toString();
+
+    virtual Value evaluate(Env *);
 
-    virtual ~EList();
+    virtual void compile(Compiler *);
 
-    virtual Expr *clone();
+    virtual std::string emitIR(IRGen *);
 
-    virtual std::string toString();
+    virtual Expr *resolve(Scope *);
 
-    virtual Value *evaluate(Env);
+    virtual Expr *fold(Folder *);
 };
 
 class ETuple : public Expr {
@@ -158,95 +231,195 @@ class ETuple : public Expr {
 
     ETuple (std::vector<Expr*>);
 
-    ETuple (const ETuple &);
+    virtual std::string toString();
 
-    virtual ~ETuple();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
+
+    virtual Expr *resolve(Scope *);
 
-    virtual Value *evaluate(Env);
+    virtual Expr *fold(Folder *);
 };
 
+// Operators quicken: each node caches the operand types it has seen (see
+// OpCache) and, while they hold, skips straight to the matching fast path.
+// Identical sites share a node, and so a cache.
+// The cache is atomic only so concurrent evaluations can share the node.
 class EOp2 : public Expr {
     Expr *left, *right;
     Op2 op;
+    std::atomic<OpCache> cache;
+
+    Value miss(Value, Value);
 
     public:
     EOp2 (Op2, Expr *l, Expr *r);
 
-    EOp2 (const EOp2 &);
+    virtual std::string toString();
 
-    virtual ~EOp2();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
 
-    virtual Value *evaluate(Env);
+    virtual JitType jit(Jit *);
+
+    virtual bool kernel(Kernel *);
+
+    virtual Expr *resolve(Scope *);
+
+    virtual Expr *fold(Folder *);
 };
 
 class EOp1 : public Expr {
     Expr *e;
     Op1 op;
+    std::atomic<OpCache> cache;
+
+    Value miss(Value);
 
     public:
     EOp1 (Op1, Expr *x);
 
-    EOp1 (const EOp1 &);
+    virtual std::string toString();
 
-    virtual ~EOp1();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
 
-    virtual Value *evaluate(Env);
+    virtual JitType jit(Jit *);
+
+    virtual bool kernel(Kernel *);
+
+    virtual Expr *resolve(Scope *);
+
+    virtual Expr *fold(Folder *);
 };
 
 class ELambda : public Expr {
-    std::vector<std::string> params;
+    std::vector<Symbol> params;
     Statement *body;
+    std::vector<int> param_slots;
+    int frame_size;
+    bool captured;
+    Proto *proto;
+    Kernel *kernel;
+    bool kernel_compiled;
+    // Where the lambda starts in the source, and the name a func gave it
+    int line, column;
+    Symbol name;
+    bool named;
 
     public:
-    ELambda (std::vector<char*>, Statement *);
+    ELambda (std::vector<Symbol>, Statement *, int line, int column);
 
-    ELambda (const ELambda &);
+    // For a lambda written as func name ...
+    ELambda (Symbol name, std::vector<Symbol>, Statement *, int line, int column);
 
     virtual ~ELambda();
 
-    virtual Expr *clone();
-
     virtual std::string toString();
 
-    virtual Value *evaluate(Env);
+    virtual Value evaluate(Env *);
+
+    virtual void compile(Compiler *);
+
+    virtual std::string emitIR(IRGen *);
 
-    std::vector<std::string> getParams() {
+    virtual Expr *resolve(Scope *);
+
+    virtual Expr *fold(Folder *);
+
+    const std::vector<Symbol> &getParams() {
         return params;
     }
 
+    const std::vector<int> &getParamSlots() {
+        return param_slots;
+    }
+
+    int getFrameSize() {
+        return frame_size;
+    }
+
+    // Whether the body creates closures that may outlive a call's frame.
+    bool isCaptured() {
+        return captured;
+    }
+
+    // The compiled body, compiling it on first use.
+    Proto *getProto();
+
+    // The body as a Kernel, compiling it on first use, or NULL if it won't
+    // compile to one.
+    Kernel *getKernel();
+
     Statement *getBody() {
         return body;
     }
+
+    // The func's name, or where an anonymous lambda starts, as
+    // lambda@line:column.
+    std::string getName();
 };
 
 class EApp : public Expr {
     Expr *func;
     std::vector<Expr*> args;
+    bool tail;
+
+    VClos *callee(Env *, Value &f);
+
+    Value callBuiltin(Env *, Value f);
+
+    static Env *newFrame(VClos *);
+
+    Value tailCall(Env *);
+
+    static Value run(VClos *, Env *frame);
 
     public:
+    // Calls left before evaluation gives up, or -1 for no limit. Set while
+    // the folder evaluates ahead of time, so a call that never returns can't
+    // hang loading; builtins whose work isn't bounded give up at once.
+    static int call_budget;
+
     EApp (Expr *f, std::vector<Expr*>);
 
-    EApp (const EApp &);
+    EApp (Expr *f, std::vector<Expr*>, bool tail);
 
-    virtual ~EApp();
+    virtual std::string toString();
 
-    virtual Expr *clone();
+    virtual Value evaluate(Env *);
 
-    virtual std::string toString();
+    virtual void compile(Compiler *);
+
+    virtual std::string emitIR(IRGen *);
+
+    virtual JitType jit(Jit *);
+
+    virtual Expr *resolve(Scope *);
 
-    virtual Value *evaluate(Env);
+    virtual Expr *fold(Folder *);
+
+    virtual Expr *markTail(NodeArena *);
+
+    // Makes the call and returns its result, even in tail position.
+    Value call(Env *);
+
+    // Calls f, a closure or a builtin, on n arguments that are already
+    // values, as map and filter do the function they're given.
+    static Value apply(Value f, Value *args, size_t n);
+
+    const std::vector<Expr*> &getArgs() {
+        return args;
+    }
 };
 
 class EIf : public Expr {
@@ -257,15 +430,23 @@ class EIf : public Expr {
     public:
     EIf (Expr *c, Expr *t, Expr *f);
 
-    EIf (const EIf &);
+    virtual std::string toString();
 
-    virtual ~EIf();
+    virtual Value evaluate(Env *);
 
-    virtual Expr *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual std::string emitIR(IRGen *);
+
+    virtual JitType jit(Jit *);
+
+    virtual bool kernel(Kernel *);
+
+    virtual Expr *resolve(Scope *);
+
+    virtual Expr *fold(Folder *);
 
-    virtual Value *evaluate(Env);
+    virtual Expr *markTail(NodeArena *);
 };
 
 #endif
@@ -0,0 +1,134 @@
+#include <string>
+#include <vector>
+
+#include "small_fold.hpp"
+#include "small_expr.hpp"
+#include "small_heap.hpp"
+
+Folder::Folder (NodeArena *a, int globals_size) {
+    arena = a;
+    branches = 0;
+    globals = Heap::instance.make<Env>((Env*)NULL, globals_size);
+    Heap::instance.pin(globals);
+}
+
+Folder::~Folder() {
+    Heap::instance.unpin(globals);
+}
+
+void Folder::enter(ELambda *lambda) {
+    frames.push_back(lambda->getFrameSize());
+}
+
+void Folder::leave() {
+    frames.pop_back();
+}
+
+// Calls app in a top-level statement, with the bindings known so far.
+// Calls are limited to CallBudget.
+Value Folder::run(EApp *app) {
+    EApp::call_budget = CallBudget;
+    try {
+        Value v = app->call(globals);
+        EApp::call_budget = -1;
+        return v;
+    } catch (...) {
+        EApp::call_budget = -1;
+        throw;
+    }
+}
+
+// A node in a branch folds to something else than the same node outside
+// one, so the key marks it with a -1 after the frames.
+Expr *Folder::fold(Expr *e) {
+    std::pair<Expr*, std::vector<int> > key(e, frames);
+    if (branches > 0)
+        key.second.push_back(-1);
+    std::map<std::pair<Expr*, std::vector<int> >, Expr*>::iterator it = folded.find(key);
+    if (it != folded.end())
+        return it->second;
+    Expr *result = e->fold(this);
+    folded.emplace(std::move(key), result);
+    return result;
+}
+
+// Whatever was folded before the binding was known may fold further now.
+void Folder::bind(int slot, Expr *e) {
+    if (!globals->get(slot).isNull())
+        return;
+
+    Value v;
+    if (e->constant(v))
+        globals->set(slot, v);
+    else if (dynamic_cast<ELambda*>(e) != NULL)
+        globals->set(slot, e->evaluate(globals));
+    else
+        return;
+    folded.clear();
+}
+
+Expr *Folder::literal(Value v) {
+    switch (v.getTag()) {
+        case Tag::Int: return arena->intern<EInt>(v.asInt());
+        case Tag::Float: return arena->intern<EFloat>(v.asFloat());
+        case Tag::Bool: return arena->intern<EBool>(v.asBool());
+        case Tag::Char: return arena->intern<EChar>(v.asChar());
+        case Tag::TailCall: return NULL;
+        case Tag::Object:
+            if (v.is(ObjKind::String))
+                return arena->intern<EString>(v.as<VString>()->getValue());
+            return NULL;
+    }
+    return NULL;
+}
+
+Expr *Folder::foldOp2(Op2 op, Expr *left, Expr *right) {
+    Roots roots;
+    Value l, r;
+    if (!left->constant(l))
+        return NULL;
+    roots.push(l);
+
+    // A deciding left side of && or || short-circuits whatever is on the right
+    if ((op == Op2::LAnd || op == Op2::LOr) && l.isBool() && l.asBool() == (op == Op2::LOr))
+        return left;
+
+    if (!right->constant(r))
+        return NULL;
+    try {
+        return literal(evalOp2(op, l, r));
+    } catch (const char *) {
+    } catch (std::string) {
+    }
+    return NULL;
+}
+
+Expr *Folder::foldOp1(Op1 op, Expr *e) {
+    Value v;
+    if (!e->constant(v))
+        return NULL;
+    try {
+        return literal(evalOp1(op, v));
+    } catch (const char *) {
+    } catch (std::string) {
+    }
+    return NULL;
+}
+
+Expr *Folder::foldApp(EApp *app) {
+    if (!frames.empty() || branches > 0)
+        return NULL;
+    const std::vector<Expr*> &args = app->getArgs();
+    for (std::vector<Expr*>::const_iterator it = args.begin(); it != args.end(); ++it) {
+        Value v;
+        if (!(*it)->constant(v))
+            return NULL;
+    }
+
+    try {
+        return literal(run(app));
+    } catch (const char *) {
+    } catch (std::string) {
+    }
+    return NULL;
+}
@@ -0,0 +1,115 @@
+#ifndef SMALL_FOLD_HPP
+#define SMALL_FOLD_HPP
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_arena.hpp"
+#include "small_ops.hpp"
+#include "small_values.hpp"
+#include "small_env.hpp"
+
+// Constant folding and partial evaluation, run once after resolution.
+//
+// Operators over literals, ifs with a literal condition and reads of
+// top-level names bound to literals are replaced by their result. Calls
+// whose arguments are all literals are run ahead of time, through the
+// ordinary evaluator, and replaced when they produce something with a
+// literal form. Anything that throws or runs out of budget is left alone, so
+// it fails at runtime exactly as before.
+//
+// Only calls the program is sure to make are run: those in top-level
+// statements, outside the branches of ifs and the right sides of && and ||.
+// Calls in lambda bodies might never be made, and are left for runtime. The
+// budget counts calls, and builtins whose work grows with their arguments,
+// like range, sum and map, aren't run at all, so loading does a bounded
+// amount of work. A call with some literal arguments isn't specialized on
+// them; it's left as it is.
+//
+// Top-level statements are folded in order, and a binding is only known to
+// the statements after it, since that is when it exists at runtime.
+//
+// Identical subtrees are one node (see NodeArena::intern), so each is folded
+// once for every nesting of frames it appears at, until another binding
+// becomes known, and the result is reused wherever else it appears.
+class Folder {
+    NodeArena *arena;
+    // The top-level bindings known so far; everything else is null
+    Env *globals;
+    // Frame sizes of the lambdas enclosing the node being folded
+    std::vector<int> frames;
+    // How many branches that might not run enclose it
+    int branches;
+    // What nodes folded to, by node and the frames enclosing it
+    std::map<std::pair<Expr*, std::vector<int> >, Expr*> folded;
+
+    Value run(EApp *);
+
+    public:
+    // Most calls one partial evaluation may make
+    static const int CallBudget = 4096;
+
+    Folder (NodeArena *, int globals_size);
+
+    ~Folder();
+
+    Folder (const Folder &) = delete;
+
+    Folder &operator=(const Folder &) = delete;
+
+    // Makes room for top-level bindings added since; see AST::extend.
+    void grow(int globals_size) {
+        globals->grow(globals_size);
+    }
+
+    void enter(ELambda *);
+
+    void leave();
+
+    // Around the parts of an expression that might not be evaluated.
+    void enterBranch() {
+        branches++;
+    }
+
+    void leaveBranch() {
+        branches--;
+    }
+
+    // Where folded nodes are interned
+    NodeArena *getArena() {
+        return arena;
+    }
+
+    bool atTopLevel() {
+        return frames.empty();
+    }
+
+    // True if an identifier resolved to depth refers to a top-level binding.
+    bool isGlobal(int depth) {
+        return depth == (int)frames.size();
+    }
+
+    Value global(int slot) {
+        return globals->get(slot);
+    }
+
+    // Folds e where it sits, or returns what it folded to before here.
+    Expr *fold(Expr *e);
+
+    // Records what a top-level assignment binds, if it's known now.
+    void bind(int slot, Expr *);
+
+    // A literal node for v, or NULL if v has none (lists, closures).
+    Expr *literal(Value v);
+
+    // Each returns the folded node, or NULL if it can't be folded.
+    Expr *foldOp2(Op2, Expr *, Expr *);
+
+    Expr *foldOp1(Op1, Expr *);
+
+    Expr *foldApp(EApp *);
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "small_heap.hpp"
+#include "small_values.hpp"
+#include "small_stats.hpp"
+
+bool Heap::marking = false;
+
+Heap Heap::instance;
+
+Heap::Heap () {
+    phase = Phase::Idle;
+    epoch = 0;
+    threshold = MinThreshold;
+    since_step = 0;
+    sweep_pos = sweep_end = sweep_keep = 0;
+    stats = GcStats();
+}
+
+Heap::~Heap() {
+    // Mid-sweep, part of the list is stale
+    if (phase == Phase::Sweep)
+        sweep((size_t)-1);
+    for (std::vector<HeapObject*>::iterator it = objects.begin(); it != objects.end(); ++it) {
+        delete *it;
+    }
+}
+
+void Heap::track(HeapObject *obj) {
+    obj->managed = true;
+    obj->size = obj->footprint();
+    objects.push_back(obj);
+    if (Stats::enabled)
+        Stats::instance.allocated(obj, obj->size);
+
+    stats.objects++;
+    stats.bytes += obj->size;
+    if (stats.bytes > stats.peak_bytes)
+        stats.peak_bytes = stats.bytes;
+
+    if (phase == Phase::Idle) {
+        if (stats.bytes < threshold)
+            return;
+        startCycle();
+    }
+
+    // Allocated grey, so whatever it was built from gets traced too
+    if (phase == Phase::Mark) {
+        obj->mark = epoch;
+        grey.push_back(obj);
+    }
+
+    since_step += obj->size;
+    if (since_step >= StepBytes) {
+        since_step = 0;
+        step();
+    }
+}
+
+void Heap::startCycle() {
+    epoch++;
+    phase = Phase::Mark;
+    marking = true;
+    since_step = 0;
+    stats.cycles++;
+    markRoots();
+}
+
+void Heap::step() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (phase == Phase::Mark) {
+        if (drain(MarkBudget)) {
+            // The stacks aren't barriered, so look at them once more
+            markRoots();
+            drain((size_t)-1);
+            phase = Phase::Sweep;
+            marking = false;
+            sweep_pos = sweep_keep = 0;
+            sweep_end = objects.size();
+        }
+    } else if (phase == Phase::Sweep) {
+        if (sweep(SweepBudget)) {
+            phase = Phase::Idle;
+            threshold = std::max(MinThreshold, stats.bytes * 2);
+        }
+    }
+
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    stats.steps++;
+    stats.total_pause_ns += ns;
+    stats.max_pause_ns = std::max(stats.max_pause_ns, ns);
+}
+
+void Heap::markRoots() {
+    for (std::vector<HeapObject*>::iterator it = pinned.begin(); it != pinned.end(); ++it) {
+        mark(*it);
+    }
+    for (std::vector<HeapObject*>::iterator it = roots.begin(); it != roots.end(); ++it) {
+        mark(*it);
+    }
+    for (std::vector<RootSet*>::iterator it = root_sets.begin(); it != root_sets.end(); ++it) {
+        (*it)->markRoots(*this);
+    }
+}
+
+// Traces up to budget grey objects. Returns true once none are left.
+bool Heap::drain(size_t budget) {
+    while (!grey.empty() && budget-- > 0) {
+        HeapObject *obj = grey.back();
+        grey.pop_back();
+        obj->trace(*this);
+    }
+    return grey.empty();
+}
+
+// Frees up to budget unmarked objects from those that existed when marking
+// finished, compacting the survivors down. Returns true once all are done.
+bool Heap::sweep(size_t budget) {
+    while (sweep_pos < sweep_end && budget-- > 0) {
+        HeapObject *obj = objects[sweep_pos++];
+        if (obj->mark == epoch) {
+            objects[sweep_keep++] = obj;
+        } else {
+            stats.objects--;
+            stats.bytes -= obj->size;
+            stats.freed_objects++;
+            stats.freed_bytes += obj->size;
+            delete obj;
+        }
+    }
+    if (sweep_pos < sweep_end)
+        return false;
+
+    // Anything allocated since the sweep started moves down too
+    std::vector<HeapObject*>::iterator rest = objects.begin() + sweep_end;
+    std::copy(rest, objects.end(), objects.begin() + sweep_keep);
+    objects.resize(sweep_keep + (objects.end() - rest));
+    return true;
+}
+
+void Heap::mark(HeapObject *obj) {
+    if (obj == NULL)
+        return;
+
+    // Unmanaged objects (call frames, constants) are only reachable from the
+    // roots and may be gone by the next step, so trace them straight away.
+    if (!obj->managed) {
+        obj->trace(*this);
+        return;
+    }
+
+    if (obj->mark == epoch)
+        return;
+    obj->mark = epoch;
+    grey.push_back(obj);
+}
+
+void Heap::mark(Value v) {
+    if (v.isObject())
+        mark(v.asObject());
+}
+
+void Heap::pin(HeapObject *obj) {
+    pinned.push_back(obj);
+    if (marking)
+        mark(obj);
+}
+
+void Heap::unpin(HeapObject *obj) {
+    std::vector<HeapObject*>::iterator it = std::find(pinned.begin(), pinned.end(), obj);
+    if (it != pinned.end())
+        pinned.erase(it);
+}
+
+void Heap::addRootSet(RootSet *set) {
+    root_sets.push_back(set);
+}
+
+void Heap::removeRootSet(RootSet *set) {
+    std::vector<RootSet*>::iterator it = std::find(root_sets.begin(), root_sets.end(), set);
+    if (it != root_sets.end())
+        root_sets.erase(it);
+}
+
+void Heap::collect() {
+    while (phase != Phase::Idle) {
+        step();
+    }
+    startCycle();
+    while (phase != Phase::Idle) {
+        step();
+    }
+}
+
+GcStats Heap::getStats() {
+    return stats;
+}
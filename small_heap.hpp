@@ -0,0 +1,190 @@
+#ifndef SMALL_HEAP_HPP
+#define SMALL_HEAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "small_lang_forwards.h"
+
+class Heap;
+
+// Anything the collector can trace: values on the heap and environment
+// frames. Objects made through Heap::make are managed and freed by the
+// collector; objects made with plain new (a call frame that can't be
+// captured, a compiled constant) are traced through but owned elsewhere.
+class HeapObject {
+    friend class Heap;
+
+    uint32_t mark;
+    uint32_t size;
+    bool managed;
+
+    public:
+    HeapObject () {
+        mark = 0;
+        size = 0;
+        managed = false;
+    }
+
+    virtual ~HeapObject() {}
+
+    // Marks everything this object points to.
+    virtual void trace(Heap &) {}
+
+    // Approximate bytes held, including out-of-line storage.
+    virtual size_t footprint() = 0;
+};
+
+// Something outside the heap that holds references into it, like a VM stack.
+class RootSet {
+    public:
+    virtual ~RootSet() {}
+
+    virtual void markRoots(Heap &) = 0;
+};
+
+class GcStats {
+    public:
+    size_t cycles;
+    size_t steps;
+    size_t objects;
+    size_t bytes;
+    size_t peak_bytes;
+    size_t freed_objects;
+    size_t freed_bytes;
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+};
+
+// An incremental mark-and-sweep collector.
+//
+// A cycle starts once the heap has grown past a threshold. From then on,
+// every StepBytes of allocation does a bounded amount of work (marking
+// MarkBudget objects, then sweeping SweepBudget objects), so no single pause
+// is proportional to the heap. Marking is tri-colour: objects allocated or
+// written into a frame while marking are shaded grey, and when the grey
+// stack runs dry the roots are scanned once more before sweeping, since
+// stacks aren't covered by the write barrier.
+//
+// Roots are pinned objects (e.g. the global frame), registered RootSets,
+// and the root stack, where evaluator code pushes any value it holds in a
+// C++ local across something that might allocate. See Roots.
+class Heap {
+    enum class Phase {
+        Idle
+        ,Mark
+        ,Sweep
+    };
+
+    static constexpr size_t MinThreshold = 4 * 1024 * 1024;
+    static constexpr size_t StepBytes = 64 * 1024;
+    static constexpr size_t MarkBudget = 4096;
+    static constexpr size_t SweepBudget = 8192;
+
+    Phase phase;
+    uint32_t epoch;
+    size_t threshold;
+    size_t since_step;
+
+    std::vector<HeapObject*> objects;
+    std::vector<HeapObject*> grey;
+    std::vector<HeapObject*> roots;
+    std::vector<HeapObject*> pinned;
+    std::vector<RootSet*> root_sets;
+
+    size_t sweep_pos, sweep_end, sweep_keep;
+
+    GcStats stats;
+
+    void track(HeapObject *);
+
+    void startCycle();
+
+    void step();
+
+    void markRoots();
+
+    bool drain(size_t budget);
+
+    bool sweep(size_t budget);
+
+    public:
+    // True while a cycle is marking; checked by the write barrier
+    static bool marking;
+
+    static Heap instance;
+
+    Heap ();
+
+    ~Heap();
+
+    template <typename T, typename... Args>
+    T *make(Args&&... args) {
+        T *obj = new T(std::forward<Args>(args)...);
+        track(obj);
+        return obj;
+    }
+
+    void mark(HeapObject *);
+
+    void mark(Value);
+
+    // The write barrier: call after storing v into an existing object.
+    void shade(Value v);
+
+    void push(HeapObject *o) {
+        roots.push_back(o);
+    }
+
+    void push(Value);
+
+    size_t height() {
+        return roots.size();
+    }
+
+    void popTo(size_t h) {
+        roots.resize(h);
+    }
+
+    void setRoot(size_t i, HeapObject *o) {
+        roots[i] = o;
+    }
+
+    void pin(HeapObject *);
+
+    void unpin(HeapObject *);
+
+    void addRootSet(RootSet *);
+
+    void removeRootSet(RootSet *);
+
+    // Finishes any cycle in progress, then runs a complete one.
+    void collect();
+
+    GcStats getStats();
+};
+
+// Pushes values onto the heap's root stack, and pops them all when it goes
+// out of scope.
+class Roots {
+    size_t height;
+
+    public:
+    Roots () {
+        height = Heap::instance.height();
+    }
+
+    ~Roots() {
+        Heap::instance.popTo(height);
+    }
+
+    void push(HeapObject *o) {
+        Heap::instance.push(o);
+    }
+
+    void push(Value v);
+};
+
+#endif
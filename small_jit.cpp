@@ -0,0 +1,416 @@
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "small_jit.hpp"
+#include "small_expr.hpp"
+#include "small_stmt.hpp"
+
+#if defined(__x86_64__)
+bool Jit::enabled = true;
+#else
+bool Jit::enabled = false;
+#endif
+
+JitCode *JitCode::make(const std::vector<uint8_t> &code) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (code.size() + page - 1) / page * page;
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    std::memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return NULL;
+    }
+    return new JitCode(mem, size);
+}
+
+JitCode::~JitCode() {
+    munmap(mem, size);
+}
+
+Value Jit::tierUp(VClos *clos, Env *frame) {
+    JitState &s = clos->getJit();
+    s.calls = 0;
+    if (s.compiles >= MaxCompiles)
+        return Value();
+
+    s.compiles++;
+    s.code = compile(clos, frame);
+    if (s.code == NULL) {
+        // It won't compile any better next time
+        s.compiles = MaxCompiles;
+        return Value();
+    }
+    return run(clos, frame);
+}
+
+Value Jit::run(VClos *clos, Env *frame) {
+    JitState &s = clos->getJit();
+    const std::vector<int> &slots = clos->getLambda()->getParamSlots();
+
+    uint64_t args[MaxParams];
+    for (size_t i = 0; i < slots.size(); ++i) {
+        args[i] = frame->get(slots[i]).getBits();
+    }
+
+    uint64_t res = s.code->getEntry()(args);
+    if (res != 0)
+        return Value::fromBits(res);
+
+    if (++s.deopts >= MaxDeopts) {
+        delete s.code;
+        s.code = NULL;
+        s.deopts = 0;
+    }
+    return Value();
+}
+
+// Specializes on the arguments in frame. The return type is a guess, checked
+// by compiling: if one doesn't fit, the other is tried.
+JitCode *Jit::compile(VClos *clos, Env *frame) {
+    if (!enabled)
+        return NULL;
+
+    const std::vector<int> &slots = clos->getLambda()->getParamSlots();
+    if ((int)slots.size() > MaxParams)
+        return NULL;
+
+    std::vector<JitType> params;
+    for (std::vector<int>::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+        Value arg = frame->get(*it);
+        if (arg.isInt())
+            params.push_back(JitType::Int);
+        else if (arg.isBool())
+            params.push_back(JitType::Bool);
+        else
+            return NULL;
+    }
+
+    JitType rets[] = {JitType::Int, JitType::Bool};
+    for (size_t i = 0; i < 2; ++i) {
+        Jit jit(clos, params, rets[i]);
+        JitCode *code = jit.build();
+        if (code != NULL)
+            return code;
+    }
+    return NULL;
+}
+
+// Arguments are pushed in order, so the first is furthest from the frame
+// pointer. Every other slot gets a word below it.
+Jit::Jit (VClos *c, const std::vector<JitType> &ps, JitType ret) {
+    clos = c;
+    lambda = c->getLambda();
+    params = ps;
+    ret_type = ret;
+    returned = false;
+
+    int n = params.size();
+    int size = lambda->getFrameSize();
+    types.assign(size, JitType::None);
+    offsets.assign(size, 0);
+    const std::vector<int> &slots = lambda->getParamSlots();
+    for (int i = 0; i < n; ++i) {
+        types[slots[i]] = params[i];
+        offsets[slots[i]] = 16 + 8 * (n - 1 - i);
+    }
+    int locals = 0;
+    for (int s = 0; s < size; ++s) {
+        if (types[s] == JitType::None)
+            offsets[s] = -8 * ++locals;
+    }
+
+    body = label();
+    loop = label();
+    bail = label();
+}
+
+// The entry follows the C calling convention, with args in rdi. It saves
+// its stack pointer in rbx for bailing out, keeps the depth left in r12,
+// checks and unboxes the arguments onto the stack, and calls the body.
+// The body keeps its result in eax, and a right operand in ecx.
+JitCode *Jit::build() {
+    int exit = label();
+
+    bytes({0x55});                          // push rbp
+    bytes({0x48, 0x89, 0xE5});              // mov rbp, rsp
+    bytes({0x53});                          // push rbx
+    bytes({0x41, 0x54});                    // push r12
+    bytes({0x48, 0x89, 0xE3});              // mov rbx, rsp
+    bytes({0x49, 0xC7, 0xC4});              // mov r12, MaxDepth
+    imm32(MaxDepth);
+    for (int i = 0; i < arity(); ++i) {
+        loadArgument(i);
+    }
+    bytes({0xE8});                          // call body
+    rel32(body);
+    box(ret_type);
+
+    bind(exit);
+    bytes({0x48, 0x89, 0xDC});              // mov rsp, rbx
+    bytes({0x41, 0x5C});                    // pop r12
+    bytes({0x5B});                          // pop rbx
+    bytes({0x5D});                          // pop rbp
+    bytes({0xC3});                          // ret
+
+    bind(bail);
+    bytes({0x31, 0xC0});                    // xor eax, eax
+    jump(exit);
+
+    bind(body);
+    prologue();
+    bind(loop);
+    if (!lambda->getBody()->jit(this) || !returned)
+        return NULL;
+
+    for (std::vector<std::pair<size_t, int> >::iterator it = fixups.begin(); it != fixups.end(); ++it) {
+        int32_t rel = (int32_t)(labels[it->second] - (int64_t)(it->first + 4));
+        std::memcpy(&code[it->first], &rel, sizeof(rel));
+    }
+    return JitCode::make(code);
+}
+
+void Jit::bytes(std::initializer_list<uint8_t> bs) {
+    code.insert(code.end(), bs.begin(), bs.end());
+}
+
+void Jit::imm32(int32_t v) {
+    uint8_t b[4];
+    std::memcpy(b, &v, sizeof(v));
+    code.insert(code.end(), b, b + 4);
+}
+
+void Jit::rel32(int l) {
+    fixups.push_back(std::make_pair(code.size(), l));
+    imm32(0);
+}
+
+int Jit::label() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+}
+
+void Jit::bind(int l) {
+    labels[l] = code.size();
+}
+
+void Jit::loadArgument(int i) {
+    bytes({0x48, 0x8B, 0x87});              // mov rax, [rdi + 8i]
+    imm32(8 * i);
+    bytes({0x48, 0x89, 0xC1});              // mov rcx, rax
+    bytes({0x83, 0xE1, 0x07});              // and ecx, 7
+    Tag tag = params[i] == JitType::Int ? Tag::Int : Tag::Bool;
+    bytes({0x83, 0xF9, (uint8_t)tag});      // cmp ecx, tag
+    bytes({0x0F, 0x85});                    // jne bail
+    rel32(bail);
+    bytes({0x48, 0xC1, 0xE8, 0x20});        // shr rax, 32
+    push();
+}
+
+void Jit::box(JitType t) {
+    Tag tag = t == JitType::Int ? Tag::Int : Tag::Bool;
+    bytes({0x48, 0xC1, 0xE0, 0x20});        // shl rax, 32
+    bytes({0x48, 0x83, 0xC8, (uint8_t)tag}); // or rax, tag
+}
+
+void Jit::prologue() {
+    bytes({0x55});                          // push rbp
+    bytes({0x48, 0x89, 0xE5});              // mov rbp, rsp
+    bytes({0x49, 0xFF, 0xCC});              // dec r12
+    bytes({0x0F, 0x84});                    // je bail
+    rel32(bail);
+    saveFrame();
+}
+
+// Makes room for the locals; also resets the stack for a self tail call.
+void Jit::saveFrame() {
+    int locals = 0;
+    for (std::vector<int32_t>::iterator it = offsets.begin(); it != offsets.end(); ++it) {
+        if (*it < 0)
+            locals++;
+    }
+    bytes({0x48, 0x89, 0xEC});              // mov rsp, rbp
+    bytes({0x48, 0x81, 0xEC});              // sub rsp, 8 * locals
+    imm32(8 * locals);
+}
+
+// The callee pops its arguments
+void Jit::epilogue() {
+    bytes({0x49, 0xFF, 0xC4});              // inc r12
+    bytes({0x48, 0x89, 0xEC});              // mov rsp, rbp
+    bytes({0x5D});                          // pop rbp
+    if (arity() == 0) {
+        bytes({0xC3});                      // ret
+    } else {
+        uint16_t n = 8 * arity();
+        bytes({0xC2, (uint8_t)n, (uint8_t)(n >> 8)}); // ret n
+    }
+}
+
+void Jit::bailIfZero() {
+    bytes({0x85, 0xC9});                    // test ecx, ecx
+    bytes({0x0F, 0x84});                    // je bail
+    rel32(bail);
+}
+
+JitType Jit::constant(Value v) {
+    if (v.isInt()) {
+        bytes({0xB8});                      // mov eax, imm32
+        imm32(v.asInt());
+        return JitType::Int;
+    }
+    if (v.isBool()) {
+        bytes({0xB8});
+        imm32(v.asBool() ? 1 : 0);
+        return JitType::Bool;
+    }
+    return JitType::None;
+}
+
+// Outer bindings are read now: once bound, they stay bound to the same value.
+JitType Jit::load(int depth, int slot) {
+    if (depth > 0)
+        return constant(clos->getEnv()->lookup(depth - 1, slot));
+
+    if (types[slot] == JitType::None)
+        return JitType::None;
+    bytes({0x48, 0x8B, 0x85});              // mov rax, [rbp + offset]
+    imm32(offsets[slot]);
+    return types[slot];
+}
+
+bool Jit::store(int slot, JitType t) {
+    if (t == JitType::None || types[slot] != JitType::None)
+        return false;
+    types[slot] = t;
+    bytes({0x48, 0x89, 0x85});              // mov [rbp + offset], rax
+    imm32(offsets[slot]);
+    return true;
+}
+
+bool Jit::isSelf(int depth, int slot) {
+    if (depth == 0)
+        return false;
+    Value v = clos->getEnv()->lookup(depth - 1, slot);
+    return v.isObject() && v.asObject() == clos;
+}
+
+void Jit::push() {
+    bytes({0x50});                          // push rax
+}
+
+void Jit::popRight() {
+    bytes({0x48, 0x89, 0xC1});              // mov rcx, rax
+    bytes({0x58});                          // pop rax
+}
+
+// Must agree with intOp2 and boolOp2
+JitType Jit::op2(Op2 op, JitType l, JitType r) {
+    if (l != r || l == JitType::None)
+        return JitType::None;
+
+    if (l == JitType::Bool) {
+        if (op != Op2::Eq)
+            return JitType::None;
+        bytes({0x39, 0xC8});                // cmp eax, ecx
+        bytes({0x0F, 0x94, 0xC0});          // sete al
+        bytes({0x0F, 0xB6, 0xC0});          // movzx eax, al
+        return JitType::Bool;
+    }
+
+    uint8_t setcc = 0;
+    switch (op) {
+        case Op2::Add:
+            bytes({0x01, 0xC8});            // add eax, ecx
+            return JitType::Int;
+        case Op2::Sub:
+            bytes({0x29, 0xC8});            // sub eax, ecx
+            return JitType::Int;
+        case Op2::Mul:
+            bytes({0x0F, 0xAF, 0xC1});      // imul eax, ecx
+            return JitType::Int;
+        case Op2::Div:
+        case Op2::Mod:
+            // In 64 bits, so INT_MIN / -1 wraps instead of trapping
+            bailIfZero();
+            bytes({0x48, 0x63, 0xC0});      // movsxd rax, eax
+            bytes({0x48, 0x63, 0xC9});      // movsxd rcx, ecx
+            bytes({0x48, 0x99});            // cqo
+            bytes({0x48, 0xF7, 0xF9});      // idiv rcx
+            if (op == Op2::Mod)
+                bytes({0x89, 0xD0});        // mov eax, edx
+            return JitType::Int;
+        case Op2::Lt: setcc = 0x9C; break;
+        case Op2::Lte: setcc = 0x9E; break;
+        case Op2::Gt: setcc = 0x9F; break;
+        case Op2::Gte: setcc = 0x9D; break;
+        case Op2::Eq: setcc = 0x94; break;
+        default:
+            return JitType::None;
+    }
+    bytes({0x39, 0xC8});                    // cmp eax, ecx
+    bytes({0x0F, setcc, 0xC0});             // setcc al
+    bytes({0x0F, 0xB6, 0xC0});              // movzx eax, al
+    return JitType::Bool;
+}
+
+JitType Jit::op1(Op1 op, JitType t) {
+    if (op == Op1::Neg && t == JitType::Int) {
+        bytes({0xF7, 0xD8});                // neg eax
+        return JitType::Int;
+    }
+    if (op == Op1::LNot && t == JitType::Bool) {
+        bytes({0x83, 0xF0, 0x01});          // xor eax, 1
+        return JitType::Bool;
+    }
+    return JitType::None;
+}
+
+void Jit::jump(int l) {
+    bytes({0xE9});                          // jmp rel32
+    rel32(l);
+}
+
+void Jit::jumpIfFalse(int l) {
+    bytes({0x85, 0xC0});                    // test eax, eax
+    bytes({0x0F, 0x84});                    // je rel32
+    rel32(l);
+}
+
+void Jit::jumpIfTrue(int l) {
+    bytes({0x85, 0xC0});                    // test eax, eax
+    bytes({0x0F, 0x85});                    // jne rel32
+    rel32(l);
+}
+
+// A tail call moves the arguments over the parameters and starts over
+JitType Jit::call(bool tail) {
+    if (!tail) {
+        bytes({0xE8});                      // call body
+        rel32(body);
+        return ret_type;
+    }
+
+    const std::vector<int> &slots = lambda->getParamSlots();
+    for (int i = arity() - 1; i >= 0; --i) {
+        bytes({0x58});                      // pop rax
+        bytes({0x48, 0x89, 0x85});          // mov [rbp + offset], rax
+        imm32(offsets[slots[i]]);
+    }
+    saveFrame();
+    jump(loop);
+    return ret_type;
+}
+
+bool Jit::ret(JitType t) {
+    if (t == JitType::None || t != ret_type)
+        return false;
+    epilogue();
+    returned = true;
+    return true;
+}
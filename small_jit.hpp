@@ -0,0 +1,185 @@
+#ifndef SMALL_JIT_HPP
+#define SMALL_JIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_ops.hpp"
+#include "small_values.hpp"
+#include "small_env.hpp"
+
+// Machine code for one closure, in its own executable mapping.
+class JitCode {
+    void *mem;
+    size_t size;
+
+    JitCode (void *m, size_t s) {
+        mem = m;
+        size = s;
+    }
+
+    public:
+    // Takes the arguments and gives the result's bits, or 0 (the null
+    // value) if the code bailed out.
+    typedef uint64_t (*Entry)(const uint64_t *args);
+
+    // Maps code executable, or returns NULL if the system won't.
+    static JitCode *make(const std::vector<uint8_t> &code);
+
+    ~JitCode();
+
+    JitCode (const JitCode &) = delete;
+
+    JitCode &operator=(const JitCode &) = delete;
+
+    Entry getEntry() {
+        return (Entry)mem;
+    }
+};
+
+// The types compiled code keeps unboxed. None means the node can't be
+// compiled, and so neither can the closure.
+enum class JitType {
+    None
+    ,Int
+    ,Bool
+};
+
+// A baseline JIT for the tree-walker. Calls count against their closure, and
+// once one has made Threshold of them its lambda is compiled to x86-64, one
+// template per node, and called instead of evaluating the body.
+//
+// Code is specialized to a closure: to the types of the arguments it was
+// called with when it got hot, and to the ints and bools it has captured,
+// which can't change once bound. Bodies that use only those, ints and bools,
+// operators on them, ifs, local bindings and calls to the closure itself
+// compile; anything else stays interpreted. Self tail calls become jumps.
+//
+// The entry checks every argument's tag. If one has changed type, or an int
+// is divided by zero, or recursion runs too deep, the code bails out:
+// compiled code has no side effects, so it unwinds straight to the entry and
+// the interpreter runs the call from the start. A closure that keeps bailing
+// out loses its code, and is compiled again for whatever types it gets next.
+class Jit {
+    VClos *clos;
+    ELambda *lambda;
+    std::vector<JitType> params;
+    JitType ret_type;
+    // Per frame slot: its type once bound, and where it lives
+    std::vector<JitType> types;
+    std::vector<int32_t> offsets;
+    bool returned;
+
+    std::vector<uint8_t> code;
+    std::vector<int64_t> labels;
+    std::vector<std::pair<size_t, int> > fixups;
+    int body, loop, bail;
+
+    Jit (VClos *, const std::vector<JitType> &params, JitType ret);
+
+    JitCode *build();
+
+    void bytes(std::initializer_list<uint8_t>);
+
+    void imm32(int32_t);
+
+    // A rel32 operand to be patched with the label's address
+    void rel32(int label);
+
+    // Instructions and templates
+    void saveFrame();
+
+    void loadArgument(int i);
+
+    void box(JitType);
+
+    void prologue();
+
+    void epilogue();
+
+    void bailIfZero();
+
+    static Value tierUp(VClos *, Env *);
+
+    static Value run(VClos *, Env *);
+
+    static JitCode *compile(VClos *, Env *);
+
+    public:
+    static const uint32_t Threshold = 1000;
+    // Bail-outs before a closure's code is thrown away
+    static const uint32_t MaxDeopts = 100;
+    static const uint8_t MaxCompiles = 3;
+    static const int MaxParams = 8;
+    // Nested compiled calls before bailing out, to stay clear of the C stack
+    static const int32_t MaxDepth = 20000;
+
+    // Off for --no-jit, and on machines it can't generate code for
+    static bool enabled;
+
+    // Counts a call to clos, whose frame has its arguments bound. Returns
+    // the result if compiled code could run it, or the null value.
+    static Value enter(VClos *clos, Env *frame) {
+        JitState &s = clos->getJit();
+        if (s.code != NULL)
+            return run(clos, frame);
+        if (++s.calls < Threshold)
+            return Value();
+        return tierUp(clos, frame);
+    }
+
+    // What the nodes compile to. Each leaves its result in the accumulator
+    // and returns its type.
+    JitType constant(Value);
+
+    JitType load(int depth, int slot);
+
+    // Binds a slot of the frame, which must not be bound yet.
+    bool store(int slot, JitType);
+
+    // True if (depth, slot) is bound to the closure being compiled.
+    bool isSelf(int depth, int slot);
+
+    int arity() {
+        return params.size();
+    }
+
+    JitType paramType(int i) {
+        return params[i];
+    }
+
+    // Saves the accumulator, e.g. a left operand or an argument.
+    void push();
+
+    // Moves the accumulator to the right operand and restores the left.
+    void popRight();
+
+    JitType op2(Op2, JitType l, JitType r);
+
+    JitType op1(Op1, JitType);
+
+    int label();
+
+    void bind(int label);
+
+    void jump(int label);
+
+    void jumpIfFalse(int label);
+
+    void jumpIfTrue(int label);
+
+    // Calls the closure itself, with the arguments pushed.
+    JitType call(bool tail);
+
+    bool ret(JitType);
+
+    bool hasReturned() {
+        return returned;
+    }
+};
+
+#endif
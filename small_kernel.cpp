@@ -0,0 +1,708 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "small_kernel.hpp"
+#include "small_expr.hpp"
+#include "small_stmt.hpp"
+#include "small_env.hpp"
+#include "small_heap.hpp"
+#include "small_pool.hpp"
+
+static const int Width = ListNode::Width;
+
+typedef Kernel::Column Column;
+typedef Kernel::Lanes Lanes;
+
+Kernel::Kernel (const std::vector<int> &p) {
+    params = p;
+    depth = 0;
+    max_depth = 0;
+}
+
+void Kernel::emit(Op op, std::initializer_list<int32_t> operands, int effect) {
+    code.push_back((int32_t)op);
+    code.insert(code.end(), operands);
+    depth += effect;
+    if (depth > max_depth)
+        max_depth = depth;
+}
+
+Kernel *Kernel::compile(ELambda *lambda) {
+    if (lambda->getParamSlots().empty())
+        return NULL;
+    Kernel *k = new Kernel(lambda->getParamSlots());
+    if (!lambda->getBody()->kernel(k)) {
+        delete k;
+        return NULL;
+    }
+    return k;
+}
+
+// The arguments are the only locals a body of one expression can name.
+// Anything further out is in the closure's env, a frame nearer.
+bool Kernel::load(int d, int slot, Symbol name) {
+    if (d == 0) {
+        std::vector<int>::iterator it = std::find(params.begin(), params.end(), slot);
+        if (it == params.end())
+            return false;
+        emit(Op::Arg, {(int32_t)(it - params.begin())}, 1);
+        return true;
+    }
+    emit(Op::Load, {(int32_t)captures.size()}, 1);
+    captures.push_back({d - 1, slot, name});
+    return true;
+}
+
+// Only immediates, which the collector needn't know about
+bool Kernel::constant(Value v) {
+    if (v.isObject())
+        return false;
+    emit(Op::Const, {(int32_t)constants.size()}, 1);
+    constants.push_back(v);
+    return true;
+}
+
+void Kernel::op2(Op2 op) {
+    emit(Op::Op2, {(int32_t)op}, -1);
+}
+
+void Kernel::op1(Op1 op) {
+    emit(Op::Op1, {(int32_t)op}, 0);
+}
+
+int Kernel::shortCircuit(Op2 op) {
+    emit(Op::ShortCircuit, {(int32_t)op, 0}, 0);
+    return code.size() - 1;
+}
+
+// Running in columns, the condition stays on the stack for the Select
+int Kernel::branch(const std::string &message) {
+    emit(Op::Branch, {0, (int32_t)strings.size()}, 0);
+    strings.push_back(message);
+    return code.size() - 2;
+}
+
+int Kernel::jump() {
+    emit(Op::Jump, {0}, 0);
+    return code.size() - 1;
+}
+
+void Kernel::select() {
+    emit(Op::Select, {}, -2);
+}
+
+void Kernel::patch(int operand) {
+    code[operand] = code.size();
+}
+
+std::vector<Value> Kernel::capture(Env *env) {
+    std::vector<Value> values;
+    for (std::vector<Capture>::iterator it = captures.begin(); it != captures.end(); ++it) {
+        values.push_back(env->lookup(it->depth, it->slot));
+    }
+    return values;
+}
+
+// One value at a time, as the interpreter would run the body. Results that
+// are objects stay rooted until the call ends, since the next operator may
+// allocate.
+Value Kernel::scalar(const Value *args, const std::vector<Value> &captured, std::vector<Value> &stack) {
+    Roots roots;
+    size_t sp = 0;
+    for (size_t pc = 0; pc < code.size();) {
+        switch ((Op)code[pc]) {
+            case Op::Arg:
+                stack[sp++] = args[code[pc + 1]];
+                pc += 2;
+                break;
+
+            case Op::Const:
+                stack[sp++] = constants[code[pc + 1]];
+                pc += 2;
+                break;
+
+            case Op::Load: {
+                Value v = captured[code[pc + 1]];
+                if (v.isNull())
+                    throw "Variable used before assignment: " + captures[code[pc + 1]].name.getName();
+                stack[sp++] = v;
+                pc += 2;
+                break;
+            }
+
+            case Op::Op2: {
+                Value r = stack[--sp];
+                stack[sp - 1] = evalOp2((Op2)code[pc + 1], stack[sp - 1], r);
+                roots.push(stack[sp - 1]);
+                pc += 2;
+                break;
+            }
+
+            case Op::Op1:
+                stack[sp - 1] = evalOp1((Op1)code[pc + 1], stack[sp - 1]);
+                pc += 2;
+                break;
+
+            case Op::ShortCircuit: {
+                Value l = stack[sp - 1];
+                if (l.isBool() && l.asBool() == ((Op2)code[pc + 1] == Op2::LOr))
+                    pc = code[pc + 2];
+                else
+                    pc += 3;
+                break;
+            }
+
+            case Op::Branch: {
+                Value c = stack[--sp];
+                if (!c.isBool())
+                    throw strings[code[pc + 2]];
+                pc = c.asBool() ? pc + 3 : code[pc + 1];
+                break;
+            }
+
+            case Op::Jump:
+                pc = code[pc + 1];
+                break;
+
+            case Op::Select:
+                pc += 1;
+                break;
+        }
+    }
+    return stack[0];
+}
+
+#if defined(__SSE2__)
+
+// The low 32 bits of each lane's product. SSE2 only multiplies the even
+// lanes, into 64 bits, so the odd ones are shifted down and done apart.
+static __m128i mullo(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Sets every lane of a to f of it and the same lane of b, four at a time.
+template <typename F>
+static void each(int32_t *a, const int32_t *b, F f) {
+    for (int i = 0; i < Width; i += 4) {
+        __m128i x = _mm_load_si128((const __m128i*)(a + i));
+        __m128i y = _mm_load_si128((const __m128i*)(b + i));
+        _mm_store_si128((__m128i*)(a + i), f(x, y));
+    }
+}
+
+template <typename F>
+static void each(float *a, const float *b, F f) {
+    for (int i = 0; i < Width; i += 4) {
+        _mm_store_ps(a + i, f(_mm_load_ps(a + i), _mm_load_ps(b + i)));
+    }
+}
+
+// A comparison's all-ones lanes as bools
+static __m128i truth(__m128i mask) {
+    return _mm_and_si128(mask, _mm_set1_epi32(1));
+}
+
+static __m128 truth(__m128 mask) {
+    return _mm_castsi128_ps(truth(_mm_castps_si128(mask)));
+}
+
+static void toFloats(Column &c) {
+    if (c.lanes != Lanes::Int)
+        return;
+    for (int i = 0; i < Width; i += 4) {
+        __m128i x = _mm_load_si128((const __m128i*)(c.ints + i));
+        _mm_store_ps(c.floats + i, _mm_cvtepi32_ps(x));
+    }
+    c.lanes = Lanes::Float;
+}
+
+// Integer division has no SIMD instruction; a zero divisor falls back, so
+// that the interpreter reports it.
+static bool divide(Op2 op, Column &l, const Column &r, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (r.ints[i] == 0)
+            return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        int64_t a = l.ints[i], b = r.ints[i];
+        l.ints[i] = (int32_t)(uint32_t)(uint64_t)(op == Op2::Div ? a / b : a % b);
+    }
+    return true;
+}
+
+static bool intLanes(Op2 op, Column &l, const Column &r, int n) {
+    int32_t *a = l.ints;
+    const int32_t *b = r.ints;
+    switch (op) {
+        case Op2::Add: each(a, b, [](__m128i x, __m128i y) { return _mm_add_epi32(x, y); }); break;
+        case Op2::Sub: each(a, b, [](__m128i x, __m128i y) { return _mm_sub_epi32(x, y); }); break;
+        case Op2::Mul: each(a, b, mullo); break;
+        case Op2::Div:
+        case Op2::Mod:
+            return divide(op, l, r, n);
+        case Op2::Lt: each(a, b, [](__m128i x, __m128i y) { return truth(_mm_cmplt_epi32(x, y)); }); break;
+        case Op2::Gt: each(a, b, [](__m128i x, __m128i y) { return truth(_mm_cmpgt_epi32(x, y)); }); break;
+        case Op2::Eq: each(a, b, [](__m128i x, __m128i y) { return truth(_mm_cmpeq_epi32(x, y)); }); break;
+        case Op2::Lte:
+            each(a, b, [](__m128i x, __m128i y) { return _mm_andnot_si128(_mm_cmpgt_epi32(x, y), _mm_set1_epi32(1)); });
+            break;
+        case Op2::Gte:
+            each(a, b, [](__m128i x, __m128i y) { return _mm_andnot_si128(_mm_cmplt_epi32(x, y), _mm_set1_epi32(1)); });
+            break;
+        default:
+            return false;
+    }
+    l.lanes = op >= Op2::Lt ? Lanes::Bool : Lanes::Int;
+    return true;
+}
+
+static bool floatLanes(Op2 op, Column &l, const Column &r) {
+    float *a = l.floats;
+    const float *b = r.floats;
+    switch (op) {
+        case Op2::Add: each(a, b, [](__m128 x, __m128 y) { return _mm_add_ps(x, y); }); break;
+        case Op2::Sub: each(a, b, [](__m128 x, __m128 y) { return _mm_sub_ps(x, y); }); break;
+        case Op2::Mul: each(a, b, [](__m128 x, __m128 y) { return _mm_mul_ps(x, y); }); break;
+        case Op2::Div: each(a, b, [](__m128 x, __m128 y) { return _mm_div_ps(x, y); }); break;
+        case Op2::Lt: each(a, b, [](__m128 x, __m128 y) { return truth(_mm_cmplt_ps(x, y)); }); break;
+        case Op2::Lte: each(a, b, [](__m128 x, __m128 y) { return truth(_mm_cmple_ps(x, y)); }); break;
+        case Op2::Gt: each(a, b, [](__m128 x, __m128 y) { return truth(_mm_cmpgt_ps(x, y)); }); break;
+        case Op2::Gte: each(a, b, [](__m128 x, __m128 y) { return truth(_mm_cmpge_ps(x, y)); }); break;
+        case Op2::Eq: each(a, b, [](__m128 x, __m128 y) { return truth(_mm_cmpeq_ps(x, y)); }); break;
+        default:
+            return false;
+    }
+    l.lanes = op >= Op2::Lt ? Lanes::Bool : Lanes::Float;
+    return true;
+}
+
+static bool boolLanes(Op2 op, Column &l, const Column &r) {
+    int32_t *a = l.ints;
+    const int32_t *b = r.ints;
+    switch (op) {
+        case Op2::LAnd: each(a, b, [](__m128i x, __m128i y) { return _mm_and_si128(x, y); }); break;
+        case Op2::LOr: each(a, b, [](__m128i x, __m128i y) { return _mm_or_si128(x, y); }); break;
+        case Op2::Eq: each(a, b, [](__m128i x, __m128i y) { return truth(_mm_cmpeq_epi32(x, y)); }); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static bool lanes2(Op2 op, Column &l, Column &r, int n) {
+    if (l.lanes == Lanes::Int && r.lanes == Lanes::Int)
+        return intLanes(op, l, r, n);
+    if (l.lanes == Lanes::Bool && r.lanes == Lanes::Bool)
+        return boolLanes(op, l, r);
+    if (l.lanes == Lanes::Bool || r.lanes == Lanes::Bool || op == Op2::Mod)
+        return false;
+    toFloats(l);
+    toFloats(r);
+    return floatLanes(op, l, r);
+}
+
+static bool lanes1(Op1 op, Column &c) {
+    if (op == Op1::Neg && c.lanes == Lanes::Int) {
+        Column zero = Column();
+        each(c.ints, zero.ints, [](__m128i x, __m128i z) { return _mm_sub_epi32(z, x); });
+        return true;
+    }
+    if (op == Op1::Neg && c.lanes == Lanes::Float) {
+        Column sign;
+        std::fill(sign.floats, sign.floats + Width, -0.0f);
+        each(c.floats, sign.floats, [](__m128 x, __m128 s) { return _mm_xor_ps(x, s); });
+        return true;
+    }
+    if (op == Op1::LNot && c.lanes == Lanes::Bool) {
+        Column one;
+        std::fill(one.ints, one.ints + Width, 1);
+        each(c.ints, one.ints, [](__m128i x, __m128i o) { return _mm_xor_si128(x, o); });
+        return true;
+    }
+    return false;
+}
+
+// c's lanes become t's where c is true and f's where it isn't.
+static bool blend(Column &c, const Column &t, const Column &f) {
+    if (c.lanes != Lanes::Bool || t.lanes != f.lanes)
+        return false;
+    for (int i = 0; i < Width; i += 4) {
+        __m128i mask = _mm_sub_epi32(_mm_setzero_si128(), _mm_load_si128((const __m128i*)(c.ints + i)));
+        __m128i x = _mm_load_si128((const __m128i*)(t.ints + i));
+        __m128i y = _mm_load_si128((const __m128i*)(f.ints + i));
+        _mm_store_si128((__m128i*)(c.ints + i), _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y)));
+    }
+    c.lanes = t.lanes;
+    return true;
+}
+
+static bool fill(Column &c, Value v) {
+    if (v.isInt()) {
+        std::fill(c.ints, c.ints + Width, v.asInt());
+        c.lanes = Lanes::Int;
+    } else if (v.isFloat()) {
+        std::fill(c.floats, c.floats + Width, v.asFloat());
+        c.lanes = Lanes::Float;
+    } else if (v.isBool()) {
+        std::fill(c.ints, c.ints + Width, v.asBool() ? 1 : 0);
+        c.lanes = Lanes::Bool;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif
+
+// A leaf's ints or floats as a column. Other leaves run a value at a time.
+static bool column(ListLeaf *leaf, Column &c) {
+    if (leaf->elem == Elem::Int) {
+        std::memcpy(c.ints, leaf->as<int32_t>()->items, leaf->count * sizeof(int32_t));
+        c.lanes = Lanes::Int;
+    } else if (leaf->elem == Elem::Float) {
+        std::memcpy(c.floats, leaf->as<float>()->items, leaf->count * sizeof(float));
+        c.lanes = Lanes::Float;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// n lanes at a time, leaving the result in stack[0]. Returns false if they
+// need running a value at a time instead.
+bool Kernel::columns(const Column *args, int n, const std::vector<Value> &captured, Column *stack) {
+#if defined(__SSE2__)
+    Column *top = stack;
+    for (size_t pc = 0; pc < code.size();) {
+        switch ((Op)code[pc]) {
+            case Op::Arg:
+                *top++ = args[code[pc + 1]];
+                pc += 2;
+                break;
+
+            case Op::Const:
+                if (!fill(*top++, constants[code[pc + 1]]))
+                    return false;
+                pc += 2;
+                break;
+
+            case Op::Load:
+                if (!fill(*top++, captured[code[pc + 1]]))
+                    return false;
+                pc += 2;
+                break;
+
+            case Op::Op2:
+                top--;
+                if (!lanes2((Op2)code[pc + 1], top[-1], top[0], n))
+                    return false;
+                pc += 2;
+                break;
+
+            case Op::Op1:
+                if (!lanes1((Op1)code[pc + 1], top[-1]))
+                    return false;
+                pc += 2;
+                break;
+
+            // Both sides run; the Op2 or Select after them picks
+            case Op::ShortCircuit:
+            case Op::Branch:
+                pc += 3;
+                break;
+
+            case Op::Jump:
+                pc += 2;
+                break;
+
+            case Op::Select:
+                top -= 2;
+                if (!blend(top[-1], top[0], top[1]))
+                    return false;
+                pc += 1;
+                break;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Kernel::mapColumns(ListLeaf *leaf, const std::vector<Value> &captured, Column *stack, Column &out) {
+    Column arg;
+    if (!column(leaf, arg) || !columns(&arg, leaf->count, captured, stack))
+        return false;
+    out = stack[0];
+    return true;
+}
+
+// Pairs of values become their results, in one column, until one is left.
+// A value without a pair waits for the next round, which needs it to have
+// the same type as the results.
+bool Kernel::reduceColumns(ListLeaf *leaf, const std::vector<Value> &captured, Column *stack, Column &out) {
+    if (!column(leaf, out))
+        return false;
+    int n = leaf->count;
+    while (n > 1) {
+        int m = n / 2;
+        Column pairs[2];
+        for (int i = 0; i < m; ++i) {
+            pairs[0].ints[i] = out.ints[2 * i];
+            pairs[1].ints[i] = out.ints[2 * i + 1];
+        }
+        pairs[0].lanes = pairs[1].lanes = out.lanes;
+        if (!columns(pairs, m, captured, stack))
+            return false;
+        if (n % 2 == 1) {
+            if (stack[0].lanes != out.lanes)
+                return false;
+            stack[0].ints[m] = out.ints[n - 1];
+        }
+        out = stack[0];
+        n = m + n % 2;
+    }
+    return true;
+}
+
+// The same pairs as reduceColumns, a value at a time
+Value Kernel::reduceScalar(ListLeaf *leaf, const std::vector<Value> &captured, std::vector<Value> &stack) {
+    Roots roots;
+    Value values[Width];
+    int n = leaf->count;
+    leaf->read(0, n, values);
+    while (n > 1) {
+        int m = n / 2;
+        for (int i = 0; i < m; ++i) {
+            Value pair[2] = {values[2 * i], values[2 * i + 1]};
+            values[i] = scalar(pair, captured, stack);
+            roots.push(values[i]);
+        }
+        if (n % 2 == 1)
+            values[m] = values[n - 1];
+        n = m + n % 2;
+    }
+    return values[0];
+}
+
+// The leaves under a node, and what the body gives for each in columns:
+// worked out for all of them on the Pool when running in parallel, and a
+// leaf at a time, as they're asked for, when not.
+class Kernel::Leaves {
+    typedef bool (Kernel::*Each)(ListLeaf *, const std::vector<Value> &, Column *, Column &);
+
+    Kernel &kernel;
+    Each each;
+    const std::vector<Value> &captured;
+    bool parallel;
+    std::vector<Column> results;
+    std::vector<char> done;
+    std::vector<Column> stack;
+
+    public:
+    std::vector<ListLeaf*> leaves;
+
+    Leaves (Kernel &k, Each e, ListNode *node, const std::vector<Value> &c, bool p)
+        : kernel(k), each(e), captured(c), stack(k.max_depth) {
+        parallel = p;
+        forEachLeaf(node, [&](ListLeaf *leaf) { leaves.push_back(leaf); });
+        if (!parallel)
+            return;
+
+        // Each thread writes only its own leaves' results.
+        results.resize(leaves.size());
+        done.resize(leaves.size());
+        Pool::instance().run(leaves.size(), [&](size_t from, size_t to) {
+            std::vector<Column> own(kernel.max_depth);
+            for (size_t i = from; i < to; ++i) {
+                done[i] = (kernel.*each)(leaves[i], captured, own.data(), results[i]);
+            }
+        });
+    }
+
+    // Leaf i's results, or NULL if it has to run a value at a time.
+    const Column *get(size_t i) {
+        if (parallel)
+            return done[i] ? &results[i] : NULL;
+        results.resize(1);
+        return (kernel.*each)(leaves[i], captured, stack.data(), results[0]) ? &results[0] : NULL;
+    }
+};
+
+static Value lane(const Column &c, int i) {
+    if (c.lanes == Lanes::Int)
+        return Value::fromInt(c.ints[i]);
+    if (c.lanes == Lanes::Float)
+        return Value::fromFloat(c.floats[i]);
+    return Value::fromBool(c.ints[i] != 0);
+}
+
+void Kernel::map(Env *env, ListNode *node, ListBuilder &out, bool parallel) {
+    std::vector<Value> captured = capture(env);
+    std::vector<Value> values(max_depth);
+    Leaves run(*this, &Kernel::mapColumns, node, captured, parallel);
+
+    for (size_t l = 0; l < run.leaves.size(); ++l) {
+        ListLeaf *leaf = run.leaves[l];
+        int n = leaf->count;
+        const Column *res = run.get(l);
+        if (res == NULL) {
+            for (int i = 0; i < n; ++i) {
+                Value v = leaf->get(i);
+                out.add(scalar(&v, captured, values));
+            }
+        } else if (res->lanes == Lanes::Int) {
+            out.add(res->ints, n);
+        } else if (res->lanes == Lanes::Float) {
+            out.add(res->floats, n);
+        } else {
+            Value bools[Width];
+            for (int i = 0; i < n; ++i) {
+                bools[i] = lane(*res, i);
+            }
+            out.add(bools, n);
+        }
+    }
+}
+
+void Kernel::filter(Env *env, ListNode *node, ListBuilder &out, bool parallel) {
+    std::vector<Value> captured = capture(env);
+    std::vector<Value> values(max_depth);
+    Leaves run(*this, &Kernel::mapColumns, node, captured, parallel);
+
+    for (size_t l = 0; l < run.leaves.size(); ++l) {
+        ListLeaf *leaf = run.leaves[l];
+        int n = leaf->count;
+        const Column *res = run.get(l);
+        bool keep[Width];
+        if (res != NULL && res->lanes == Lanes::Bool) {
+            for (int i = 0; i < n; ++i) {
+                keep[i] = res->ints[i] != 0;
+            }
+        } else {
+            for (int i = 0; i < n; ++i) {
+                Value v = leaf->get(i);
+                v = scalar(&v, captured, values);
+                if (!v.isBool())
+                    throw "filter: predicate gave " + v.typeName() + ", not bool";
+                keep[i] = v.asBool();
+            }
+        }
+
+        withItems(leaf, [&](auto *items) {
+            std::remove_pointer_t<decltype(items)> kept[Width];
+            int k = 0;
+            for (int i = 0; i < n; ++i) {
+                if (keep[i])
+                    kept[k++] = items[i];
+            }
+            out.add(kept, k);
+        });
+    }
+}
+
+Value Kernel::reduce(Env *env, ListNode *node, bool parallel) {
+    std::vector<Value> captured = capture(env);
+    std::vector<Value> values(max_depth);
+    Leaves run(*this, &Kernel::reduceColumns, node, captured, parallel);
+
+    Roots roots;
+    Value total;
+    for (size_t l = 0; l < run.leaves.size(); ++l) {
+        const Column *res = run.get(l);
+        Value v = res != NULL ? lane(*res, 0) : reduceScalar(run.leaves[l], captured, values);
+        roots.push(v);
+        if (l == 0) {
+            total = v;
+        } else {
+            Value pair[2] = {total, v};
+            total = scalar(pair, captured, values);
+            roots.push(total);
+        }
+    }
+    return total;
+}
+
+int32_t sumInts(const int32_t *items, int n) {
+    uint32_t sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i*)(items + i)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; ++i) {
+        sum += (uint32_t)items[i];
+    }
+    return (int32_t)sum;
+}
+
+float sumFloats(const float *items, int n) {
+    float sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_loadu_ps(items + i));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) {
+        sum += items[i];
+    }
+    return sum;
+}
+
+int32_t dotInts(const int32_t *a, const int32_t *b, int n) {
+    uint32_t sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi32(acc, mullo(x, y));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; ++i) {
+        sum += (uint32_t)a[i] * (uint32_t)b[i];
+    }
+    return (int32_t)sum;
+}
+
+float dotFloats(const float *a, const float *b, int n) {
+    float sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
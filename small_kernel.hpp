@@ -0,0 +1,157 @@
+#ifndef SMALL_KERNEL_HPP
+#define SMALL_KERNEL_HPP
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_ops.hpp"
+#include "small_values.hpp"
+#include "small_list.hpp"
+#include "small_symbol.hpp"
+
+// The body of a lambda, compiled for map, filter and preduce to run over a
+// whole leaf of a list at a time.
+//
+// Bodies that use only the argument, literals, captured variables,
+// operators and ifs compile; see Expr::kernel. The code is a small stack
+// machine with two ways to run it. Over a leaf of ints or floats, each
+// instruction works on a column of Width lanes at once, with SSE2, and both
+// sides of every if and && are computed and then blended. That gives the
+// same results as running the body on each value, unless a lane would fail
+// or the lanes' types don't fit, and then the leaf is run again a value at a
+// time, with the operators and errors the interpreter has. So do leaves of
+// chars or of mixed values, and everything on machines without SSE2.
+//
+// Running in columns reads nothing but the leaf and the captured values,
+// which are fetched beforehand, so the parallel versions run the columns on
+// the Pool and then go through the leaves in order on the caller's thread,
+// adding the columns' results and running the leaves that fell back.
+class Kernel {
+    public:
+    enum class Op : int32_t {
+        // [param]
+        Arg
+        // [constant]
+        ,Const
+        // [capture]
+        ,Load
+        // [op]
+        ,Op2
+        ,Op1
+        // [op, end]: jumps to end when the left side decides && or ||
+        ,ShortCircuit
+        // [else, message]: pops the condition, and jumps if it's false
+        ,Branch
+        // [end]: from the end of the then branch to the Select
+        ,Jump
+        // Joins the branches of an if
+        ,Select
+    };
+
+    // How a column holds its lanes. Bools are 0 or 1 in an int lane.
+    enum class Lanes : uint8_t {
+        Int
+        ,Float
+        ,Bool
+    };
+
+    struct alignas(16) Column {
+        union {
+            int32_t ints[ListNode::Width];
+            float floats[ListNode::Width];
+        };
+        Lanes lanes;
+    };
+
+    private:
+    struct Capture {
+        int depth, slot;
+        Symbol name;
+    };
+
+    std::vector<int> params;
+    std::vector<int32_t> code;
+    std::vector<Value> constants;
+    std::vector<Capture> captures;
+    std::vector<std::string> strings;
+    int depth, max_depth;
+
+    Kernel (const std::vector<int> &p);
+
+    void emit(Op, std::initializer_list<int32_t> operands, int effect);
+
+    // The captured variables' values, or null values for unbound ones
+    std::vector<Value> capture(Env *env);
+
+    bool columns(const Column *args, int n, const std::vector<Value> &captured, Column *stack);
+
+    Value scalar(const Value *args, const std::vector<Value> &captured, std::vector<Value> &stack);
+
+    class Leaves;
+
+    bool mapColumns(ListLeaf *, const std::vector<Value> &captured, Column *stack, Column &out);
+
+    bool reduceColumns(ListLeaf *, const std::vector<Value> &captured, Column *stack, Column &out);
+
+    Value reduceScalar(ListLeaf *, const std::vector<Value> &captured, std::vector<Value> &stack);
+
+    public:
+    // The lambda's kernel, or NULL if its body won't compile to one.
+    static Kernel *compile(ELambda *);
+
+    int getArity() {
+        return params.size();
+    }
+
+    // What the nodes compile to; each returns false if it can't.
+    bool load(int depth, int slot, Symbol name);
+
+    bool constant(Value);
+
+    void op2(Op2);
+
+    void op1(Op1);
+
+    // Returns the operand that patch() points at what comes next.
+    int shortCircuit(Op2);
+
+    int branch(const std::string &message);
+
+    int jump();
+
+    void select();
+
+    void patch(int operand);
+
+    // Runs the body on every value under node, in order, and adds what it
+    // gives to out. env is the closure's. With parallel, the leaves are
+    // spread over the Pool's threads.
+    void map(Env *env, ListNode *node, ListBuilder &out, bool parallel);
+
+    // Adds to out the values under node the body gives true for. Throws if
+    // it gives anything but a bool.
+    void filter(Env *env, ListNode *node, ListBuilder &out, bool parallel);
+
+    // Combines the values under node, which mustn't be NULL, with a body of
+    // two arguments: in pairs within each leaf, the pairs' results in pairs
+    // and so on, and then the leaves' results from left to right. That's
+    // the same whichever way the leaves are run, and the same as combining
+    // from left to right when the body is associative.
+    Value reduce(Env *env, ListNode *node, bool parallel);
+};
+
+// Sums and dot products of n items. Ints wrap at 32 bits, like +; floats
+// are added in four lanes and then across them, so they can differ in the
+// last bits from adding left to right.
+int32_t sumInts(const int32_t *items, int n);
+
+float sumFloats(const float *items, int n);
+
+int32_t dotInts(const int32_t *a, const int32_t *b, int n);
+
+float dotFloats(const float *a, const float *b, int n);
+
+#endif
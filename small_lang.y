@@ -1,48 +1,76 @@
 %{
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <thread>
 #include <vector>
 
-extern "C" int yylex();
-extern "C" int yyparse();
-extern "C" FILE *yyin;
-
-void yyerror(const char *msg);
+#include <unistd.h>
 %}
 
 %code requires {
 #include "small_lang_includes.h"
+
+// The lexer's state, as flex declares it
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
 }
 
 %code {
-// The root of the AST
-AST *ast;
-
-// tmp Expr list for building list literals and tuples
-// TODO: Got to be a safer way to do this. Consider nested lists!
-std::vector<Expr *> tmp_expr_list;
-std::vector<char*> tmp_str_list;
+#include "small_lexer.hpp"
+#include "small_pool.hpp"
+#include "small_memo.hpp"
+#include "small_profile.hpp"
+#include "small_stats.hpp"
+#include "small_repl.hpp"
+
+int flexLex(YYSTYPE *, YYLTYPE *, yyscan_t);
+void yyerror(YYLTYPE *, yyscan_t, ParseContext *, const char *msg);
+
+// From the reentrant lexer
+int yylex_init_extra(ParseContext *, yyscan_t *);
+struct yy_buffer_state *yy_scan_buffer(char *, size_t, yyscan_t);
+void yyset_lineno(int, yyscan_t);
+int yylex_destroy(yyscan_t);
+
+// Tokens come from the hand-written lexer if the parse has one, or flex's
+static int yylex(YYSTYPE *lval, YYLTYPE *loc, yyscan_t scanner, ParseContext *ctx) {
+    if (ctx->lexer != NULL)
+        return ctx->lexer->next(lval, loc);
+    return flexLex(lval, loc, scanner);
+}
 }
 
+%define api.pure full
 %define parse.error verbose
 %locations
+%param {yyscan_t scanner} {ParseContext *ctx}
 
 %union{
     int ival;
     float fval;
-    char *id;
-    char *strlit;
+    Symbol id;
+    Span span;
     char charlit;
     bool boollit;
     Op2 op2;
     Op1 op1;
     Expr *expr;
     Statement *stateval;
+    Seq *seqval;
+    std::vector<Expr*> *exprs;
+    std::vector<Symbol> *ids;
 }
 
 %token <ival> INT
 %token <fval> FLOAT
 %token <id> ID
-%token <strlit> STRING
+%token <span> STRING
 %token <charlit> CHAR
 %token <boollit> BOOL
 
@@ -73,99 +101,97 @@ std::vector<char*> tmp_str_list;
 %token RETURN
 
 %type <expr> expr list tuple lambda app if
-%type <stateval> program stmt seq func_body
+%type <seqval> program
+%type <stateval> stmt func_body
+%type <seqval> seq
+%type <exprs> comma_sep_exprs
+%type <ids> id_list
 
 %token END 0 "end of file"
 %%
 
 program:
-    ENDLS seq   { $$ = $2; ast = new AST($$); }
-    | seq       { $$ = $1; ast = new AST($$);}
+    ENDLS seq   { $$ = $2; ctx->ast = new AST($$, ctx->arena, ctx->source); ctx->arena = NULL; ctx->source = NULL; }
+    | seq       { $$ = $1; ctx->ast = new AST($$, ctx->arena, ctx->source); ctx->arena = NULL; ctx->source = NULL; }
 
+// Left-recursive, so the parser stack stays flat however long the program
 seq:
-   stmt ENDLS seq  { $$ = new Seq($1, $3); }
-   | stmt ENDLS    { $$ = $1; }
+   seq stmt ENDLS  { $$ = $1; $$->append($2); }
+   | stmt ENDLS    { $$ = ctx->arena->make<Seq>($1); }
 
 stmt:
-    ID '=' expr   { $$ = new Assign($1, $3); }
+    ID '=' expr   { $$ = ctx->arena->make<Assign>($1, $3, @$.first_line); }
     | FUNC ID[name] id_list '=' '{' func_body[body] '}'
-        { $$ = new Assign($name, new ELambda(tmp_str_list, $body)); tmp_str_list.clear(); }
+        { $$ = ctx->arena->make<Assign>($name, ctx->arena->make<ELambda>($name, *$3, $body, @$.first_line, @$.first_column), @$.first_line); }
     | FUNC ID[name] '=' '{' func_body[body] '}'
-        { $$ = new Assign($name, new ELambda(tmp_str_list, $body)); tmp_str_list.clear(); }
-    | RETURN expr { $$ = new Return($2); }
+        { $$ = ctx->arena->make<Assign>($name, ctx->arena->make<ELambda>($name, std::vector<Symbol>(), $body, @$.first_line, @$.first_column), @$.first_line); }
+    | RETURN expr { $$ = ctx->arena->make<Return>($2, @$.first_line); }
 
 expr:
-    INT     { $$ = new EInt($1); }
-    | FLOAT  { $$ = new EFloat($1); }
-    | ID     { $$ = new EId($1); }
-    | STRING { $$ = new EString($1); }
-    | CHAR   { $$ = new EChar($1); }
-    | BOOL   { $$ = new EBool($1); }
+    INT     { $$ = ctx->arena->intern<EInt>($1); }
+    | FLOAT  { $$ = ctx->arena->intern<EFloat>($1); }
+    | ID     { $$ = ctx->arena->intern<EId>($1); }
+    | STRING { $$ = ctx->arena->intern<EString>(ctx->source->view($1)); }
+    | CHAR   { $$ = ctx->arena->intern<EChar>($1); }
+    | BOOL   { $$ = ctx->arena->intern<EBool>($1); }
     | '(' expr ')' { $$ = $2; }
     | list   { $$ = $1; }
     | tuple  { $$ = $1; }
     | lambda { $$ = $1; }
     | app    { $$ = $1; }
     | if     { $$ = $1; }
-    | expr ADD expr { $$ = new EOp2(Op2::Add, $1, $3); }
-    | expr SUB expr { $$ = new EOp2(Op2::Sub, $1, $3); }
-    | expr MUL expr { $$ = new EOp2(Op2::Mul, $1, $3); }
-    | expr DIV expr { $$ = new EOp2(Op2::Div, $1, $3); }
-    | expr MOD expr { $$ = new EOp2(Op2::Mod, $1, $3); }
-    | expr LAND expr { $$ = new EOp2(Op2::LAnd, $1, $3); }
-    | expr LOR expr { $$ = new EOp2(Op2::LOr, $1, $3); }
-    | expr LT expr { $$ = new EOp2(Op2::Lt, $1, $3); }
-    | expr LTE expr { $$ = new EOp2(Op2::Lte, $1, $3); }
-    | expr GT expr { $$ = new EOp2(Op2::Gt, $1, $3); }
-    | expr GTE expr { $$ = new EOp2(Op2::Gte, $1, $3); }
-    | expr EQ expr { $$ = new EOp2(Op2::Eq, $1, $3); }
-    | LNOT expr      { $$ = new EOp1(Op1::LNot, $2); }
-    | SUB expr %prec NEG { $$ = new EOp1(Op1::Neg, $2); }
-
+    | expr ADD expr { $$ = ctx->arena->intern<EOp2>(Op2::Add, $1, $3); }
+    | expr SUB expr { $$ = ctx->arena->intern<EOp2>(Op2::Sub, $1, $3); }
+    | expr MUL expr { $$ = ctx->arena->intern<EOp2>(Op2::Mul, $1, $3); }
+    | expr DIV expr { $$ = ctx->arena->intern<EOp2>(Op2::Div, $1, $3); }
+    | expr MOD expr { $$ = ctx->arena->intern<EOp2>(Op2::Mod, $1, $3); }
+    | expr LAND expr { $$ = ctx->arena->intern<EOp2>(Op2::LAnd, $1, $3); }
+    | expr LOR expr { $$ = ctx->arena->intern<EOp2>(Op2::LOr, $1, $3); }
+    | expr LT expr { $$ = ctx->arena->intern<EOp2>(Op2::Lt, $1, $3); }
+    | expr LTE expr { $$ = ctx->arena->intern<EOp2>(Op2::Lte, $1, $3); }
+    | expr GT expr { $$ = ctx->arena->intern<EOp2>(Op2::Gt, $1, $3); }
+    | expr GTE expr { $$ = ctx->arena->intern<EOp2>(Op2::Gte, $1, $3); }
+    | expr EQ expr { $$ = ctx->arena->intern<EOp2>(Op2::Eq, $1, $3); }
+    | LNOT expr      { $$ = ctx->arena->intern<EOp1>(Op1::LNot, $2); }
+    | SUB expr %prec NEG { $$ = ctx->arena->intern<EOp1>(Op1::Neg, $2); }
+
+// Lists are built in the arena, so a nested list or call gets its own
 comma_sep_exprs:
-    expr    { tmp_expr_list.push_back($1); }
-    | comma_sep_exprs ',' expr { tmp_expr_list.push_back($3); }
+    expr    { $$ = ctx->arena->make<std::vector<Expr*> >(1, $1); }
+    | comma_sep_exprs ',' expr { $$ = $1; $$->push_back($3); }
 
 list:
-    '[' comma_sep_exprs ']' { $$ = new EList(tmp_expr_list); tmp_expr_list.clear(); }
-    | '[' ']' { $$ = new EList(tmp_expr_list); tmp_expr_list.clear(); }
-
-tuple_body:
-          %empty
-          | tuple_body ',' expr[e] { tmp_expr_list.push_back($e); }
+    '[' comma_sep_exprs ']' { $$ = ctx->arena->intern<EList>(*$2); }
+    | '[' ']' { $$ = ctx->arena->intern<EList>(std::vector<Expr*>()); }
 
 tuple:
-     '(' expr[e1]
-        { tmp_expr_list.push_back($e1); }
-     ',' expr[e2]
-        { tmp_expr_list.push_back($e2); }
-     tuple_body ')'
-        { $$ = new ETuple(tmp_expr_list); tmp_expr_list.clear(); }
-    | '(' ')' { $$ = new ETuple(); }
+     '(' expr[e1] ',' comma_sep_exprs[rest] ')'
+        { $rest->insert($rest->begin(), $e1); $$ = ctx->arena->intern<ETuple>(*$rest); }
+    | '(' ')' { $$ = ctx->arena->intern<ETuple>(std::vector<Expr*>()); }
 
 id_list:
-       ID           { tmp_str_list.push_back($1); }
-       | id_list ID { tmp_str_list.push_back($2); }
+       ID           { $$ = ctx->arena->make<std::vector<Symbol> >(1, $1); }
+       | id_list ID { $$ = $1; $$->push_back($2); }
 
 func_body:
-         expr  { $$ = new Return($1); }
+         expr  { $$ = ctx->arena->make<Return>($1, @$.first_line); }
          | seq { $$ = $1; }
 
 lambda:
       LAMBDA_OPEN id_list LAMBDA_ARROW func_body ')'
-       { $$ = new ELambda(tmp_str_list, $4); tmp_str_list.clear(); }
+       { $$ = ctx->arena->make<ELambda>(*$2, $4, @$.first_line, @$.first_column); }
       | LAMBDA_OPEN LAMBDA_ARROW func_body ')'
-       { $$ = new ELambda(tmp_str_list, $3); tmp_str_list.clear(); }
+       { $$ = ctx->arena->make<ELambda>(std::vector<Symbol>(), $3, @$.first_line, @$.first_column); }
 
 app:
    expr[fun] '(' comma_sep_exprs ')'
-      { $$ = new EApp($fun, tmp_expr_list); tmp_expr_list.clear(); }
+      { $$ = ctx->arena->intern<EApp>($fun, *$3); }
    | expr '(' ')'
-      { $$ = new EApp($1, tmp_expr_list); }
+      { $$ = ctx->arena->intern<EApp>($1, std::vector<Expr*>()); }
 
 if:
   IF expr[cond] THEN expr[t_body] ELSE expr[f_body]
-    { $$ = new EIf($cond, $t_body, $f_body); }
+    { $$ = ctx->arena->intern<EIf>($cond, $t_body, $f_body); }
 
 ENDLS:
      ENDL
@@ -173,31 +199,481 @@ ENDLS:
 
 %%
 
+// Parses source, which starts on the given line, into an AST that takes it
+// over, or returns NULL and deletes it. Adds any errors to errors.
+static AST *parseSource(Source *source, int line, std::string &errors) {
+    ParseContext ctx;
+    ctx.source = source;
+    ctx.arena = new NodeArena();
+    ctx.ast = NULL;
+    ctx.line = line;
+    ctx.column = 1;
+
+    Lexer fast(&ctx);
+    ctx.lexer = Lexer::enabled ? &fast : NULL;
+
+    // Either lexer scans the source where it is, rather than reading it
+    yyscan_t scanner;
+    yylex_init_extra(&ctx, &scanner);
+    yy_scan_buffer(source->getBuffer(), source->getBufferSize(), scanner);
+    yyset_lineno(line, scanner);
+    yyparse(scanner, &ctx);
+    yylex_destroy(scanner);
+
+    // A failed parse leaves its nodes and source behind
+    delete ctx.arena;
+    delete ctx.source;
+    errors += ctx.errors;
+    return ctx.ast;
+}
+
+// Parses each chunk of source on a thread of its own, from a copy of it with
+// its own NULs, and appends the ASTs in order. Returns NULL if any chunk
+// fails; source is left alone either way.
+static AST *parseChunks(Source *source, const std::vector<Chunk> &chunks, std::string &errors) {
+    std::vector<AST*> asts(chunks.size(), NULL);
+    std::vector<std::string> chunk_errors(chunks.size());
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        pool.emplace_back([&, i]() {
+            Source *part = Source::copy(source->getBuffer() + chunks[i].offset, chunks[i].size);
+            if (part != NULL)
+                asts[i] = parseSource(part, chunks[i].line, chunk_errors[i]);
+        });
+    }
+    for (std::vector<std::thread>::iterator it = pool.begin(); it != pool.end(); ++it) {
+        it->join();
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < asts.size(); ++i) {
+        ok = ok && asts[i] != NULL;
+    }
+    if (!ok) {
+        for (size_t i = 0; i < asts.size(); ++i) {
+            delete asts[i];
+        }
+        return NULL;
+    }
+
+    for (size_t i = 0; i < asts.size(); ++i) {
+        if (i > 0)
+            asts[0]->append(asts[i]);
+        errors += chunk_errors[i];
+    }
+    return asts[0];
+}
+
+ParseResult parseFile(const std::string &path, unsigned threads) {
+    ParseResult res;
+    res.file = path;
+    res.ast = NULL;
+
+    Source *source = Source::open(path);
+    res.opened = source != NULL;
+    if (source == NULL) {
+        res.errors = "Failed to open " + path + "\n";
+        return res;
+    }
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads > 1) {
+        std::vector<Chunk> chunks = splitSource(source->getBuffer(), source->getSize(), threads);
+        if (chunks.size() > 1) {
+            res.ast = parseChunks(source, chunks, res.errors);
+            if (res.ast != NULL) {
+                delete source;
+                return res;
+            }
+        }
+    }
+
+    res.ast = parseSource(source, 1, res.errors);
+    return res;
+}
+
+AST *parseText(const std::string &text, int line, std::string &errors) {
+    Source *source = Source::copy(text.data(), text.size());
+    if (source == NULL) {
+        errors += "Out of memory\n";
+        return NULL;
+    }
+    return parseSource(source, line, errors);
+}
+
+// Each worker takes the next file that nobody has taken yet, so one slow
+// file doesn't hold up the rest.
+std::vector<ParseResult> parseFiles(const std::vector<std::string> &paths, unsigned threads) {
+    std::vector<ParseResult> results(paths.size());
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    if (threads > paths.size())
+        threads = paths.size();
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i) {
+        pool.emplace_back([&]() {
+            for (size_t f = next++; f < paths.size(); f = next++) {
+                results[f] = parseFile(paths[f]);
+            }
+        });
+    }
+    for (std::vector<std::thread>::iterator it = pool.begin(); it != pool.end(); ++it) {
+        it->join();
+    }
+    return results;
+}
+
+// The command line. Programs that link the parser into their own, like
+// bench/suite.cpp, build without it.
+#ifndef SMALL_NO_MAIN
+
+// Evaluates ast with one engine. On success, fills out with a line per
+// top-level binding; on failure, with the error message.
+static bool evaluate(AST *ast, Engine engine, std::vector<std::string> &out) {
+    try {
+        Env *env = ast->eval(engine);
+
+        const std::vector<Symbol> &names = ast->getGlobals();
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (!env->get(i).isNull())
+                out.push_back(names[i].getName() + " = " + env->get(i).toString());
+        }
+        Heap::instance.unpin(env);
+        return true;
+    } catch (const char *msg) {
+        out.push_back(msg);
+    } catch (std::string msg) {
+        out.push_back(msg);
+    }
+    return false;
+}
+
+static void print(std::vector<std::string> &lines) {
+    for (std::vector<std::string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+        std::cout << *it << std::endl;
+    }
+}
+
+static void printGcStats() {
+    GcStats s = Heap::instance.getStats();
+    std::cout << "GC: " << s.cycles << " cycles, " << s.steps << " steps, "
+        << "pause total " << s.total_pause_ns / 1000 << "us, "
+        << "max " << s.max_pause_ns / 1000 << "us" << std::endl;
+    std::cout << "GC: " << s.objects << " objects (" << s.bytes << " bytes) live, "
+        << "peak " << s.peak_bytes << " bytes, "
+        << s.freed_objects << " objects (" << s.freed_bytes << " bytes) freed" << std::endl;
+}
+
+static void printMemoStats() {
+    MemoStats s = Memo::instance.getStats();
+    std::cout << "Memo: " << s.hits << " hits, " << s.misses << " misses, "
+        << s.evictions << " evicted, " << s.entries << " kept" << std::endl;
+}
+
+static void printCount(const std::string &what, const AllocCount &c) {
+    std::cout << "Stats:   " << what << ": " << c.count << " (" << c.bytes << " bytes)" << std::endl;
+}
+
+// What was allocated, by heap type, frame, node type and line; lines come
+// most bytes first, the top 20.
+static void printStats(AST *ast) {
+    const size_t Top = 20;
+
+    GcStats gc = Heap::instance.getStats();
+    std::cout << "Stats: heap: " << gc.objects + gc.freed_objects << " objects ("
+        << gc.bytes + gc.freed_bytes << " bytes) allocated, " << gc.bytes << " bytes live, peak "
+        << gc.peak_bytes << " bytes" << std::endl;
+    std::vector<std::pair<std::string, AllocCount> > types = Stats::instance.byType();
+    for (size_t i = 0; i < types.size(); ++i) {
+        printCount(types[i].first, types[i].second);
+    }
+
+    std::cout << "Stats: frames: " << Stats::instance.framesMade().count << " made ("
+        << Stats::instance.framesMade().bytes << " bytes), " << Stats::instance.framesReused()
+        << " reused" << std::endl;
+
+    NodeArena *arena = ast->getArena();
+    std::vector<std::pair<std::string, AllocCount> > nodes;
+    AllocCount all = AllocCount();
+    for (std::unordered_map<std::type_index, AllocCount>::const_iterator it = arena->getMade().begin(); it != arena->getMade().end(); ++it) {
+        nodes.push_back(std::make_pair(Stats::typeName(it->first), it->second));
+        all.count += it->second.count;
+        all.bytes += it->second.bytes;
+    }
+    size_t shared = 0;
+    for (std::unordered_map<std::type_index, size_t>::const_iterator it = arena->getShared().begin(); it != arena->getShared().end(); ++it) {
+        shared += it->second;
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const std::pair<std::string, AllocCount> &a, const std::pair<std::string, AllocCount> &b) {
+        return a.first < b.first;
+    });
+    std::cout << "Stats: nodes: " << all.count << " made (" << all.bytes << " bytes), "
+        << shared << " more shared" << std::endl;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        printCount(nodes[i].first, nodes[i].second);
+    }
+
+    std::vector<std::pair<int, AllocCount> > lines(Stats::instance.byLine().begin(), Stats::instance.byLine().end());
+    std::sort(lines.begin(), lines.end(), [](const std::pair<int, AllocCount> &a, const std::pair<int, AllocCount> &b) {
+        return a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes : a.first < b.first;
+    });
+    std::cout << "Stats: lines: " << lines.size() << " allocated" << std::endl;
+    for (size_t i = 0; i < lines.size() && i < Top; ++i) {
+        printCount("line " + std::to_string(lines[i].first), lines[i].second);
+    }
+}
+
+// Writes the profile's stacks to path, and prints the functions that spent
+// the most time themselves.
+static void printProfile(const std::string &path) {
+    const size_t Top = 20;
+
+    std::ofstream out(path);
+    Profiler::instance.writeFolded(out);
+    if (!out)
+        std::cout << "Profile: failed to write " << path << std::endl;
+
+    std::vector<ProfileEntry> entries = Profiler::instance.summary();
+    std::cout << "Profile: " << entries.size() << " functions; stacks in " << path << std::endl;
+    std::cout << "Profile:        calls     total ms      self ms  function" << std::endl;
+    for (size_t i = 0; i < entries.size() && i < Top; ++i) {
+        char line[64];
+        snprintf(line, sizeof(line), "%12llu %12.3f %12.3f", (unsigned long long)entries[i].calls,
+            entries[i].total_ns / 1e6, entries[i].self_ns / 1e6);
+        std::cout << "Profile: " << line << "  " << entries[i].name << std::endl;
+    }
+}
+
+// Parses every file at once, and reports the ones that failed. When split,
+// the files are parsed one at a time instead, each by every thread. Either
+// way, --threads sets how many there are.
+static int parseAll(const std::vector<std::string> &files, bool split) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<ParseResult> results;
+    if (split) {
+        for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+            results.push_back(parseFile(*it, Pool::threads));
+        }
+    } else {
+        results = parseFiles(files, Pool::threads);
+    }
+    std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+
+    int failed = 0;
+    for (std::vector<ParseResult>::iterator it = results.begin(); it != results.end(); ++it) {
+        if (it->ast == NULL) {
+            std::cout << it->file << ":\n" << it->errors;
+            failed++;
+        }
+        delete it->ast;
+    }
+    std::cout << "Parsed " << results.size() - failed << " of " << results.size()
+        << " files in " << took.count() << "ms." << std::endl;
+    return failed == 0 ? 0 : 2;
+}
+
+// Runs a session over stdin, one statement a line, after the file if there
+// is one; see Repl. Blank lines and comments are skipped, and lines that
+// start with a colon are commands: :reset forgets everything entered so
+// far, and :quit ends the session. Prompts only when stdin is a terminal,
+// so statements can be piped in.
+static int runRepl(const std::vector<std::string> &files, Engine engine, bool fold, bool gc_stats, const std::string &profile) {
+    Repl repl(engine, fold);
+    bool ok = true;
+    if (!files.empty()) {
+        ParseResult parsed = parseFile(files[0]);
+        std::cout << parsed.errors;
+        if (!parsed.opened)
+            return 1;
+        if (parsed.ast == NULL) {
+            std::cout << "Parsing failed." << std::endl;
+            return 2;
+        }
+        ok = repl.enter(parsed.ast, std::cout);
+    }
+
+    bool prompt = isatty(0);
+    std::string text;
+    for (int line = 1; ; ++line) {
+        if (prompt)
+            std::cout << "> " << std::flush;
+        if (!std::getline(std::cin, text))
+            break;
+
+        size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string::npos || text.compare(start, 2, "//") == 0)
+            continue;
+        if (text[start] == ':') {
+            std::string command = text.substr(start, text.find_last_not_of(" \t\r") + 1 - start);
+            if (command == ":quit")
+                break;
+            else if (command == ":reset")
+                repl.reset();
+            else
+                std::cout << "Unknown command: " << command << std::endl;
+            continue;
+        }
+
+        std::string errors;
+        AST *program = parseText(text + "\n", line, errors);
+        std::cout << errors;
+        if (program == NULL)
+            ok = false;
+        else
+            ok = repl.enter(program, std::cout) && ok;
+    }
+    if (prompt)
+        std::cout << std::endl;
+
+    if (gc_stats)
+        printGcStats();
+    if (Memo::enabled)
+        printMemoStats();
+    if (!profile.empty())
+        printProfile(profile);
+    if (Stats::enabled && repl.getAST() != NULL)
+        printStats(repl.getAST());
+    return ok ? 0 : 3;
+}
+
 int main( int argc, char** argv) {
-    yyin = fopen(argv[1], "r");
-    if (!yyin) {
-        std::cout << "Failed to open " << argv[1] << std::endl;
+    Engine engine = Engine::Tree;
+    bool compare = false;
+    bool gc_stats = false;
+    bool fold = true;
+    bool emit_llvm = false;
+    bool parse_only = false;
+    bool split = false;
+    bool repl = false;
+    std::string profile;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--vm")
+            engine = Engine::VM;
+        else if (arg == "--compare")
+            compare = true;
+        else if (arg == "--gc-stats")
+            gc_stats = true;
+        else if (arg == "--no-fold")
+            fold = false;
+        else if (arg == "--no-jit")
+            Jit::enabled = false;
+        else if (arg == "--memo")
+            Memo::enabled = true;
+        else if (arg == "--stats")
+            Stats::enabled = true;
+        else if (arg == "--profile" && i + 1 < argc)
+            profile = argv[++i];
+        else if (arg == "--emit-llvm")
+            emit_llvm = true;
+        else if (arg == "--fast-lex")
+            Lexer::enabled = true;
+        else if (arg == "--parse-only")
+            parse_only = true;
+        else if (arg == "--split")
+            split = true;
+        else if (arg == "--repl")
+            repl = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            Pool::threads = std::stoi(argv[++i]);
+        else
+            files.push_back(arg);
+    }
+
+    Profiler::enabled = !profile.empty();
+
+    if (parse_only && !files.empty())
+        return parseAll(files, split);
+
+    if (repl && files.size() <= 1)
+        return runRepl(files, engine, fold, gc_stats, profile);
+
+    if (files.size() != 1) {
+        std::cout << "Usage: " << argv[0] << " [--vm | --compare] [--gc-stats] [--no-fold] [--no-jit] [--memo] [--stats] [--profile out.folded] [--fast-lex] [--split] [--threads n] [--emit-llvm] file.smol" << std::endl;
+        std::cout << "       " << argv[0] << " [--vm] [--no-fold] [--no-jit] [--memo] [--gc-stats] [--stats] [--profile out.folded] --repl [file.smol]" << std::endl;
+        std::cout << "       " << argv[0] << " [--fast-lex] [--split] --parse-only file.smol..." << std::endl;
         return 1;
     }
 
-    while (!feof(yyin)) {
-		yyparse();
-    };
-    std::cout << "Parsing completed." << std::endl;
-    fclose(yyin);
+    // Nothing but the module goes to stdout, so it can be piped to llc
+    std::ostream &log = emit_llvm ? std::cerr : std::cout;
+
+    ParseResult parsed = parseFile(files[0], split ? Pool::threads : 1);
+    log << parsed.errors;
+    AST *ast = parsed.ast;
+    if (!parsed.opened)
+        return 1;
+
+    if (!emit_llvm)
+        std::cout << "Parsing completed." << std::endl;
 
     if (ast == NULL) {
-        std::cout << "Parsing failed." << std::endl;
+        log << "Parsing failed." << std::endl;
         return 2;
-    } else {
+    } else if (!emit_llvm) {
         std::cout << "The program:\n" << ast->toString() << std::endl;;
     }
-    return 0;
+
+    ast->resolve();
+    if (fold)
+        ast->optimize();
+
+    if (emit_llvm) {
+        try {
+            std::cout << ast->emitIR();
+        } catch (std::string msg) {
+            std::cerr << msg;
+            return 2;
+        }
+        return 0;
+    }
+
+    // Run both engines and check that they end in the same state, or fail
+    // with the same error.
+    if (compare) {
+        std::vector<std::string> tree, vm;
+        bool tree_ok = evaluate(ast, Engine::Tree, tree);
+        bool vm_ok = evaluate(ast, Engine::VM, vm);
+        if (tree_ok != vm_ok || tree != vm) {
+            std::cout << "Engines disagree.\nTree:" << std::endl;
+            print(tree);
+            std::cout << "VM:" << std::endl;
+            print(vm);
+            return 4;
+        }
+        std::cout << "Engines agree." << std::endl;
+        print(tree);
+        return 0;
+    }
+
+    std::vector<std::string> results;
+    bool ok = evaluate(ast, engine, results);
+    if (!ok) {
+        std::cout << "Evaluation failed: " << results.back() << std::endl;
+    } else {
+        std::cout << "Evaluation completed." << std::endl;
+        print(results);
+    }
+    if (gc_stats)
+        printGcStats();
+    if (Memo::enabled)
+        printMemoStats();
+    if (!profile.empty())
+        printProfile(profile);
+    if (Stats::enabled)
+        printStats(ast);
+    return ok ? 0 : 3;
 }
 
-void yyerror(const char *msg) {
-    std::cout << "Parse error at ";
-    std::cout << yylloc.first_line << ":" << yylloc.first_column << " - ";
-    std::cout << yylloc.last_line << ":" << yylloc.last_column << ": ";
-    std::cout << msg << std::endl;
+#endif
+
+void yyerror(YYLTYPE *loc, yyscan_t, ParseContext *ctx, const char *msg) {
+    ctx->error(loc->first_line, loc->first_column, loc->last_line, loc->last_column, msg);
 }
@@ -1,3 +1,22 @@
 class Expr;
+class ELambda;
+class EApp;
 class Statement;
 class Value;
+class Object;
+class Env;
+class Scope;
+class Proto;
+class Compiler;
+class Folder;
+class IRGen;
+class JitCode;
+class Jit;
+enum class JitType;
+class NodeArena;
+class AST;
+class Source;
+class Lexer;
+class ListNode;
+class VBuiltin;
+class Kernel;
@@ -5,5 +5,6 @@
 #include "small_stmt.hpp"
 #include "small_ast.hpp"
 #include "small_ops.hpp"
+#include "small_parse.hpp"
 
 #endif
@@ -0,0 +1,357 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "small_lexer.hpp"
+
+bool Lexer::enabled = false;
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool isHex(char c) {
+    return isDigit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+static bool isIdStart(char c) {
+    return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+static bool isIdChar(char c) {
+    return isIdStart(c) || isDigit(c);
+}
+
+// The scanners below find the first byte from p that ends a run, 16 bytes at
+// a time while there are 16 left, and return end if there is none. Each
+// comparison gives a mask with a bit set per byte that ends the run.
+
+#if defined(__SSE2__)
+static const char *firstSet(const char *p, unsigned mask) {
+    return p + __builtin_ctz(mask);
+}
+#endif
+
+// The first byte that isn't a space or a tab
+static const char *skipBlanks(const char *p, const char *end) {
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    for (; end - p >= 16; p += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)p);
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_cmpeq_epi8(c, tab));
+        unsigned mask = ~_mm_movemask_epi8(blank) & 0xFFFF;
+        if (mask != 0)
+            return firstSet(p, mask);
+    }
+#endif
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+// The first byte that is a or b
+static const char *findEither(const char *p, const char *end, char a, char b) {
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)p);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(c, va), _mm_cmpeq_epi8(c, vb)));
+        if (mask != 0)
+            return firstSet(p, mask);
+    }
+#endif
+    while (p < end && *p != a && *p != b)
+        p++;
+    return p;
+}
+
+// The first byte that can't be in an identifier. Bytes over 0x7F compare as
+// negative, so they never count as letters.
+static const char *skipIdChars(const char *p, const char *end) {
+#if defined(__SSE2__)
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1), after_z = _mm_set1_epi8('z' + 1);
+    const __m128i before_0 = _mm_set1_epi8('0' - 1), after_9 = _mm_set1_epi8('9' + 1);
+    const __m128i underscore = _mm_set1_epi8('_');
+    for (; end - p >= 16; p += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)p);
+        __m128i l = _mm_or_si128(c, lower);
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, before_a), _mm_cmpgt_epi8(after_z, l));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, before_0), _mm_cmpgt_epi8(after_9, c));
+        __m128i id = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(c, underscore));
+        unsigned mask = ~_mm_movemask_epi8(id) & 0xFFFF;
+        if (mask != 0)
+            return firstSet(p, mask);
+    }
+#endif
+    while (p < end && isIdChar(*p))
+        p++;
+    return p;
+}
+
+Lexer::Lexer (ParseContext *c) {
+    ctx = c;
+    text = c->source->getBuffer();
+    pos = text;
+    end = text + c->source->getSize();
+    line = c->line;
+}
+
+void Lexer::locate(YYLTYPE *loc, const char *start) {
+    int len = pos - start;
+    loc->first_line = loc->last_line = line;
+    loc->first_column = ctx->column;
+    loc->last_column = ctx->column + len - 1;
+    ctx->column += len;
+}
+
+// The longest of an int, a float and a hex int, as flex would pick. The
+// token ends where the next one starts, so atoi and strtol stop at its end;
+// a float is copied out, since strtod would read a signed exponent the
+// lexer doesn't.
+int Lexer::number(YYSTYPE *lval, YYLTYPE *loc) {
+    const char *start = pos;
+    const char *p = pos;
+    if (*p == '+' || *p == '-')
+        p++;
+    while (p < end && isDigit(*p))
+        p++;
+    const char *dec = p;
+
+    const char *flt = NULL;
+    if (dec + 1 < end && *dec == '.' && isDigit(dec[1])) {
+        flt = dec + 1;
+        while (flt < end && isDigit(*flt))
+            flt++;
+        if (flt + 1 < end && (*flt == 'e' || *flt == 'E') && isDigit(flt[1])) {
+            flt++;
+            while (flt < end && isDigit(*flt))
+                flt++;
+        }
+    }
+
+    const char *hex = NULL;
+    if (start + 2 < end && start[0] == '0' && start[1] == 'x' && isHex(start[2])) {
+        hex = start + 2;
+        while (hex < end && isHex(*hex))
+            hex++;
+    }
+
+    if (hex != NULL && hex > dec && (flt == NULL || hex > flt)) {
+        pos = hex;
+        locate(loc, start);
+        lval->ival = (int)strtol(start, NULL, 16);
+        return INT;
+    }
+    if (flt != NULL) {
+        pos = flt;
+        locate(loc, start);
+        lval->fval = atof(std::string(start, pos - start).c_str());
+        return FLOAT;
+    }
+    pos = dec;
+    locate(loc, start);
+    lval->ival = atoi(start);
+    return INT;
+}
+
+// A keyword, a bool or an identifier
+int Lexer::word(YYSTYPE *lval, YYLTYPE *loc) {
+    const char *start = pos;
+    pos = skipIdChars(pos + 1, end);
+    locate(loc, start);
+
+    size_t len = pos - start;
+    switch (len) {
+        case 2:
+            if (std::memcmp(start, "if", 2) == 0)
+                return IF;
+            break;
+        case 4:
+            if (std::memcmp(start, "then", 4) == 0)
+                return THEN;
+            if (std::memcmp(start, "else", 4) == 0)
+                return ELSE;
+            if (std::memcmp(start, "func", 4) == 0)
+                return FUNC;
+            if (std::memcmp(start, "true", 4) == 0) {
+                lval->boollit = true;
+                return BOOL;
+            }
+            break;
+        case 5:
+            if (std::memcmp(start, "false", 5) == 0) {
+                lval->boollit = false;
+                return BOOL;
+            }
+            break;
+        case 6:
+            if (std::memcmp(start, "return", 6) == 0)
+                return RETURN;
+            break;
+    }
+    lval->id = Symbol::intern(start, len);
+    return ID;
+}
+
+// 'c' for any c but a quote (even a newline), '\n', '\'' or '\xDD' with
+// decimal digits read as hex. Returns 0 if none of them is here.
+int Lexer::character(YYSTYPE *lval, YYLTYPE *loc) {
+    const char *p = pos;
+    size_t left = end - p;
+    size_t len = 0;
+    if (left >= 6 && p[1] == '\\' && p[2] == 'x' && isDigit(p[3]) && isDigit(p[4]) && p[5] == '\'')
+        len = 6;
+    else if (left >= 4 && p[1] == '\\' && (p[2] == 'n' || p[2] == '\'') && p[3] == '\'')
+        len = 4;
+    else if (left >= 3 && p[1] != '\'' && p[2] == '\'')
+        len = 3;
+    else
+        return 0;
+
+    pos += len;
+    if (p[1] == '\n')
+        line++;
+    locate(loc, p);
+    if (len == 3)
+        lval->charlit = p[1];
+    else if (len == 6)
+        lval->charlit = (char)strtol(std::string(p + 3, 2).c_str(), NULL, 16);
+    else
+        lval->charlit = p[2];
+    return CHAR;
+}
+
+int Lexer::next(YYSTYPE *lval, YYLTYPE *loc) {
+    while (pos < end) {
+        const char *start = pos;
+        char c = *pos;
+        char n = pos + 1 < end ? pos[1] : '\0';
+
+        switch (c) {
+            case ' ':
+            case '\t':
+                pos = skipBlanks(pos, end);
+                locate(loc, start);
+                continue;
+            case '\n':
+                pos++;
+                line++;
+                locate(loc, start);
+                ctx->column = 1;
+                return ENDL;
+            case ';':
+                pos++;
+                locate(loc, start);
+                return ENDL;
+            case '[': case ']': case ')': case '{': case '}': case ',':
+                pos++;
+                locate(loc, start);
+                return c;
+            case '(':
+                pos += n == '\\' ? 2 : 1;
+                locate(loc, start);
+                return n == '\\' ? (int)LAMBDA_OPEN : (int)'(';
+            case '=':
+                pos += n == '=' ? 2 : 1;
+                locate(loc, start);
+                return n == '=' ? (int)EQ : (int)'=';
+            case '<':
+                pos += n == '=' ? 2 : 1;
+                locate(loc, start);
+                return n == '=' ? LTE : LT;
+            case '>':
+                pos += n == '=' ? 2 : 1;
+                locate(loc, start);
+                return n == '=' ? GTE : GT;
+            case '!':
+                pos++;
+                locate(loc, start);
+                return LNOT;
+            case '*':
+                pos++;
+                locate(loc, start);
+                return MUL;
+            case '%':
+                pos++;
+                locate(loc, start);
+                return MOD;
+            case '-':
+                // An arrow swallows the newline after it, without resetting
+                // the column
+                if (n == '>') {
+                    const char *p = skipBlanks(pos + 2, end);
+                    if (p < end && *p == '\n') {
+                        pos = p + 1;
+                        line++;
+                    } else {
+                        pos += 2;
+                    }
+                    locate(loc, start);
+                    return LAMBDA_ARROW;
+                }
+                // fall through
+            case '+':
+                if (isDigit(n))
+                    return number(lval, loc);
+                pos++;
+                locate(loc, start);
+                return c == '+' ? ADD : SUB;
+            case '/':
+                // A comment runs to the end of its line, which must be there
+                if (n == '/') {
+                    const char *p = findEither(pos + 2, end, '\n', '\n');
+                    if (p < end) {
+                        pos = p;
+                        locate(loc, start);
+                        continue;
+                    }
+                }
+                pos++;
+                locate(loc, start);
+                return DIV;
+            case '&':
+            case '|':
+                if (n == c) {
+                    pos += 2;
+                    locate(loc, start);
+                    return c == '&' ? LAND : LOR;
+                }
+                break;
+            case '"': {
+                const char *p = findEither(pos + 1, end, '"', '\n');
+                if (p < end && *p == '"') {
+                    pos = p + 1;
+                    locate(loc, start);
+                    lval->span = ctx->source->span(start, pos - start);
+                    return STRING;
+                }
+                break;
+            }
+            case '\'': {
+                int tok = character(lval, loc);
+                if (tok != 0)
+                    return tok;
+                break;
+            }
+            default:
+                if (isDigit(c))
+                    return number(lval, loc);
+                if (isIdStart(c))
+                    return word(lval, loc);
+                break;
+        }
+
+        // Anything else is one byte flex doesn't know either
+        pos++;
+        locate(loc, start);
+        ctx->error(loc->first_line, loc->first_column, loc->last_line, loc->last_column, "Unknown token");
+    }
+    return 0;
+}
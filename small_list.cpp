@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "small_list.hpp"
+
+template <>
+void LeafOf<Value>::trace(Heap &heap) {
+    for (int i = 0; i < count; ++i) {
+        heap.mark(items[i]);
+    }
+}
+
+Value ListLeaf::get(int i) {
+    Value v;
+    withItems(this, [&](auto *items) { v = boxed(items[i]); });
+    return v;
+}
+
+void ListLeaf::read(int from, int n, Value *out) {
+    withItems(this, [&](auto *items) {
+        for (int i = 0; i < n; ++i) {
+            out[i] = boxed(items[from + i]);
+        }
+    });
+}
+
+ListBranch::ListBranch (ListNode *const *nodes, int n) : ListNode(0, n, nodes[0]->elem) {
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) {
+        children[i] = nodes[i];
+        total += nodes[i]->size();
+        sizes[i] = total;
+        if (nodes[i]->height >= height)
+            height = nodes[i]->height + 1;
+        if (nodes[i]->elem != elem)
+            elem = Elem::Value;
+    }
+}
+
+void ListBranch::trace(Heap &heap) {
+    for (int i = 0; i < count; ++i) {
+        heap.mark(children[i]);
+    }
+}
+
+// A child holds at most Width^height values, so i's child is at least
+// i >> (Bits * height) along: exactly there if the children are full, and
+// a step or two further if they aren't.
+int ListBranch::find(size_t &i) {
+    int shift = Bits * height;
+    int c = shift < 64 ? (int)(i >> shift) : 0;
+    while (sizes[c] <= i)
+        c++;
+    if (c > 0)
+        i -= sizes[c - 1];
+    return c;
+}
+
+// Every node an operation makes stays on the root stack until the list that
+// holds it has been made, since making the next node may run the collector.
+
+template <typename T>
+static ListNode *makeLeaf(Roots &roots, const T *items, int n) {
+    ListNode *leaf = Heap::instance.make<LeafOf<T> >(items, n);
+    roots.push(leaf);
+    return leaf;
+}
+
+// Each unboxes v into out, if it's of out's type.
+static bool unboxed(Value v, int32_t &out) {
+    out = v.asInt();
+    return v.isInt();
+}
+
+static bool unboxed(Value v, float &out) {
+    out = v.asFloat();
+    return v.isFloat();
+}
+
+static bool unboxed(Value v, char &out) {
+    out = v.asChar();
+    return v.isChar();
+}
+
+template <typename T>
+static bool unbox(const Value *items, int n, T *out) {
+    for (int i = 0; i < n; ++i) {
+        if (!unboxed(items[i], out[i]))
+            return false;
+    }
+    return true;
+}
+
+// Values go into the tightest leaf that holds them, so a leaf is only ever
+// boxed if its values really are of different types.
+template <>
+ListNode *makeLeaf<Value>(Roots &roots, const Value *items, int n) {
+    int32_t ints[ListNode::Width];
+    float floats[ListNode::Width];
+    char chars[ListNode::Width];
+    Value first = items[0];
+    switch (first.getTag()) {
+        case Tag::Int:
+            if (unbox(items, n, ints))
+                return makeLeaf(roots, ints, n);
+            break;
+        case Tag::Float:
+            if (unbox(items, n, floats))
+                return makeLeaf(roots, floats, n);
+            break;
+        case Tag::Char:
+            if (unbox(items, n, chars))
+                return makeLeaf(roots, chars, n);
+            break;
+        default:
+            break;
+    }
+    ListNode *leaf = Heap::instance.make<LeafOf<Value> >(items, n);
+    roots.push(leaf);
+    return leaf;
+}
+
+static ListNode *makeBranch(Roots &roots, ListNode *const *children, int n) {
+    // A branch of one adds nothing but height
+    if (n == 1)
+        return children[0];
+    ListNode *branch = Heap::instance.make<ListBranch>(children, n);
+    roots.push(branch);
+    return branch;
+}
+
+// Joins nodes of one height into a tree, a level at a time.
+static ListNode *buildTree(Roots &roots, std::vector<ListNode*> level) {
+    while (level.size() > 1) {
+        std::vector<ListNode*> up;
+        for (size_t i = 0; i < level.size(); i += ListNode::Width) {
+            up.push_back(makeBranch(roots, &level[i], std::min((size_t)ListNode::Width, level.size() - i)));
+        }
+        level.swap(up);
+    }
+    return level[0];
+}
+
+// A tree of full nodes over n values, or NULL if there are none.
+static ListNode *build(Roots &roots, const Value *items, size_t n) {
+    if (n == 0)
+        return NULL;
+
+    std::vector<ListNode*> leaves;
+    for (size_t i = 0; i < n; i += ListNode::Width) {
+        leaves.push_back(makeLeaf(roots, items + i, std::min((size_t)ListNode::Width, n - i)));
+    }
+    return buildTree(roots, leaves);
+}
+
+// Puts n values or nodes into one node, or into two if there are more than
+// fit. Then one of the two is full: the one on the side that gave the most,
+// so that appending (or prepending) one value at a time fills nodes up
+// rather than leaving a trail of half-empty ones.
+template <typename T, typename Make>
+static int pack(Roots &roots, T *items, int n, bool left_full, ListNode **out, Make make) {
+    if (n <= ListNode::Width) {
+        out[0] = make(roots, items, n);
+        return 1;
+    }
+    int first = left_full ? ListNode::Width : n - ListNode::Width;
+    out[0] = make(roots, items, first);
+    out[1] = make(roots, items + first, n - first);
+    return 2;
+}
+
+// Joins a and b, in that order, into one or two nodes, which go in out.
+// Only the nodes along the seam between them are rebuilt: the shorter tree
+// is merged into the taller one's spine at its own height, and where they
+// meet, two leaves (or branches) become one or two.
+static int merge(Roots &roots, ListNode *a, ListNode *b, ListNode **out) {
+    if (a->height == 0 && b->height == 0) {
+        ListLeaf *l = static_cast<ListLeaf*>(a);
+        ListLeaf *r = static_cast<ListLeaf*>(b);
+        int n = l->count + r->count;
+        bool left_full = l->count >= r->count;
+        if (l->elem != r->elem) {
+            Value items[2 * ListNode::Width];
+            l->read(0, l->count, items);
+            r->read(0, r->count, items + l->count);
+            return pack(roots, items, n, left_full, out, makeLeaf<Value>);
+        }
+
+        int made = 0;
+        withItems(l, [&](auto *left) {
+            typedef std::remove_pointer_t<decltype(left)> T;
+            T items[2 * ListNode::Width];
+            std::copy(left, left + l->count, items);
+            std::copy(r->as<T>()->items, r->as<T>()->items + r->count, items + l->count);
+            made = pack(roots, items, n, left_full, out, makeLeaf<T>);
+        });
+        return made;
+    }
+
+    ListNode *nodes[2 * ListNode::Width];
+    int n = 0;
+    bool left_full;
+    if (a->height > b->height) {
+        ListBranch *l = static_cast<ListBranch*>(a);
+        n = std::copy(l->children, l->children + l->count - 1, nodes) - nodes;
+        n += merge(roots, l->children[l->count - 1], b, nodes + n);
+        left_full = true;
+    } else if (a->height < b->height) {
+        ListBranch *r = static_cast<ListBranch*>(b);
+        n = merge(roots, a, r->children[0], nodes);
+        n = std::copy(r->children + 1, r->children + r->count, nodes + n) - nodes;
+        left_full = false;
+    } else {
+        ListBranch *l = static_cast<ListBranch*>(a);
+        ListBranch *r = static_cast<ListBranch*>(b);
+        n = std::copy(l->children, l->children + l->count - 1, nodes) - nodes;
+        n += merge(roots, l->children[l->count - 1], r->children[0], nodes + n);
+        n = std::copy(r->children + 1, r->children + r->count, nodes + n) - nodes;
+        left_full = l->count >= r->count;
+    }
+    return pack(roots, nodes, n, left_full, out, makeBranch);
+}
+
+static ListNode *join(Roots &roots, ListNode *a, ListNode *b) {
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+
+    ListNode *out[2];
+    if (merge(roots, a, b, out) == 1)
+        return out[0];
+    return makeBranch(roots, out, 2);
+}
+
+// The first n values of node, for 0 < n <= its size. Copies the nodes along
+// the path to the last value kept, and shares everything left of it.
+static ListNode *take(Roots &roots, ListNode *node, size_t n) {
+    if (n == node->size())
+        return node;
+    if (node->height == 0) {
+        ListNode *leaf = NULL;
+        withItems(static_cast<ListLeaf*>(node), [&](auto *items) { leaf = makeLeaf(roots, items, n); });
+        return leaf;
+    }
+
+    ListBranch *b = static_cast<ListBranch*>(node);
+    size_t i = n - 1;
+    int c = b->find(i);
+    ListNode *nodes[ListNode::Width];
+    std::copy(b->children, b->children + c, nodes);
+    nodes[c] = take(roots, b->children[c], i + 1);
+    return makeBranch(roots, nodes, c + 1);
+}
+
+// All but the first n values of node, for 0 <= n < its size.
+static ListNode *drop(Roots &roots, ListNode *node, size_t n) {
+    if (n == 0)
+        return node;
+    if (node->height == 0) {
+        ListLeaf *leaf = static_cast<ListLeaf*>(node);
+        ListNode *rest = NULL;
+        withItems(leaf, [&](auto *items) { rest = makeLeaf(roots, items + n, leaf->count - n); });
+        return rest;
+    }
+
+    ListBranch *b = static_cast<ListBranch*>(node);
+    size_t i = n;
+    int c = b->find(i);
+    ListNode *nodes[ListNode::Width];
+    nodes[0] = drop(roots, b->children[c], i);
+    std::copy(b->children + c + 1, b->children + b->count, nodes + 1);
+    return makeBranch(roots, nodes, b->count - c);
+}
+
+static void collect(ListNode *node, std::vector<Value> &out) {
+    if (node->height == 0) {
+        ListLeaf *leaf = static_cast<ListLeaf*>(node);
+        size_t end = out.size();
+        out.resize(end + leaf->count);
+        leaf->read(0, leaf->count, &out[end]);
+        return;
+    }
+    ListBranch *b = static_cast<ListBranch*>(node);
+    for (int i = 0; i < b->count; ++i) {
+        collect(b->children[i], out);
+    }
+}
+
+// The nodes are made before the list is, and rooted only until the end of
+// the constructor; nothing allocates between then and Heap::make tracking
+// the list, which traces them from then on.
+VList::VList (std::vector<Value> l) : Object(ObjKind::List) {
+    Roots roots;
+    root = build(roots, l.data(), l.size());
+}
+
+VList::VList (Value e) : Object(ObjKind::List) {
+    Roots roots;
+    root = build(roots, &e, 1);
+}
+
+size_t VList::size() {
+    return root != NULL ? root->size() : 0;
+}
+
+Value VList::get(size_t i) {
+    ListNode *node = root;
+    while (node->height > 0) {
+        ListBranch *b = static_cast<ListBranch*>(node);
+        node = b->children[b->find(i)];
+    }
+    return static_cast<ListLeaf*>(node)->get(i);
+}
+
+std::vector<Value> VList::getValue() {
+    std::vector<Value> values;
+    values.reserve(size());
+    if (root != NULL)
+        collect(root, values);
+    return values;
+}
+
+void VList::trace(Heap &heap) {
+    heap.mark(root);
+}
+
+VList *VList::concat(VList *a, VList *b) {
+    Roots roots;
+    roots.push(a);
+    roots.push(b);
+    return Heap::instance.make<VList>(join(roots, a->root, b->root));
+}
+
+VList *VList::append(VList *a, Value v) {
+    Roots roots;
+    roots.push(a);
+    roots.push(v);
+    return Heap::instance.make<VList>(join(roots, a->root, makeLeaf(roots, &v, 1)));
+}
+
+VList *VList::slice(size_t from, size_t to) {
+    Roots roots;
+    roots.push(this);
+    ListNode *node = NULL;
+    if (from < to)
+        node = drop(roots, take(roots, root, to), from);
+    return Heap::instance.make<VList>(node);
+}
+
+void ListBuilder::add(Value v) {
+    if (v.isInt()) {
+        int32_t i = v.asInt();
+        add(&i, 1);
+    } else if (v.isFloat()) {
+        float f = v.asFloat();
+        add(&f, 1);
+    } else if (v.isChar()) {
+        char c = v.asChar();
+        add(&c, 1);
+    } else {
+        add(&v, 1);
+    }
+}
+
+void ListBuilder::box() {
+    Value boxes[ListNode::Width];
+    for (int i = 0; i < count; ++i) {
+        switch (elem) {
+            case Elem::Int: boxes[i] = boxed(ints[i]); break;
+            case Elem::Float: boxes[i] = boxed(floats[i]); break;
+            case Elem::Char: boxes[i] = boxed(chars[i]); break;
+            case Elem::Value: boxes[i] = values[i]; break;
+        }
+    }
+    std::copy(boxes, boxes + count, values);
+    elem = Elem::Value;
+}
+
+void ListBuilder::flush() {
+    switch (elem) {
+        case Elem::Value: leaves.push_back(makeLeaf(roots, values, count)); break;
+        case Elem::Int: leaves.push_back(makeLeaf(roots, ints, count)); break;
+        case Elem::Float: leaves.push_back(makeLeaf(roots, floats, count)); break;
+        case Elem::Char: leaves.push_back(makeLeaf(roots, chars, count)); break;
+    }
+    count = 0;
+}
+
+ListNode *ListBuilder::finish() {
+    if (count > 0)
+        flush();
+    if (leaves.empty())
+        return NULL;
+    return buildTree(roots, leaves);
+}
@@ -0,0 +1,242 @@
+#ifndef SMALL_LIST_HPP
+#define SMALL_LIST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "small_heap.hpp"
+#include "small_values.hpp"
+
+// How a leaf stores its values. A leaf whose values are all ints, all floats
+// or all chars keeps them unboxed, packed into an array of int32_t, float or
+// char; any other mix is kept as Values. A branch's elem is its children's
+// when they all agree, and Value when they don't, so a list's root says
+// whether every value in it has one type.
+enum class Elem : uint8_t {
+    Value
+    ,Int
+    ,Float
+    ,Char
+};
+
+// The Elem a leaf of items of type T has.
+template <typename T> struct ElemOf;
+template <> struct ElemOf<Value> { static const Elem elem = Elem::Value; };
+template <> struct ElemOf<int32_t> { static const Elem elem = Elem::Int; };
+template <> struct ElemOf<float> { static const Elem elem = Elem::Float; };
+template <> struct ElemOf<char> { static const Elem elem = Elem::Char; };
+
+// An item as a Value
+inline Value boxed(Value v) { return v; }
+inline Value boxed(int32_t i) { return Value::fromInt(i); }
+inline Value boxed(float f) { return Value::fromFloat(f); }
+inline Value boxed(char c) { return Value::fromChar(c); }
+
+// The nodes of a list: a relaxed radix balanced (RRB) tree. Leaves hold up
+// to Width values and branches up to Width children, each branch with a
+// table of its children's running sizes, so children needn't be full and
+// two trees can be joined by rebuilding only the nodes along the seam.
+//
+// Nodes never change once made, so lists share them freely: concatenating,
+// appending or slicing makes O(log n) new nodes and reuses the rest. They
+// are heap objects like any value, and a node is made with its contents, so
+// it never needs the write barrier.
+class ListNode : public HeapObject {
+    public:
+    static const int Bits = 5;
+    static const int Width = 1 << Bits;
+
+    // 0 for a leaf; otherwise one more than the tallest child
+    int height;
+    // Values in a leaf, children in a branch
+    int count;
+    Elem elem;
+
+    ListNode (int h, int c, Elem e) {
+        height = h;
+        count = c;
+        elem = e;
+    }
+
+    // The number of values under this node
+    inline size_t size();
+};
+
+template <typename T> class LeafOf;
+
+// A leaf is a LeafOf its elem's item type.
+class ListLeaf : public ListNode {
+    public:
+    ListLeaf (int n, Elem e) : ListNode(0, n, e) {}
+
+    template <typename T>
+    LeafOf<T> *as() {
+        return static_cast<LeafOf<T>*>(this);
+    }
+
+    // The value at i, boxed if need be.
+    Value get(int i);
+
+    // Copies values from through from + n - 1 to out, boxed.
+    void read(int from, int n, Value *out);
+};
+
+template <typename T>
+class LeafOf : public ListLeaf {
+    public:
+    T items[Width];
+
+    LeafOf (const T *values, int n) : ListLeaf(n, ElemOf<T>::elem) {
+        for (int i = 0; i < n; ++i) {
+            items[i] = values[i];
+        }
+    }
+
+    virtual void trace(Heap &);
+
+    virtual size_t footprint() {
+        return sizeof(LeafOf<T>);
+    }
+};
+
+// Only boxed values can point into the heap.
+template <typename T>
+void LeafOf<T>::trace(Heap &) {}
+
+template <>
+void LeafOf<Value>::trace(Heap &);
+
+// Calls f with leaf's items, as a pointer to its item type.
+template <typename F>
+void withItems(ListLeaf *leaf, F f) {
+    switch (leaf->elem) {
+        case Elem::Value: f(leaf->as<Value>()->items); break;
+        case Elem::Int: f(leaf->as<int32_t>()->items); break;
+        case Elem::Float: f(leaf->as<float>()->items); break;
+        case Elem::Char: f(leaf->as<char>()->items); break;
+    }
+}
+
+class ListBranch : public ListNode {
+    public:
+    ListNode *children[Width];
+    // sizes[i] is the number of values in children 0 through i
+    size_t sizes[Width];
+
+    ListBranch (ListNode *const *nodes, int n);
+
+    virtual void trace(Heap &);
+
+    virtual size_t footprint() {
+        return sizeof(ListBranch);
+    }
+
+    // The child holding value i, and i's index within it.
+    int find(size_t &i);
+};
+
+size_t ListNode::size() {
+    if (height == 0)
+        return count;
+    return static_cast<ListBranch*>(this)->sizes[count - 1];
+}
+
+// Calls f on each leaf under node, in order.
+template <typename F>
+void forEachLeaf(ListNode *node, F f) {
+    if (node == NULL)
+        return;
+    if (node->height == 0) {
+        f(static_cast<ListLeaf*>(node));
+        return;
+    }
+    ListBranch *b = static_cast<ListBranch*>(node);
+    for (int i = 0; i < b->count; ++i) {
+        forEachLeaf(b->children[i], f);
+    }
+}
+
+// Builds a list from values added in order, a leaf at a time. Runs of one
+// type go into leaves of that type until a value of another type arrives;
+// the leaf being filled then falls back to boxed Values.
+//
+// Leaves are rooted in roots as they're made, and so is every object added,
+// so it's safe to allocate between adds.
+class ListBuilder {
+    Roots &roots;
+    std::vector<ListNode*> leaves;
+    Elem elem;
+    int count;
+    union {
+        Value values[ListNode::Width];
+        int32_t ints[ListNode::Width];
+        float floats[ListNode::Width];
+        char chars[ListNode::Width];
+    };
+
+    template <typename T>
+    T *buffer();
+
+    void flush();
+
+    // Boxes the partial leaf, to take a value of another type.
+    void box();
+
+    public:
+    ListBuilder (Roots &r) : roots(r) {
+        elem = Elem::Value;
+        count = 0;
+    }
+
+    void add(Value);
+
+    template <typename T>
+    void add(const T *items, int n);
+
+    // The tree over everything added, or NULL if nothing was.
+    ListNode *finish();
+};
+
+template <> inline Value *ListBuilder::buffer<Value>() { return values; }
+template <> inline int32_t *ListBuilder::buffer<int32_t>() { return ints; }
+template <> inline float *ListBuilder::buffer<float>() { return floats; }
+template <> inline char *ListBuilder::buffer<char>() { return chars; }
+
+inline void keep(Roots &roots, Value v) {
+    roots.push(v);
+}
+
+template <typename T>
+void keep(Roots &, T) {}
+
+template <typename T>
+void ListBuilder::add(const T *items, int n) {
+    while (n > 0) {
+        if (count > 0 && elem != ElemOf<T>::elem && elem != Elem::Value)
+            box();
+        else if (count == 0)
+            elem = ElemOf<T>::elem;
+
+        int room = ListNode::Width - count;
+        int k = n < room ? n : room;
+        if (elem == ElemOf<T>::elem) {
+            T *buf = buffer<T>();
+            for (int i = 0; i < k; ++i) {
+                keep(roots, items[i]);
+                buf[count + i] = items[i];
+            }
+        } else {
+            for (int i = 0; i < k; ++i) {
+                values[count + i] = boxed(items[i]);
+            }
+        }
+        count += k;
+        items += k;
+        n -= k;
+        if (count == ListNode::Width)
+            flush();
+    }
+}
+
+#endif
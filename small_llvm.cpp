@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "small_llvm.hpp"
+#include "small_expr.hpp"
+#include "small_stmt.hpp"
+#include "small_values.hpp"
+
+// The runtime's entry points; see runtime/small_rt.cpp
+static const char *Declarations =
+    "@smol_sp = external global i64*\n"
+    "@smol_stack_limit = external global i64*\n"
+    "\n"
+    "declare void @smol_init()\n"
+    "declare void @smol_fail(i8*) noreturn cold\n"
+    "declare i8* @smol_globals(i32)\n"
+    "declare i8* @smol_frame(i64, i32)\n"
+    "declare i8* @smol_closure_env(i64)\n"
+    "declare i64 @smol_lookup(i8*, i32, i32)\n"
+    "declare void @smol_assign(i8*, i32, i64)\n"
+    "declare void @smol_bind(i8*, i32, i64)\n"
+    "declare i64 @smol_closure(i8*, i32, i8*, i8*)\n"
+    "declare i8* @smol_callee(i64, i32)\n"
+    "declare i64 @smol_string(i8*, i64)\n"
+    "declare i64 @smol_list(i64*, i32)\n"
+    "declare i64 @smol_tuple(i64*, i32)\n"
+    "declare i64 @smol_op2(i32, i64, i64)\n"
+    "declare i64 @smol_op1(i32, i64)\n"
+    "declare i64 @smol_builtin(i32, i64*, i32)\n"
+    "declare i32 @smol_finish(i8*, i8**, i32)\n"
+    "declare void @llvm.memset.p0i8.i64(i8*, i8, i64, i1)\n";
+
+// The type of the function for a lambda of this many parameters
+static std::string functionType(int arity) {
+    std::string type = "i64 (i64";
+    for (int i = 0; i < arity; ++i) {
+        type += ", i64";
+    }
+    return type + ")";
+}
+
+std::string IRGen::word(Value v) {
+    return std::to_string((int64_t)v.getBits());
+}
+
+// Keeps a frame's Env alive, in word 1
+static void saveEnv(IRGen *g) {
+    g->emit("%env_word = ptrtoint i8* %env to i64");
+    g->emit("%env_slot = getelementptr i64, i64* %frame, i64 1");
+    g->emit("store i64 %env_word, i64* %env_slot");
+}
+
+IRGen::IRGen () {
+    next_constant = 0;
+    next_lambda = 0;
+}
+
+void IRGen::begin(const std::string &header, bool stack_locals, int locals, bool top_level) {
+    Function *f = new Function();
+    f->header = header;
+    f->next_reg = 0;
+    f->next_label = 0;
+    f->base = 2 + (stack_locals ? locals : 0);
+    f->temps = 0;
+    f->max_temps = 0;
+    f->stack_locals = stack_locals;
+    f->top_level = top_level;
+    f->terminated = false;
+    f->block = "enter";
+    functions.push_back(f);
+}
+
+// The entry block claims the frame: it bumps the shadow stack pointer,
+// clears the words so the collector never sees stale ones, and saves the
+// closure being run.
+std::string IRGen::end() {
+    Function *f = functions.back();
+    functions.pop_back();
+    if (!f->terminated)
+        f->body << "  unreachable\n";
+
+    int size = f->base + f->max_temps;
+    std::stringstream out;
+    out << f->header << " {\n";
+    out << "entry:\n";
+    if (f->top_level)
+        out << "  call void @smol_init()\n";
+    out << "  %frame = load i64*, i64** @smol_sp\n";
+    out << "  %top = getelementptr i64, i64* %frame, i64 " << size << "\n";
+    out << "  %limit = load i64*, i64** @smol_stack_limit\n";
+    out << "  %full = icmp ugt i64* %top, %limit\n";
+    out << "  br i1 %full, label %overflow, label %enter\n";
+    out << "overflow:\n";
+    out << "  call void @smol_fail(i8* " << constant("Stack overflow") << ")\n";
+    out << "  unreachable\n";
+    out << "enter:\n";
+    out << "  store i64* %top, i64** @smol_sp\n";
+    out << "  %words = bitcast i64* %frame to i8*\n";
+    out << "  call void @llvm.memset.p0i8.i64(i8* %words, i8 0, i64 " << size * 8 << ", i1 false)\n";
+    if (!f->top_level)
+        out << "  store i64 %self, i64* %frame\n";
+    out << f->body.str();
+    out << "}\n\n";
+
+    delete f;
+    return out.str();
+}
+
+std::string IRGen::program(Statement *root, const std::vector<Symbol> &globals) {
+    int n = globals.size();
+    begin("define i32 @main()", false, n, true);
+    emit("%env = call i8* @smol_globals(i32 " + std::to_string(n) + ")");
+    saveEnv(this);
+
+    root->emitIR(this);
+    if (!isTerminated())
+        jump("done");
+
+    // The names to print the bindings under
+    std::stringstream names;
+    names << "@smol_names = private constant [" << n << " x i8*] [";
+    for (int i = 0; i < n; ++i) {
+        if (i > 0)
+            names << ", ";
+        names << "i8* " << constant(globals[i].getName());
+    }
+    names << "]\n";
+    constants << names.str();
+
+    block("done");
+    emit("%code = call i32 @smol_finish(i8* %env, i8** getelementptr ([" + std::to_string(n) +
+        " x i8*], [" + std::to_string(n) + " x i8*]* @smol_names, i64 0, i64 0), i32 " +
+        std::to_string(n) + ")");
+    emit("ret i32 %code");
+    fn().terminated = true;
+    std::string entry = end();
+
+    if (!rejected.empty()) {
+        std::string msg;
+        for (size_t i = 0; i < rejected.size(); ++i) {
+            msg += "Can't compile: " + rejected[i] + "\n";
+        }
+        throw msg;
+    }
+
+    std::stringstream module;
+    module << "; Generated from Small by --emit-llvm\n\n";
+    module << Declarations << "\n";
+    module << constants.str() << "\n";
+    module << definitions.str();
+    module << entry;
+    return module.str();
+}
+
+// A closure's frame hangs off the Env it closed over. Arguments are only in
+// registers until they are bound, so they are stored in the frame before
+// anything can allocate.
+std::string IRGen::lambda(ELambda *lambda) {
+    std::string name = "@smol_fn_" + std::to_string(next_lambda++);
+    const std::vector<int> &slots = lambda->getParamSlots();
+    int n = slots.size();
+
+    std::string header = "define internal fastcc i64 " + name + "(i64 %self";
+    for (int i = 0; i < n; ++i) {
+        header += ", i64 %a" + std::to_string(i);
+    }
+    header += ")";
+    begin(header, !lambda->isCaptured(), lambda->getFrameSize(), false);
+
+    if (stackLocals()) {
+        emit("%env = call i8* @smol_closure_env(i64 %self)");
+        for (int i = 0; i < n; ++i) {
+            bind(slots[i], "%a" + std::to_string(i), false);
+        }
+    } else {
+        for (int i = 0; i < n; ++i) {
+            store(pushTemp(), "%a" + std::to_string(i));
+        }
+        emit("%env = call i8* @smol_frame(i64 %self, i32 " + std::to_string(lambda->getFrameSize()) + ")");
+        saveEnv(this);
+        for (int i = 0; i < n; ++i) {
+            bind(slots[i], "%a" + std::to_string(i), false);
+        }
+        popTemps(n);
+    }
+
+    lambda->getBody()->emitIR(this);
+    if (!isTerminated())
+        fail("App: Function had no return statement");
+
+    definitions << end();
+    return name;
+}
+
+std::string IRGen::reg() {
+    return "%r" + std::to_string(fn().next_reg++);
+}
+
+std::string IRGen::label() {
+    return "L" + std::to_string(fn().next_label++);
+}
+
+void IRGen::emit(const std::string &instr) {
+    fn().body << "  " << instr << "\n";
+}
+
+void IRGen::block(const std::string &label) {
+    fn().body << label << ":\n";
+    fn().block = label;
+    fn().terminated = false;
+}
+
+void IRGen::jump(const std::string &label) {
+    emit("br label %" + label);
+    fn().terminated = true;
+}
+
+void IRGen::branch(const std::string &cond, const std::string &t, const std::string &f) {
+    emit("br i1 " + cond + ", label %" + t + ", label %" + f);
+    fn().terminated = true;
+}
+
+std::string IRGen::constant(const std::string &bytes) {
+    std::string name = "@.str." + std::to_string(next_constant++);
+    std::string size = std::to_string(bytes.size() + 1);
+
+    constants << name << " = private unnamed_addr constant [" << size << " x i8] c\"";
+    for (std::string::const_iterator it = bytes.begin(); it != bytes.end(); ++it) {
+        unsigned char c = *it;
+        if (c >= ' ' && c <= '~' && c != '"' && c != '\\') {
+            constants << c;
+        } else {
+            char hex[4];
+            std::snprintf(hex, sizeof(hex), "\\%02X", c);
+            constants << hex;
+        }
+    }
+    constants << "\\00\"\n";
+
+    return "getelementptr inbounds ([" + size + " x i8], [" + size + " x i8]* " + name + ", i64 0, i64 0)";
+}
+
+void IRGen::fail(const std::string &msg) {
+    emit("call void @smol_fail(i8* " + constant(msg) + ")");
+    emit("unreachable");
+    block(label());
+}
+
+void IRGen::failIf(const std::string &cond, const std::string &msg) {
+    std::string bad = label(), ok = label();
+    branch(cond, bad, ok);
+    block(bad);
+    emit("call void @smol_fail(i8* " + constant(msg) + ")");
+    emit("unreachable");
+    block(ok);
+}
+
+void IRGen::reject(const std::string &msg) {
+    if (std::find(rejected.begin(), rejected.end(), msg) == rejected.end())
+        rejected.push_back(msg);
+}
+
+std::string IRGen::phi(const std::vector<std::pair<std::string, std::string> > &incoming) {
+    std::string r = reg();
+    std::string instr = r + " = phi i64 ";
+    for (size_t i = 0; i < incoming.size(); ++i) {
+        if (i > 0)
+            instr += ", ";
+        instr += "[" + incoming[i].first + ", %" + incoming[i].second + "]";
+    }
+    emit(instr);
+    return r;
+}
+
+int IRGen::pushTemp() {
+    Function &f = fn();
+    int t = f.temps++;
+    if (f.temps > f.max_temps)
+        f.max_temps = f.temps;
+    return t;
+}
+
+void IRGen::popTemps(int n) {
+    fn().temps -= n;
+}
+
+std::string IRGen::temp(int t) {
+    std::string p = reg();
+    emit(p + " = getelementptr i64, i64* %frame, i64 " + std::to_string(fn().base + t));
+    return p;
+}
+
+void IRGen::store(int t, const std::string &value) {
+    emit("store i64 " + value + ", i64* " + temp(t));
+}
+
+// Boxes an i32 in r as an int value
+static std::string boxInt(IRGen *g, const std::string &r) {
+    std::string wide = g->reg(), high = g->reg(), v = g->reg();
+    g->emit(wide + " = zext i32 " + r + " to i64");
+    g->emit(high + " = shl i64 " + wide + ", 32");
+    g->emit(v + " = or i64 " + high + ", " + std::to_string((int)Tag::Int));
+    return v;
+}
+
+static std::string boxBool(IRGen *g, const std::string &r) {
+    std::string wide = g->reg(), high = g->reg(), v = g->reg();
+    g->emit(wide + " = zext i1 " + r + " to i64");
+    g->emit(high + " = shl i64 " + wide + ", 32");
+    g->emit(v + " = or i64 " + high + ", " + std::to_string((int)Tag::Bool));
+    return v;
+}
+
+// The payload of an int value
+static std::string unboxInt(IRGen *g, const std::string &v) {
+    std::string high = g->reg(), r = g->reg();
+    g->emit(high + " = lshr i64 " + v + ", 32");
+    g->emit(r + " = trunc i64 " + high + " to i32");
+    return r;
+}
+
+static std::string hasTag(IRGen *g, const std::string &v, Tag tag) {
+    std::string bits = g->reg(), r = g->reg();
+    g->emit(bits + " = and i64 " + v + ", 7");
+    g->emit(r + " = icmp eq i64 " + bits + ", " + std::to_string((int)tag));
+    return r;
+}
+
+// Must agree with intOp2. && and || have no int form.
+std::string IRGen::op2(Op2 op, const std::string &l, const std::string &r) {
+    std::string slow_call = "call i64 @smol_op2(i32 " + std::to_string((int)op) +
+        ", i64 " + l + ", i64 " + r + ")";
+    if (op == Op2::LAnd || op == Op2::LOr) {
+        std::string res = reg();
+        emit(res + " = " + slow_call);
+        return res;
+    }
+
+    std::string ints = reg();
+    emit(ints + " = and i1 " + hasTag(this, l, Tag::Int) + ", " + hasTag(this, r, Tag::Int));
+    std::string a = unboxInt(this, l), b = unboxInt(this, r);
+    if (op == Op2::Div || op == Op2::Mod) {
+        // Division by zero is for the runtime to report
+        std::string nonzero = reg(), ok = reg();
+        emit(nonzero + " = icmp ne i32 " + b + ", 0");
+        emit(ok + " = and i1 " + ints + ", " + nonzero);
+        ints = ok;
+    }
+
+    std::string fast = label(), slow = label(), done = label();
+    branch(ints, fast, slow);
+
+    block(fast);
+    std::string res = reg(), fast_res;
+    switch (op) {
+        case Op2::Add: emit(res + " = add i32 " + a + ", " + b); break;
+        case Op2::Sub: emit(res + " = sub i32 " + a + ", " + b); break;
+        case Op2::Mul: emit(res + " = mul i32 " + a + ", " + b); break;
+        case Op2::Div:
+        case Op2::Mod: {
+            // In 64 bits, like intOp2, so INT_MIN / -1 wraps instead of trapping
+            std::string wa = reg(), wb = reg(), q = reg();
+            emit(wa + " = sext i32 " + a + " to i64");
+            emit(wb + " = sext i32 " + b + " to i64");
+            emit(q + " = " + (op == Op2::Div ? "sdiv" : "srem") + " i64 " + wa + ", " + wb);
+            emit(res + " = trunc i64 " + q + " to i32");
+            break;
+        }
+        case Op2::Lt: emit(res + " = icmp slt i32 " + a + ", " + b); break;
+        case Op2::Lte: emit(res + " = icmp sle i32 " + a + ", " + b); break;
+        case Op2::Gt: emit(res + " = icmp sgt i32 " + a + ", " + b); break;
+        case Op2::Gte: emit(res + " = icmp sge i32 " + a + ", " + b); break;
+        case Op2::Eq: emit(res + " = icmp eq i32 " + a + ", " + b); break;
+        default: break;
+    }
+    if (op == Op2::Add || op == Op2::Sub || op == Op2::Mul || op == Op2::Div || op == Op2::Mod)
+        fast_res = boxInt(this, res);
+    else
+        fast_res = boxBool(this, res);
+    std::string fast_end = currentBlock();
+    jump(done);
+
+    block(slow);
+    std::string slow_res = reg();
+    emit(slow_res + " = " + slow_call);
+    jump(done);
+
+    block(done);
+    std::vector<std::pair<std::string, std::string> > in;
+    in.push_back(std::make_pair(fast_res, fast_end));
+    in.push_back(std::make_pair(slow_res, slow));
+    return phi(in);
+}
+
+std::string IRGen::op1(Op1 op, const std::string &v) {
+    Tag tag = op == Op1::Neg ? Tag::Int : Tag::Bool;
+    std::string fast = label(), slow = label(), done = label();
+    branch(hasTag(this, v, tag), fast, slow);
+
+    block(fast);
+    std::string fast_res;
+    if (op == Op1::Neg) {
+        std::string neg = reg();
+        emit(neg + " = sub i32 0, " + unboxInt(this, v));
+        fast_res = boxInt(this, neg);
+    } else {
+        // A bool's payload is 0 or 1
+        fast_res = reg();
+        emit(fast_res + " = xor i64 " + v + ", " + std::to_string(1ull << 32));
+    }
+    std::string fast_end = currentBlock();
+    jump(done);
+
+    block(slow);
+    std::string slow_res = reg();
+    emit(slow_res + " = call i64 @smol_op1(i32 " + std::to_string((int)op) + ", i64 " + v + ")");
+    jump(done);
+
+    block(done);
+    std::vector<std::pair<std::string, std::string> > in;
+    in.push_back(std::make_pair(fast_res, fast_end));
+    in.push_back(std::make_pair(slow_res, slow));
+    return phi(in);
+}
+
+std::string IRGen::truth(const std::string &v, const std::string &msg) {
+    std::string not_bool = reg();
+    emit(not_bool + " = xor i1 " + hasTag(this, v, Tag::Bool) + ", true");
+    failIf(not_bool, msg);
+    std::string r = reg();
+    emit(r + " = icmp eq i64 " + v + ", " + word(Value::fromBool(true)));
+    return r;
+}
+
+std::string IRGen::closure(const std::string &fn, int arity, const std::string &text) {
+    std::string r = reg();
+    emit(r + " = call i64 @smol_closure(i8* bitcast (" + functionType(arity) + "* " + fn +
+        " to i8*), i32 " + std::to_string(arity) + ", i8* " + constant(text) + ", i8* %env)");
+    return r;
+}
+
+std::string IRGen::callee(const std::string &f, int arity) {
+    std::string code = reg(), r = reg();
+    emit(code + " = call i8* @smol_callee(i64 " + f + ", i32 " + std::to_string(arity) + ")");
+    emit(r + " = bitcast i8* " + code + " to " + functionType(arity) + "*");
+    return r;
+}
+
+std::string IRGen::call(const std::string &code, const std::string &args) {
+    std::string r = reg();
+    emit(r + " = call fastcc i64 " + code + "(" + args + ")");
+    return r;
+}
+
+std::string IRGen::lookup(int depth, int slot) {
+    std::string r = reg();
+    if (stackLocals() && depth == 0) {
+        std::string p = reg();
+        emit(p + " = getelementptr i64, i64* %frame, i64 " + std::to_string(2 + slot));
+        emit(r + " = load i64, i64* " + p);
+        return r;
+    }
+
+    int d = stackLocals() ? depth - 1 : depth;
+    emit(r + " = call i64 @smol_lookup(i8* %env, i32 " + std::to_string(d) +
+        ", i32 " + std::to_string(slot) + ")");
+    return r;
+}
+
+void IRGen::bind(int slot, const std::string &value, bool check) {
+    if (!stackLocals()) {
+        emit(std::string("call void ") + (check ? "@smol_assign" : "@smol_bind") +
+            "(i8* %env, i32 " + std::to_string(slot) + ", i64 " + value + ")");
+        return;
+    }
+
+    std::string p = reg();
+    emit(p + " = getelementptr i64, i64* %frame, i64 " + std::to_string(2 + slot));
+    if (check) {
+        std::string old = reg(), bound = reg();
+        emit(old + " = load i64, i64* " + p);
+        emit(bound + " = icmp ne i64 " + old + ", 0");
+        failIf(bound, "Variable already exists");
+    }
+    emit("store i64 " + value + ", i64* " + p);
+}
+
+void IRGen::ret(const std::string &value) {
+    emit("store i64* %frame, i64** @smol_sp");
+    emit("ret i64 " + value);
+    fn().terminated = true;
+}
+
+// Marked tail and made with fastcc, which llc -tailcallopt turns into a
+// jump, so tail recursion runs in constant stack.
+void IRGen::tailCall(const std::string &callee, const std::string &args) {
+    emit("store i64* %frame, i64** @smol_sp");
+    std::string r = reg();
+    emit(r + " = tail call fastcc i64 " + callee + "(" + args + ")");
+    emit("ret i64 " + r);
+    fn().terminated = true;
+}
+
+void IRGen::finish() {
+    jump("done");
+}
@@ -0,0 +1,177 @@
+#ifndef SMALL_LLVM_HPP
+#define SMALL_LLVM_HPP
+
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_ops.hpp"
+#include "small_symbol.hpp"
+
+// Lowers a resolved AST to textual LLVM IR, for compiling ahead of time
+// against the runtime in runtime/small_rt.cpp.
+//
+// Every value is an i64 holding a Value's bits, so compiled code and the
+// runtime (which reuses the interpreter's values, operators and heap) agree
+// on representation. Each function keeps a frame on the runtime's shadow
+// stack, which the collector scans: word 0 is the closure being run, word 1
+// its Env if it has one, then its bindings if they live on the stack, then
+// temporaries that must survive an allocation. As in the VM, a body whose
+// frame nothing can capture keeps its bindings on the stack; the top level
+// and every other body bind into an Env on the heap.
+//
+// Int arithmetic and comparisons are inline; everything else calls into the
+// runtime. A runtime error prints what the interpreter would and exits.
+// Builtins can only be called directly, and only those the runtime has
+// (VBuiltin::isNative); a program that does otherwise isn't compiled.
+class IRGen {
+    // A function being generated. Its entry block is written last, once the
+    // size of its frame is known.
+    struct Function {
+        std::string header;
+        std::stringstream body;
+        int next_reg;
+        int next_label;
+        // Words before the first temporary
+        int base;
+        int temps;
+        int max_temps;
+        bool stack_locals;
+        bool top_level;
+        bool terminated;
+        std::string block;
+    };
+
+    // Innermost last; lambdas are generated as they are reached
+    std::vector<Function*> functions;
+    std::stringstream constants;
+    std::stringstream definitions;
+    // Why the program can't be compiled, if it can't
+    std::vector<std::string> rejected;
+    int next_constant;
+    int next_lambda;
+
+    Function &fn() {
+        return *functions.back();
+    }
+
+    void begin(const std::string &header, bool stack_locals, int locals, bool top_level);
+
+    // Finishes the innermost function: its entry block, then its body.
+    std::string end();
+
+    public:
+    // A value as an i64 operand
+    static std::string word(Value);
+
+    IRGen ();
+
+    IRGen (const IRGen &) = delete;
+
+    IRGen &operator=(const IRGen &) = delete;
+
+    // The whole module: every lambda, and a main that runs the program and
+    // prints its top-level bindings. Throws a string, a line per reason, if
+    // the program uses what compiled code can't do.
+    std::string program(Statement *root, const std::vector<Symbol> &globals);
+
+    // Generates the function for a lambda and returns its name.
+    std::string lambda(ELambda *);
+
+    // A fresh register or label name
+    std::string reg();
+
+    std::string label();
+
+    void emit(const std::string &instr);
+
+    // Starts a new block. The previous one must have been terminated.
+    void block(const std::string &label);
+
+    void jump(const std::string &label);
+
+    void branch(const std::string &cond, const std::string &t, const std::string &f);
+
+    // True once the current block has ended in a return or a failure. The
+    // code after it is unreachable and must not be emitted.
+    bool isTerminated() {
+        return fn().terminated;
+    }
+
+    std::string currentBlock() {
+        return fn().block;
+    }
+
+    bool stackLocals() {
+        return fn().stack_locals;
+    }
+
+    bool atTopLevel() {
+        return fn().top_level;
+    }
+
+    // An i8* to a private copy of bytes, NUL-terminated.
+    std::string constant(const std::string &bytes);
+
+    // Fails at runtime with msg. Code emitted after it is unreachable.
+    void fail(const std::string &msg);
+
+    void failIf(const std::string &cond, const std::string &msg);
+
+    // Refuses to compile the program, for msg. Generation carries on, so
+    // every reason is reported at once.
+    void reject(const std::string &msg);
+
+    std::string phi(const std::vector<std::pair<std::string, std::string> > &incoming);
+
+    // Temporaries are allocated and freed in stack order, so the ones
+    // pushed in a row are adjacent.
+    int pushTemp();
+
+    void popTemps(int n);
+
+    // An i64* to a temporary
+    std::string temp(int t);
+
+    void store(int t, const std::string &value);
+
+    // Applies an operator, inline for ints and through the runtime otherwise.
+    std::string op2(Op2, const std::string &l, const std::string &r);
+
+    std::string op1(Op1, const std::string &v);
+
+    // The i1 truth of a bool, failing with msg for anything else.
+    std::string truth(const std::string &v, const std::string &msg);
+
+    std::string closure(const std::string &fn, int arity, const std::string &text);
+
+    // Checks f is a function of arity arguments and returns its code.
+    std::string callee(const std::string &f, int arity);
+
+    // Calls code with args, the closure first, e.g. "i64 %r1, i64 %r2".
+    std::string call(const std::string &code, const std::string &args);
+
+    // The raw binding at (depth, slot), which is 0 if it is unbound.
+    std::string lookup(int depth, int slot);
+
+    // Binds a slot of the current frame, refusing to rebind if check is set.
+    void bind(int slot, const std::string &value, bool check);
+
+    // The current function's Env: its own, or the one it closed over.
+    std::string env() {
+        return "%env";
+    }
+
+    // Pops the frame and returns value from the current function.
+    void ret(const std::string &value);
+
+    // Pops the frame and makes a call in its place, returning its result.
+    void tailCall(const std::string &callee, const std::string &args);
+
+    // Leaves the top-level program, with everything bound so far.
+    void finish();
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "small_memo.hpp"
+#include "small_ops.hpp"
+
+bool Memo::enabled = false;
+
+Memo Memo::instance;
+
+Memo::Memo () {
+    registered = false;
+    stats = MemoStats();
+}
+
+bool Memo::KeyEq::operator()(const Key &a, const Key &b) const {
+    if (a.clos != b.clos || a.args.size() != b.args.size())
+        return false;
+    for (size_t i = 0; i < a.args.size(); ++i) {
+        if (!sameValue(a.args[i], b.args[i]))
+            return false;
+    }
+    return true;
+}
+
+Memo::Key Memo::key(VClos *clos, const std::vector<Value> &args) {
+    size_t hash = std::hash<VClos*>()(clos);
+    for (size_t i = 0; i < args.size(); ++i) {
+        hash = hash * 31 + hashValue(args[i]);
+    }
+    return {clos, args, hash};
+}
+
+bool Memo::find(VClos *clos, const std::vector<Value> &args, Value &result) {
+    auto it = table.find(key(clos, args));
+    if (it == table.end()) {
+        stats.misses++;
+        return false;
+    }
+    stats.hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    result = it->second->result;
+    return true;
+}
+
+// The heap only learns of the memo once it holds something, so it needn't
+// exist before the heap does.
+void Memo::insert(VClos *clos, const std::vector<Value> &args, Value result) {
+    if (!registered) {
+        Heap::instance.addRootSet(this);
+        registered = true;
+    }
+
+    Key k = key(clos, args);
+    if (table.count(k) > 0)
+        return;
+    if (entries.size() == Capacity) {
+        table.erase(entries.back().key);
+        entries.pop_back();
+        stats.evictions++;
+    }
+    entries.push_front({k, result});
+    table.emplace(k, entries.begin());
+}
+
+void Memo::markRoots(Heap &heap) {
+    for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        heap.mark(it->key.clos);
+        for (size_t i = 0; i < it->key.args.size(); ++i) {
+            heap.mark(it->key.args[i]);
+        }
+        heap.mark(it->result);
+    }
+}
+
+MemoStats Memo::getStats() {
+    MemoStats s = stats;
+    s.entries = entries.size();
+    return s;
+}
@@ -0,0 +1,82 @@
+#ifndef SMALL_MEMO_HPP
+#define SMALL_MEMO_HPP
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_heap.hpp"
+#include "small_values.hpp"
+
+class MemoStats {
+    public:
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+};
+
+// Results of closure calls, for --memo. Functions can't change anything,
+// and a closure's captured variables can't change once bound, so a call
+// gives the same result every time it's made with the same arguments
+// (compared by sameValue), and EApp::call can answer a repeat from here.
+// Calls that throw aren't kept.
+//
+// At most Capacity calls are kept, and adding one past that evicts the one
+// used least recently. Keys are closures rather than lambdas, since the
+// same lambda closed over different variables is a different function.
+// The closures, arguments and results are all roots, so none of them can
+// be collected, and an address can't be reused, while the call is kept.
+class Memo : public RootSet {
+    struct Key {
+        VClos *clos;
+        std::vector<Value> args;
+        size_t hash;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            return k.hash;
+        }
+    };
+
+    struct KeyEq {
+        bool operator()(const Key &a, const Key &b) const;
+    };
+
+    struct Entry {
+        Key key;
+        Value result;
+    };
+
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash, KeyEq> table;
+    bool registered;
+    MemoStats stats;
+
+    static Key key(VClos *, const std::vector<Value> &args);
+
+    public:
+    static const size_t Capacity = 1 << 16;
+
+    // On for --memo
+    static bool enabled;
+
+    static Memo instance;
+
+    Memo ();
+
+    // Sets result and returns true if the call has been made before.
+    bool find(VClos *, const std::vector<Value> &args, Value &result);
+
+    void insert(VClos *, const std::vector<Value> &args, Value result);
+
+    virtual void markRoots(Heap &);
+
+    MemoStats getStats();
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include <cmath>
+#include <climits>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "small_ops.hpp"
+#include "small_values.hpp"
+#include "small_list.hpp"
+
+// Int arithmetic wraps at 32 bits rather than invoking signed overflow.
+static int32_t wrap(int64_t v) {
+    return (int32_t)(uint32_t)(uint64_t)v;
+}
+
+static void typeError(Op2 op, Value l, Value r) {
+    throw "Op2: cannot apply " + Op2Strings[(int)op] + " to " +
+        l.typeName() + " and " + r.typeName();
+}
+
+static Value arith(Op2 op, Value l, Value r) {
+    if (l.isInt() && r.isInt()) {
+        int64_t a = l.asInt(), b = r.asInt();
+        switch (op) {
+            case Op2::Add: return Value::fromInt(wrap(a + b));
+            case Op2::Sub: return Value::fromInt(wrap(a - b));
+            case Op2::Mul: return Value::fromInt(wrap(a * b));
+            case Op2::Div:
+                if (b == 0)
+                    throw "Op2: division by zero";
+                return Value::fromInt(wrap(a / b));
+            case Op2::Mod:
+                if (b == 0)
+                    throw "Op2: division by zero";
+                return Value::fromInt(wrap(a % b));
+            default: break;
+        }
+    }
+
+    float a = l.toFloat(), b = r.toFloat();
+    switch (op) {
+        case Op2::Add: return Value::fromFloat(a + b);
+        case Op2::Sub: return Value::fromFloat(a - b);
+        case Op2::Mul: return Value::fromFloat(a * b);
+        case Op2::Div: return Value::fromFloat(a / b);
+        case Op2::Mod: return Value::fromFloat(std::fmod(a, b));
+        default: break;
+    }
+    typeError(op, l, r);
+    return Value();
+}
+
+// <0, 0 or >0 as l is less than, equal to or greater than r. Not for
+// floats, which NaN leaves unordered; see evalOp2.
+static int compare(Op2 op, Value l, Value r) {
+    if (l.isInt() && r.isInt())
+        return (l.asInt() > r.asInt()) - (l.asInt() < r.asInt());
+    if (l.isChar() && r.isChar())
+        return (l.asChar() > r.asChar()) - (l.asChar() < r.asChar());
+    if (l.is(ObjKind::String) && r.is(ObjKind::String))
+        return l.as<VString>()->getValue().compare(r.as<VString>()->getValue());
+    typeError(op, l, r);
+    return 0;
+}
+
+static bool sequenceEquals(std::vector<Value> a, std::vector<Value> b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (!valueEquals(a[i], b[i]))
+            return false;
+    }
+    return true;
+}
+
+bool valueEquals(Value l, Value r) {
+    if (l.isNumber() && r.isNumber()) {
+        if (l.isInt() && r.isInt())
+            return l.asInt() == r.asInt();
+        return l.toFloat() == r.toFloat();
+    }
+    if (!l.isObject() || !r.isObject())
+        return l.getBits() == r.getBits();
+    if (l.asObject() == r.asObject())
+        return true;
+    if (l.asObject()->getKind() != r.asObject()->getKind())
+        return false;
+
+    switch (l.asObject()->getKind()) {
+        case ObjKind::String:
+            return l.as<VString>()->getValue() == r.as<VString>()->getValue();
+        case ObjKind::List:
+            return sequenceEquals(l.as<VList>()->getValue(), r.as<VList>()->getValue());
+        case ObjKind::Tuple:
+            return sequenceEquals(l.as<VTuple>()->getValue(), r.as<VTuple>()->getValue());
+        case ObjKind::Closure:
+        case ObjKind::Builtin:
+            return false;
+    }
+    return false;
+}
+
+bool sameValue(Value l, Value r) {
+    if (l.getBits() == r.getBits())
+        return true;
+    if (!l.isObject() || !r.isObject() || l.asObject()->getKind() != r.asObject()->getKind())
+        return false;
+
+    switch (l.asObject()->getKind()) {
+        case ObjKind::String:
+            return l.as<VString>()->getValue() == r.as<VString>()->getValue();
+        case ObjKind::List: {
+            VList *a = l.as<VList>(), *b = r.as<VList>();
+            if (a->getRoot() == b->getRoot())
+                return true;
+            if (a->size() != b->size())
+                return false;
+            std::vector<Value> xs = a->getValue(), ys = b->getValue();
+            for (size_t i = 0; i < xs.size(); ++i) {
+                if (!sameValue(xs[i], ys[i]))
+                    return false;
+            }
+            return true;
+        }
+        case ObjKind::Tuple: {
+            std::vector<Value> xs = l.as<VTuple>()->getValue(), ys = r.as<VTuple>()->getValue();
+            if (xs.size() != ys.size())
+                return false;
+            for (size_t i = 0; i < xs.size(); ++i) {
+                if (!sameValue(xs[i], ys[i]))
+                    return false;
+            }
+            return true;
+        }
+        case ObjKind::Closure:
+        case ObjKind::Builtin:
+            return false;
+    }
+    return false;
+}
+
+static size_t mix(size_t h, size_t v) {
+    return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+size_t hashValue(Value v) {
+    if (!v.isObject())
+        return std::hash<uint64_t>()(v.getBits());
+
+    Object *o = v.asObject();
+    size_t h = (size_t)o->getKind();
+    switch (o->getKind()) {
+        case ObjKind::String:
+            return mix(h, std::hash<std::string>()(v.as<VString>()->getValue()));
+        case ObjKind::List:
+            forEachLeaf(v.as<VList>()->getRoot(), [&](ListLeaf *leaf) {
+                for (int i = 0; i < leaf->count; ++i) {
+                    h = mix(h, hashValue(leaf->get(i)));
+                }
+            });
+            return h;
+        case ObjKind::Tuple: {
+            std::vector<Value> items = v.as<VTuple>()->getValue();
+            for (size_t i = 0; i < items.size(); ++i) {
+                h = mix(h, hashValue(items[i]));
+            }
+            return h;
+        }
+        case ObjKind::Closure:
+        case ObjKind::Builtin:
+            break;
+    }
+    return mix(h, std::hash<Object*>()(o));
+}
+
+Value evalOp2(Op2 op, Value l, Value r) {
+    switch (op) {
+        case Op2::Add:
+            if (l.is(ObjKind::String) && r.is(ObjKind::String))
+                return Value::fromObject(Heap::instance.make<VString>(
+                    l.as<VString>()->getValue() + r.as<VString>()->getValue()));
+            if (l.is(ObjKind::List) && r.is(ObjKind::List))
+                return Value::fromObject(VList::concat(l.as<VList>(), r.as<VList>()));
+            [[fallthrough]];
+        case Op2::Sub:
+        case Op2::Mul:
+        case Op2::Div:
+        case Op2::Mod:
+            if (!l.isNumber() || !r.isNumber())
+                typeError(op, l, r);
+            return arith(op, l, r);
+
+        case Op2::LAnd:
+        case Op2::LOr:
+            if (!l.isBool() || !r.isBool())
+                typeError(op, l, r);
+            if (op == Op2::LAnd)
+                return Value::fromBool(l.asBool() && r.asBool());
+            return Value::fromBool(l.asBool() || r.asBool());
+
+        case Op2::Lt:
+        case Op2::Lte:
+        case Op2::Gt:
+        case Op2::Gte:
+            // Floats compare as IEEE says, as floatOp2 and the VM do: every
+            // comparison with NaN is false
+            if (l.isNumber() && r.isNumber() && !(l.isInt() && r.isInt())) {
+                Value res;
+                floatOp2(op, l.toFloat(), r.toFloat(), res);
+                return res;
+            }
+            switch (op) {
+                case Op2::Lt: return Value::fromBool(compare(op, l, r) < 0);
+                case Op2::Lte: return Value::fromBool(compare(op, l, r) <= 0);
+                case Op2::Gt: return Value::fromBool(compare(op, l, r) > 0);
+                default: return Value::fromBool(compare(op, l, r) >= 0);
+            }
+        case Op2::Eq: return Value::fromBool(valueEquals(l, r));
+    }
+    typeError(op, l, r);
+    return Value();
+}
+
+Value evalOp1(Op1 op, Value v) {
+    switch (op) {
+        case Op1::Neg:
+            if (v.isInt())
+                return Value::fromInt(wrap(-(int64_t)v.asInt()));
+            if (v.isFloat())
+                return Value::fromFloat(-v.asFloat());
+            break;
+        case Op1::LNot:
+            if (v.isBool())
+                return Value::fromBool(!v.asBool());
+            break;
+    }
+    throw "Op1: cannot apply " + Op1Strings[(int)op] + " to " + v.typeName();
+}
+
+OpCache classifyOp2(Op2 op, Value l, Value r) {
+    bool logical = op == Op2::LAnd || op == Op2::LOr;
+    if (l.isInt() && r.isInt())
+        return logical ? OpCache::Generic : OpCache::Int;
+    if (l.isNumber() && r.isNumber())
+        return logical ? OpCache::Generic : OpCache::Float;
+    if (l.isBool() && r.isBool())
+        return logical || op == Op2::Eq ? OpCache::Bool : OpCache::Generic;
+    if (l.is(ObjKind::String) && r.is(ObjKind::String)) {
+        switch (op) {
+            case Op2::Add: case Op2::Lt: case Op2::Lte:
+            case Op2::Gt: case Op2::Gte: case Op2::Eq:
+                return OpCache::String;
+            default:
+                return OpCache::Generic;
+        }
+    }
+    return OpCache::Generic;
+}
+
+OpCache classifyOp1(Op1 op, Value v) {
+    if (op == Op1::Neg && v.isInt())
+        return OpCache::Int;
+    if (op == Op1::Neg && v.isFloat())
+        return OpCache::Float;
+    if (op == Op1::LNot && v.isBool())
+        return OpCache::Bool;
+    return OpCache::Generic;
+}
+
+bool stringOp2(Op2 op, VString *a, VString *b, Value &res) {
+    switch (op) {
+        case Op2::Add:
+            res = Value::fromObject(Heap::instance.make<VString>(a->getValue() + b->getValue()));
+            return true;
+        case Op2::Eq:
+            res = Value::fromBool(a->getValue() == b->getValue());
+            return true;
+        default:
+            break;
+    }
+
+    int c = a->getValue().compare(b->getValue());
+    switch (op) {
+        case Op2::Lt: res = Value::fromBool(c < 0); return true;
+        case Op2::Lte: res = Value::fromBool(c <= 0); return true;
+        case Op2::Gt: res = Value::fromBool(c > 0); return true;
+        case Op2::Gte: res = Value::fromBool(c >= 0); return true;
+        default: return false;
+    }
+}
@@ -1,6 +1,13 @@
 #ifndef SMALL_OPS_HPP
 #define SMALL_OPS_HPP
 
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "small_lang_forwards.h"
+#include "small_values.hpp"
+
 // TODO: Simplify this:
 // - Doesn't involve cast to access Op name
 // - Ensures Op2 and Op2Strings are always in sync (macro?)
@@ -53,4 +60,92 @@ static const std::string Op1Strings[] = {
     ,"!"
 };
 
+// Operator semantics, shared by everything that evaluates operators.
+// && and || here are strict; EOp2 short-circuits before calling in.
+Value evalOp2(Op2, Value, Value);
+
+Value evalOp1(Op1, Value);
+
+// Structural equality, as used by ==
+bool valueEquals(Value, Value);
+
+// Equality for memo keys. Unlike ==, values of different types are never
+// the same, so 1 and 1.0 differ, and floats are compared bit for bit.
+// Closures and builtins are only the same as themselves.
+bool sameValue(Value, Value);
+
+// A hash that agrees with sameValue
+size_t hashValue(Value);
+
+// The operand types an operator site has seen. A site starts Uninit, takes
+// the kind of the first operands it's evaluated with, and drops to Generic
+// for good as soon as it sees operands of another kind.
+enum class OpCache : uint8_t {
+    Uninit
+    ,Int        // int x int
+    ,Float      // number x number, at least one a float
+    ,String     // string x string
+    ,Bool       // bool x bool
+    ,Generic
+};
+
+// The specialized kind for these operands, or Generic if there isn't one.
+OpCache classifyOp2(Op2, Value, Value);
+
+OpCache classifyOp1(Op1, Value);
+
+// The fast paths. Each fills in res and returns true, or returns false for
+// anything it doesn't cover (including division by zero, so evalOp2 can
+// report it). They must agree with evalOp2 wherever they return true.
+static inline bool intOp2(Op2 op, int32_t a, int32_t b, Value &res) {
+    switch (op) {
+        case Op2::Add: res = Value::fromInt((int32_t)((uint32_t)a + (uint32_t)b)); return true;
+        case Op2::Sub: res = Value::fromInt((int32_t)((uint32_t)a - (uint32_t)b)); return true;
+        case Op2::Mul: res = Value::fromInt((int32_t)((uint32_t)a * (uint32_t)b)); return true;
+        case Op2::Div:
+            if (b == 0)
+                return false;
+            res = Value::fromInt((int32_t)(uint32_t)((int64_t)a / b));
+            return true;
+        case Op2::Mod:
+            if (b == 0)
+                return false;
+            res = Value::fromInt((int32_t)(uint32_t)((int64_t)a % b));
+            return true;
+        case Op2::Lt: res = Value::fromBool(a < b); return true;
+        case Op2::Lte: res = Value::fromBool(a <= b); return true;
+        case Op2::Gt: res = Value::fromBool(a > b); return true;
+        case Op2::Gte: res = Value::fromBool(a >= b); return true;
+        case Op2::Eq: res = Value::fromBool(a == b); return true;
+        default: return false;
+    }
+}
+
+static inline bool floatOp2(Op2 op, float a, float b, Value &res) {
+    switch (op) {
+        case Op2::Add: res = Value::fromFloat(a + b); return true;
+        case Op2::Sub: res = Value::fromFloat(a - b); return true;
+        case Op2::Mul: res = Value::fromFloat(a * b); return true;
+        case Op2::Div: res = Value::fromFloat(a / b); return true;
+        case Op2::Mod: res = Value::fromFloat(std::fmod(a, b)); return true;
+        case Op2::Lt: res = Value::fromBool(a < b); return true;
+        case Op2::Lte: res = Value::fromBool(a <= b); return true;
+        case Op2::Gt: res = Value::fromBool(a > b); return true;
+        case Op2::Gte: res = Value::fromBool(a >= b); return true;
+        case Op2::Eq: res = Value::fromBool(a == b); return true;
+        default: return false;
+    }
+}
+
+static inline bool boolOp2(Op2 op, bool a, bool b, Value &res) {
+    switch (op) {
+        case Op2::LAnd: res = Value::fromBool(a && b); return true;
+        case Op2::LOr: res = Value::fromBool(a || b); return true;
+        case Op2::Eq: res = Value::fromBool(a == b); return true;
+        default: return false;
+    }
+}
+
+bool stringOp2(Op2 op, VString *a, VString *b, Value &res);
+
 #endif
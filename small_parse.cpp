@@ -0,0 +1,115 @@
+#include <cstring>
+#include <sstream>
+
+#include "small_parse.hpp"
+
+// Errors are kept with their parse rather than printed, since other files
+// may be parsing on other threads.
+void ParseContext::error(int first_line, int first_column, int last_line, int last_column, const char *msg) {
+    std::stringstream err;
+    err << "Parse error at ";
+    err << first_line << ":" << first_column << " - ";
+    err << last_line << ":" << last_column << ": ";
+    err << msg << std::endl;
+    errors += err.str();
+}
+
+// Chunks smaller than this aren't worth a thread
+static const size_t MinChunk = 1 << 20;
+
+static bool isIdStart(char c) {
+    return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// The length of the character literal at p, or 0 if there isn't one; the
+// same forms the lexer takes, longest first.
+static size_t charLength(const char *p, const char *end) {
+    size_t left = end - p;
+    if (left >= 6 && p[1] == '\\' && p[2] == 'x' && isDigit(p[3]) && isDigit(p[4]) && p[5] == '\'')
+        return 6;
+    if (left >= 4 && p[1] == '\\' && (p[2] == 'n' || p[2] == '\'') && p[3] == '\'')
+        return 4;
+    if (left >= 3 && p[1] != '\'' && p[2] == '\'')
+        return 3;
+    return 0;
+}
+
+// One pass over the text, skipping what the lexer would skip or take whole,
+// and counting brackets and lines. A split is taken at the first safe
+// newline past each chunk's share of the text.
+std::vector<Chunk> splitSource(const char *text, size_t size, unsigned pieces) {
+    if (pieces > size / MinChunk)
+        pieces = size / MinChunk;
+    if (pieces == 0)
+        pieces = 1;
+
+    std::vector<Chunk> chunks;
+    chunks.push_back({0, size, 1});
+    const char *p = text;
+    const char *end = text + size;
+    size_t target = size / pieces;
+    int depth = 0;
+    int line = 1;
+    // Whether the current chunk has anything but blanks and comments yet
+    bool seen = false;
+
+    while (p < end && chunks.size() < pieces) {
+        switch (*p) {
+            case '\n':
+                p++;
+                line++;
+                if (depth == 0 && seen && (size_t)(p - text) >= target && p < end && isIdStart(*p)) {
+                    size_t offset = p - text;
+                    chunks.back().size = offset - chunks.back().offset;
+                    chunks.push_back({offset, size - offset, line});
+                    target = chunks.size() * (size / pieces);
+                    seen = false;
+                }
+                continue;
+            case ' ':
+            case '\t':
+                p++;
+                continue;
+            case '(': case '[': case '{':
+                depth++;
+                break;
+            case ')': case ']': case '}':
+                depth--;
+                break;
+            case '/':
+                // A comment runs to the newline; without one, it's two
+                // divisions on the last line, where nothing can be split
+                if (p + 1 < end && p[1] == '/') {
+                    const char *nl = (const char*)std::memchr(p, '\n', end - p);
+                    p = nl != NULL ? nl : end;
+                    continue;
+                }
+                break;
+            case '"': {
+                // A string can't hold a newline; a quote without its match
+                // is a token of its own
+                const char *q = p + 1;
+                while (q < end && *q != '"' && *q != '\n')
+                    q++;
+                if (q < end && *q == '"')
+                    p = q;
+                break;
+            }
+            case '\'': {
+                size_t len = charLength(p, end);
+                if (len == 3 && p[1] == '\n')
+                    line++;
+                if (len > 0)
+                    p += len - 1;
+                break;
+            }
+        }
+        seen = true;
+        p++;
+    }
+    return chunks;
+}
@@ -0,0 +1,71 @@
+#ifndef SMALL_PARSE_HPP
+#define SMALL_PARSE_HPP
+
+#include <string>
+#include <vector>
+
+#include "small_lang_forwards.h"
+
+// Everything one parse needs, threaded through the parser and the lexer
+// instead of kept in globals, so that files can be parsed at the same time.
+struct ParseContext {
+    // The text being parsed, and every node of the parse; the AST takes
+    // both over
+    Source *source;
+    NodeArena *arena;
+    AST *ast;
+    // The hand-written lexer, or NULL to use flex's
+    Lexer *lexer;
+    // The line the source starts on, which is past 1 if it's a piece of a
+    // larger one, and the lexer's column on the current line
+    int line;
+    int column;
+    // Parse errors, one per line
+    std::string errors;
+
+    void error(int first_line, int first_column, int last_line, int last_column, const char *msg);
+};
+
+// One file's parse: its AST, or NULL and what went wrong. The AST is the
+// caller's to delete.
+struct ParseResult {
+    std::string file;
+    bool opened;
+    AST *ast;
+    std::string errors;
+};
+
+// A piece of a source that can be parsed on its own: where it starts, in
+// bytes, how long it is, and the line it starts on.
+struct Chunk {
+    size_t offset;
+    size_t size;
+    int line;
+};
+
+// Splits text into at most pieces chunks of about the same size, none
+// smaller than a megabyte, each a run of whole top-level statements. A
+// chunk ends with a newline outside any brackets, string, character or
+// comment, and the next starts with the first word of a statement. Since a
+// program is just statements and newlines, the chunks parse to the same
+// statements as the whole, as long as each parses.
+std::vector<Chunk> splitSource(const char *text, size_t size, unsigned pieces);
+
+// Parses one file. Safe to call from several threads at once.
+//
+// With more than one thread (0 means one per core), a large file is split
+// with splitSource, and the chunks are parsed on threads of their own and
+// stitched back into one AST. If any chunk fails, the file is parsed again in
+// one piece, so errors are reported as they would be without splitting.
+ParseResult parseFile(const std::string &path, unsigned threads = 1);
+
+// Parses text that was typed rather than read from a file, as if it started
+// on the given line, and adds any errors to errors. Returns NULL if it
+// fails; the AST is the caller's to delete.
+AST *parseText(const std::string &text, int line, std::string &errors);
+
+// Parses every file, each into its own AST, on a pool of threads (by
+// default, one per core). The results are in the same order as paths.
+std::vector<ParseResult> parseFiles(const std::vector<std::string> &paths, unsigned threads = 0);
+
+#endif
@@ -0,0 +1,125 @@
+#include <algorithm>
+
+#include "small_pool.hpp"
+
+unsigned Pool::threads = 0;
+
+Pool::Pool (unsigned n) : shares(n) {
+    body = NULL;
+    generation = 0;
+    busy = 0;
+    stopping = false;
+    for (unsigned i = 1; i < n; ++i) {
+        workers.emplace_back(&Pool::loop, this, i);
+    }
+}
+
+Pool::~Pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+}
+
+Pool &Pool::instance() {
+    static Pool pool(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+// Share 0 is the caller's; worker i sleeps until a loop starts and then
+// works on it from share i.
+void Pool::loop(unsigned self) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        work(self);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+}
+
+void Pool::work(unsigned self) {
+    size_t from, to;
+    while (take(self, from, to)) {
+        (*body)(from, to);
+    }
+}
+
+bool Pool::take(unsigned self, size_t &from, size_t &to) {
+    Share &own = shares[self];
+    do {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.begin < own.end) {
+            from = own.begin;
+            to = std::min(own.end, from + Grain);
+            own.begin = to;
+            return true;
+        }
+    } while (steal(self));
+    return false;
+}
+
+// Moves the back half of the first other share with anything left into
+// self's, which is empty. A thief only ever holds one share's lock.
+bool Pool::steal(unsigned self) {
+    unsigned n = shares.size();
+    for (unsigned k = 1; k < n; ++k) {
+        Share &victim = shares[(self + k) % n];
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.begin == victim.end)
+                continue;
+            end = victim.end;
+            begin = victim.begin + (victim.end - victim.begin) / 2;
+            victim.end = begin;
+        }
+        std::lock_guard<std::mutex> guard(shares[self].lock);
+        shares[self].begin = begin;
+        shares[self].end = end;
+        return true;
+    }
+    return false;
+}
+
+void Pool::run(size_t n, const std::function<void(size_t, size_t)> &f) {
+    unsigned k = shares.size();
+    if (k == 1 || n <= Grain) {
+        if (n > 0)
+            f(0, n);
+        return;
+    }
+
+    std::lock_guard<std::mutex> one(running);
+    for (unsigned i = 0; i < k; ++i) {
+        std::lock_guard<std::mutex> guard(shares[i].lock);
+        shares[i].begin = n * i / k;
+        shares[i].end = n * (i + 1) / k;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        body = &f;
+        busy = k - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&]() { return busy == 0; });
+    body = NULL;
+}
@@ -0,0 +1,75 @@
+#ifndef SMALL_POOL_HPP
+#define SMALL_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that split a loop between them, started the first
+// time it's used and kept until exit.
+//
+// Each thread, the caller included, starts with an equal share of the
+// loop's indices and works through it a few at a time. One that runs out
+// steals the back half of what's left of another's, so an uneven loop
+// still keeps every thread busy to the end.
+//
+// The body runs on other threads while the caller's is busy with its own
+// share, so it mustn't allocate on the heap, evaluate code or throw; the
+// evaluator and the collector aren't safe to use from two threads at once.
+class Pool {
+    // Indices not yet taken from one thread's share
+    struct Share {
+        std::mutex lock;
+        size_t begin, end;
+    };
+
+    // Indices taken at a time from a thread's own share
+    static const size_t Grain = 4;
+
+    std::vector<std::thread> workers;
+    std::vector<Share> shares;
+
+    // One loop at a time, from whichever thread calls run
+    std::mutex running;
+
+    std::mutex lock;
+    std::condition_variable wake, done;
+    const std::function<void(size_t, size_t)> *body;
+    uint64_t generation;
+    unsigned busy;
+    bool stopping;
+
+    Pool (unsigned threads);
+
+    ~Pool();
+
+    void loop(unsigned self);
+
+    // Works on the loop until no share has indices left.
+    void work(unsigned self);
+
+    bool take(unsigned self, size_t &from, size_t &to);
+
+    bool steal(unsigned self);
+
+    public:
+    // How many threads, the caller's included, the pool starts with; 0
+    // means one per core. Set it before the first loop runs.
+    static unsigned threads;
+
+    static Pool &instance();
+
+    unsigned size() {
+        return shares.size();
+    }
+
+    // Calls body(from, to) on ranges that together cover 0 up to n once
+    // each, and returns once they've all finished.
+    void run(size_t n, const std::function<void(size_t, size_t)> &body);
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "small_profile.hpp"
+#include "small_expr.hpp"
+
+bool Profiler::enabled = false;
+
+Profiler Profiler::instance;
+
+static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Profiler::Profiler () {
+    nodes.push_back(Node());
+    nodes.back().lambda = NULL;
+    nodes.back().parent = NULL;
+}
+
+Profiler::Node *Profiler::child(Node *parent, ELambda *lambda) {
+    std::unordered_map<ELambda*, Node*>::iterator it = parent->children.find(lambda);
+    if (it != parent->children.end())
+        return it->second;
+    nodes.push_back(Node());
+    Node *node = &nodes.back();
+    node->lambda = lambda;
+    node->parent = parent;
+    node->calls = 0;
+    node->total_ns = 0;
+    node->self_ns = 0;
+    parent->children.emplace(lambda, node);
+    return node;
+}
+
+void Profiler::enter(ELambda *lambda) {
+    Node *node = child(stack.empty() ? &nodes.front() : stack.back().node, lambda);
+    node->calls++;
+    stack.push_back({node, now(), 0});
+}
+
+void Profiler::leave() {
+    Active top = stack.back();
+    stack.pop_back();
+    uint64_t took = now() - top.start;
+    top.node->total_ns += took;
+    top.node->self_ns += took - std::min(took, top.children_ns);
+    if (!stack.empty())
+        stack.back().children_ns += took;
+}
+
+void Profiler::replace(ELambda *lambda) {
+    leave();
+    enter(lambda);
+}
+
+// Depth first, so each stack's name is built from its caller's
+void Profiler::writeFolded(std::ostream &out) {
+    std::vector<std::pair<Node*, std::string> > todo;
+    for (std::unordered_map<ELambda*, Node*>::iterator it = nodes.front().children.begin(); it != nodes.front().children.end(); ++it) {
+        todo.push_back(std::make_pair(it->second, it->first->getName()));
+    }
+    while (!todo.empty()) {
+        Node *node = todo.back().first;
+        std::string stack = std::move(todo.back().second);
+        todo.pop_back();
+        if (node->self_ns >= 1000)
+            out << stack << ' ' << node->self_ns / 1000 << '\n';
+        for (std::unordered_map<ELambda*, Node*>::iterator it = node->children.begin(); it != node->children.end(); ++it) {
+            todo.push_back(std::make_pair(it->second, stack + ';' + it->first->getName()));
+        }
+    }
+}
+
+// A node's total counts for its function unless it's inside another call
+// to the same function, whose total already includes it. The walk keeps
+// count of the calls to each function on the way down to a node.
+std::vector<ProfileEntry> Profiler::summary() {
+    std::unordered_map<ELambda*, ProfileEntry> entries;
+    std::unordered_map<ELambda*, int> open;
+    // A node, and whether its children are done
+    std::vector<std::pair<Node*, bool> > todo;
+    for (std::unordered_map<ELambda*, Node*>::iterator it = nodes.front().children.begin(); it != nodes.front().children.end(); ++it) {
+        todo.push_back(std::make_pair(it->second, false));
+    }
+    while (!todo.empty()) {
+        Node *node = todo.back().first;
+        if (todo.back().second) {
+            todo.pop_back();
+            open[node->lambda]--;
+            continue;
+        }
+        todo.back().second = true;
+
+        ProfileEntry &e = entries[node->lambda];
+        e.calls += node->calls;
+        e.self_ns += node->self_ns;
+        if (open[node->lambda]++ == 0)
+            e.total_ns += node->total_ns;
+        for (std::unordered_map<ELambda*, Node*>::iterator it = node->children.begin(); it != node->children.end(); ++it) {
+            todo.push_back(std::make_pair(it->second, false));
+        }
+    }
+
+    std::vector<ProfileEntry> result;
+    for (std::unordered_map<ELambda*, ProfileEntry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        it->second.name = it->first->getName();
+        result.push_back(it->second);
+    }
+    std::sort(result.begin(), result.end(), [](const ProfileEntry &a, const ProfileEntry &b) {
+        return a.self_ns != b.self_ns ? a.self_ns > b.self_ns : a.name < b.name;
+    });
+    return result;
+}
@@ -0,0 +1,102 @@
+#ifndef SMALL_PROFILE_HPP
+#define SMALL_PROFILE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "small_lang_forwards.h"
+
+// One function's share of a profile. Time a function spends inside another
+// call to itself counts once in total.
+class ProfileEntry {
+    public:
+    std::string name;
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t self_ns;
+};
+
+// Where the tree-walker spends its time, for --profile.
+//
+// EApp::call keeps a shadow of the call stack: a closure's lambda is pushed
+// once its arguments are evaluated and popped when it returns or throws, and
+// a tail call swaps the top for the callee, just as it replaces the caller.
+// Every distinct stack is a node of a call tree that counts its calls and
+// the time spent in it, with and without the calls it made.
+//
+// Calls that compiled code makes to itself never come back through
+// EApp::call, so nothing runs compiled while profiling. Lambdas run over a
+// list by map and the like aren't calls; their time is the caller's.
+class Profiler {
+    struct Node {
+        ELambda *lambda;
+        Node *parent;
+        std::unordered_map<ELambda*, Node*> children;
+        uint64_t calls;
+        uint64_t total_ns;
+        uint64_t self_ns;
+    };
+
+    struct Active {
+        Node *node;
+        uint64_t start;
+        uint64_t children_ns;
+    };
+
+    // The nodes, which never move; the first is the root
+    std::deque<Node> nodes;
+    std::vector<Active> stack;
+
+    Node *child(Node *, ELambda *);
+
+    public:
+    // On for --profile
+    static bool enabled;
+
+    static Profiler instance;
+
+    Profiler ();
+
+    void enter(ELambda *);
+
+    void leave();
+
+    // The call on top of the stack made a tail call to lambda.
+    void replace(ELambda *);
+
+    // Writes the call tree as folded stacks, one line per stack, that
+    // flamegraph.pl and speedscope read: the functions from the outermost
+    // in, separated by semicolons, then the microseconds spent in the
+    // innermost one itself.
+    void writeFolded(std::ostream &);
+
+    // Every function called, the one that spent most time itself first.
+    std::vector<ProfileEntry> summary();
+};
+
+// Pops the profiler's stack however the call it pushed for ends.
+class ProfileScope {
+    bool on;
+
+    public:
+    ProfileScope (bool profile, ELambda *lambda) {
+        on = profile;
+        if (on)
+            Profiler::instance.enter(lambda);
+    }
+
+    ~ProfileScope() {
+        if (on)
+            Profiler::instance.leave();
+    }
+
+    ProfileScope (const ProfileScope &) = delete;
+
+    ProfileScope &operator=(const ProfileScope &) = delete;
+};
+
+#endif
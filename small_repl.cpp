@@ -0,0 +1,66 @@
+#include <string>
+#include <vector>
+
+#include "small_repl.hpp"
+
+Repl::Repl (Engine e, bool f) {
+    engine = e;
+    fold = f;
+    ast = NULL;
+    env = NULL;
+}
+
+Repl::~Repl() {
+    reset();
+}
+
+void Repl::reset() {
+    if (env != NULL)
+        Heap::instance.unpin(env);
+    delete ast;
+    ast = NULL;
+    env = NULL;
+}
+
+bool Repl::enter(AST *program, std::ostream &out) {
+    // Which slots were bound before, so only the new ones are written
+    std::vector<bool> was;
+    for (int i = 0; env != NULL && i < env->size(); ++i) {
+        was.push_back(!env->get(i).isNull());
+    }
+
+    std::string error;
+    bool ok = true;
+    try {
+        if (ast == NULL) {
+            ast = program;
+            ast->keepOpen();
+            ast->resolve();
+            if (fold)
+                ast->optimize();
+            env = Heap::instance.make<Env>((Env*)NULL, ast->getGlobals().size());
+            Heap::instance.pin(env);
+            ast->eval(env, engine);
+        } else {
+            ast->extend(program, env, engine);
+        }
+    } catch (const char *msg) {
+        error = msg;
+        ok = false;
+    } catch (std::string msg) {
+        error = msg;
+        ok = false;
+    }
+
+    const std::vector<Symbol> &names = ast->getGlobals();
+    for (size_t i = 0; i < names.size() && (int)i < env->size(); ++i) {
+        if (!env->get(i).isNull() && (i >= was.size() || !was[i]))
+            out << names[i].getName() << " = " << env->get(i).toString() << std::endl;
+    }
+    // A return ends the program it's in, not the session
+    env->set(0, Value());
+
+    if (!ok)
+        out << "Evaluation failed: " << error << std::endl;
+    return ok;
+}
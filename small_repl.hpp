@@ -0,0 +1,49 @@
+#ifndef SMALL_REPL_HPP
+#define SMALL_REPL_HPP
+
+#include <ostream>
+
+#include "small_lang_forwards.h"
+#include "small_ast.hpp"
+
+// An interactive session, for --repl. Each program entered, a line or a
+// file, runs in the same top-level frame as those before it, so it costs
+// only its own parse and evaluation; see AST::extend. Closures, and the code
+// compiled for them, live as long as the session.
+//
+// Names can't be bound twice, just as in a file. A program can use a name
+// that a later one binds, in a function body say, since the session's top
+// level is left open. One that fails keeps whatever it bound before it
+// failed.
+class Repl {
+    Engine engine;
+    bool fold;
+    // Everything run so far, or NULL before the first program
+    AST *ast;
+    // The top-level frame, pinned while the session lasts
+    Env *env;
+
+    public:
+    Repl (Engine, bool fold);
+
+    ~Repl();
+
+    Repl (const Repl &) = delete;
+
+    Repl &operator=(const Repl &) = delete;
+
+    // Runs program, fresh from the parser, which the session takes over,
+    // and writes each name it bound and its value, or what went wrong, to
+    // out. Returns false if it failed.
+    bool enter(AST *program, std::ostream &out);
+
+    // Forgets everything entered so far.
+    void reset();
+
+    // Everything run so far, or NULL.
+    AST *getAST() {
+        return ast;
+    }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef SMALL_SCOPE_HPP
+#define SMALL_SCOPE_HPP
+
+#include <unordered_map>
+#include <vector>
+
+#include "small_symbol.hpp"
+#include "small_arena.hpp"
+
+// Compile-time mirror of a Frame: maps the names bound in one scope to their
+// slot numbers. Used by the resolver to turn identifiers into (depth, slot)
+// coordinates so evaluation never has to look a name up. Resolved nodes are
+// interned in the arena of the outermost scope.
+class Scope {
+    Scope *parent;
+    NodeArena *arena;
+    std::unordered_map<Symbol, int> slots;
+    std::vector<Symbol> names;
+    bool captured;
+    // See bindLate
+    bool open;
+
+    public:
+    Scope (Scope *p, NodeArena *a = NULL) {
+        parent = p;
+        arena = parent != NULL ? parent->arena : a;
+        captured = false;
+        open = false;
+        if (parent != NULL)
+            parent->captured = true;
+        declare(ReturnId);
+    }
+
+    Scope (const Scope &other) {
+        parent = other.parent;
+        arena = other.arena;
+        slots = other.slots;
+        names = other.names;
+        captured = other.captured;
+        open = other.open;
+    }
+
+    // Returns the slot for id, allocating a new one if id is not yet bound
+    // in this scope.
+    int declare(Symbol id) {
+        std::unordered_map<Symbol, int>::iterator it = slots.find(id);
+        if (it != slots.end())
+            return it->second;
+        int slot = names.size();
+        slots.insert({id, slot});
+        names.push_back(id);
+        return slot;
+    }
+
+    bool lookup(Symbol id, int &depth, int &slot) {
+        depth = 0;
+        for (Scope *s = this; s != NULL; s = s->parent, ++depth) {
+            std::unordered_map<Symbol, int>::iterator it = s->slots.find(id);
+            if (it != s->slots.end()) {
+                slot = it->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Leaves the outermost scope open, as a REPL's top level is: it never
+    // sees every statement that binds in it.
+    void setOpen() {
+        open = true;
+    }
+
+    // Gives id a slot in the outermost scope if that is open, for a later
+    // statement to bind, and returns its coordinates as lookup would.
+    bool bindLate(Symbol id, int &depth, int &slot) {
+        int d = 0;
+        Scope *s = this;
+        for (; s->parent != NULL; s = s->parent) {
+            ++d;
+        }
+        if (!s->open)
+            return false;
+        depth = d;
+        slot = s->declare(id);
+        return true;
+    }
+
+    int size() {
+        return names.size();
+    }
+
+    // True once a nested scope (a lambda) has been opened inside this one,
+    // i.e. when this scope's frames may be captured by closures.
+    bool isCaptured() {
+        return captured;
+    }
+
+    const std::vector<Symbol> &getNames() {
+        return names;
+    }
+
+    NodeArena *getArena() {
+        return arena;
+    }
+};
+
+#endif
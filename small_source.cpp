@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "small_source.hpp"
+
+// Reserves zeroed pages for the text and its NULs, then maps the file over
+// the start of them. The file's last page is zero past its end, and any
+// page after that is still the reservation's, so the NULs are always there.
+static char *map(int fd, size_t size, size_t &mapped) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    mapped = (size + 2 + page - 1) / page * page;
+    void *mem = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    void *file = mmap(mem, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (file == MAP_FAILED) {
+        munmap(mem, mapped);
+        return NULL;
+    }
+    return (char*)mem;
+}
+
+static char *slurp(int fd, size_t &size) {
+    size_t capacity = 4096;
+    char *text = (char*)std::malloc(capacity);
+    size = 0;
+    while (text != NULL) {
+        if (capacity - size < 2) {
+            capacity *= 2;
+            char *more = (char*)std::realloc(text, capacity);
+            if (more == NULL)
+                break;
+            text = more;
+        }
+        ssize_t n = read(fd, text + size, capacity - size - 2);
+        if (n < 0)
+            break;
+        if (n == 0) {
+            text[size] = text[size + 1] = '\0';
+            return text;
+        }
+        size += n;
+    }
+    std::free(text);
+    return NULL;
+}
+
+Source *Source::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    char *text = NULL;
+    size_t size = 0, mapped = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size = st.st_size;
+        text = map(fd, size, mapped);
+    }
+    if (text == NULL) {
+        mapped = 0;
+        text = slurp(fd, size);
+    }
+    close(fd);
+
+    if (text == NULL)
+        return NULL;
+    return new Source(text, size, mapped);
+}
+
+Source *Source::copy(const char *text, size_t size) {
+    char *buf = (char*)std::malloc(size + 2);
+    if (buf == NULL)
+        return NULL;
+    std::memcpy(buf, text, size);
+    buf[size] = buf[size + 1] = '\0';
+    return new Source(buf, size, 0);
+}
+
+Source::~Source() {
+    if (mapped > 0)
+        munmap(text, mapped);
+    else
+        std::free(text);
+}
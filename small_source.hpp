@@ -0,0 +1,76 @@
+#ifndef SMALL_SOURCE_HPP
+#define SMALL_SOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Where a token is in its source: an offset and a length, in bytes. Plain
+// data, so it can sit in the parser's value union.
+struct Span {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// A source file's text, mapped into memory rather than read. The lexer scans
+// it in place and string literals point into it, so the text is never copied
+// into the lexer's buffer or into the AST, which keeps the Source alive.
+//
+// The text is followed by two NULs, which flex needs to scan a buffer in
+// place. The mapping is private and writable, since flex also NUL-terminates
+// each token in place while it's being matched.
+class Source {
+    char *text;
+    size_t size;
+    // Bytes mapped, or 0 if the text was read into memory instead
+    size_t mapped;
+
+    Source (char *t, size_t s, size_t m) {
+        text = t;
+        size = s;
+        mapped = m;
+    }
+
+    public:
+    // Maps the file at path, or reads it if it can't be mapped (a pipe, or
+    // an empty file). Returns NULL if it can't be opened.
+    static Source *open(const std::string &path);
+
+    // A copy of size bytes of text, with its own NULs, so that part of a
+    // source can be lexed on its own. Returns NULL if out of memory.
+    static Source *copy(const char *text, size_t size);
+
+    ~Source();
+
+    Source (const Source &) = delete;
+
+    Source &operator=(const Source &) = delete;
+
+    // The text and the two NULs after it, for the lexer.
+    char *getBuffer() {
+        return text;
+    }
+
+    size_t getBufferSize() {
+        return size + 2;
+    }
+
+    // The length of the text alone
+    size_t getSize() {
+        return size;
+    }
+
+    Span span(const char *start, size_t len) {
+        Span s;
+        s.offset = start - text;
+        s.length = len;
+        return s;
+    }
+
+    std::string_view view(Span s) {
+        return std::string_view(text + s.offset, s.length);
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <cxxabi.h>
+
+#include "small_stats.hpp"
+#include "small_heap.hpp"
+
+bool Stats::enabled = false;
+
+Stats Stats::instance;
+
+Stats::Stats () {
+    frames = AllocCount();
+    frames_reused = 0;
+    line = 0;
+}
+
+void Stats::allocated(HeapObject *obj, size_t bytes) {
+    heap[std::type_index(typeid(*obj))].add(bytes);
+    lines[line].add(bytes);
+}
+
+void Stats::frame(size_t bytes, bool reused) {
+    if (reused) {
+        frames_reused++;
+        return;
+    }
+    frames.add(bytes);
+    lines[line].add(bytes);
+}
+
+std::vector<std::pair<std::string, AllocCount> > Stats::byType() {
+    std::vector<std::pair<std::string, AllocCount> > types;
+    for (std::unordered_map<std::type_index, AllocCount>::iterator it = heap.begin(); it != heap.end(); ++it) {
+        types.push_back(std::make_pair(typeName(it->first), it->second));
+    }
+    std::sort(types.begin(), types.end(), [](const std::pair<std::string, AllocCount> &a, const std::pair<std::string, AllocCount> &b) {
+        return a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes : a.first < b.first;
+    });
+    return types;
+}
+
+std::string Stats::typeName(std::type_index type) {
+    int status;
+    char *name = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+    if (name == NULL)
+        return type.name();
+    std::string s(name);
+    std::free(name);
+    return s;
+}
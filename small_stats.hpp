@@ -0,0 +1,108 @@
+#ifndef SMALL_STATS_HPP
+#define SMALL_STATS_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "small_lang_forwards.h"
+
+class HeapObject;
+
+// How many of something were allocated, and the bytes they took
+class AllocCount {
+    public:
+    size_t count;
+    size_t bytes;
+
+    void add(size_t b) {
+        count++;
+        bytes += b;
+    }
+};
+
+// Allocation counters, for --stats: every object the heap takes on, by its
+// type and by the line of the statement that was being evaluated when it
+// was made, and every call frame, whether made or reused. Frames that can't
+// be captured are made with plain new and recycled, so the heap never
+// sees them.
+//
+// Nodes are counted by the arena that makes them; see NodeArena::getMade.
+// Lines come from the tree-walker's statements, so what the VM allocates
+// counts as line 0.
+class Stats {
+    std::unordered_map<std::type_index, AllocCount> heap;
+    std::map<int, AllocCount> lines;
+    AllocCount frames;
+    size_t frames_reused;
+    // The line of the statement being evaluated
+    int line;
+
+    public:
+    // On for --stats
+    static bool enabled;
+
+    static Stats instance;
+
+    Stats ();
+
+    // The heap took on obj, of size bytes.
+    void allocated(HeapObject *obj, size_t bytes);
+
+    // A call frame was made outside the heap, or reused.
+    void frame(size_t bytes, bool reused);
+
+    // Sets the current line and returns what it was.
+    int at(int l) {
+        int was = line;
+        line = l;
+        return was;
+    }
+
+    // The heap's allocations by type, the most bytes first.
+    std::vector<std::pair<std::string, AllocCount> > byType();
+
+    // The heap's allocations and frames, by line.
+    const std::map<int, AllocCount> &byLine() {
+        return lines;
+    }
+
+    const AllocCount &framesMade() {
+        return frames;
+    }
+
+    size_t framesReused() {
+        return frames_reused;
+    }
+
+    // A readable name for a type, like "VList" or "LeafOf<int>".
+    static std::string typeName(std::type_index);
+};
+
+// Sets the current line while a statement runs, and puts back the caller's
+// after.
+class StatsLine {
+    int was = 0;
+
+    public:
+    StatsLine (int line) {
+        if (Stats::enabled)
+            was = Stats::instance.at(line);
+    }
+
+    ~StatsLine() {
+        if (Stats::enabled)
+            Stats::instance.at(was);
+    }
+
+    StatsLine (const StatsLine &) = delete;
+
+    StatsLine &operator=(const StatsLine &) = delete;
+};
+
+#endif
@@ -2,91 +2,200 @@
 
 #include "small_stmt.hpp"
 #include "small_expr.hpp"
+#include "small_scope.hpp"
+#include "small_bytecode.hpp"
+#include "small_fold.hpp"
+#include "small_llvm.hpp"
+#include "small_jit.hpp"
+#include "small_stats.hpp"
 /* #include "small_lang_forwards.h" */
 
-Seq::Seq (Statement *a, Statement *b) {
-    s1 = a->clone();
-    s2 = b->clone();
+Seq::Seq (Statement *first) {
+    stmts.push_back(first);
 }
 
-Seq::Seq (const Seq &other) {
-    s1 = other.s1->clone();
-    s2 = other.s2->clone();
+void Seq::append(Statement *s) {
+    stmts.push_back(s);
 }
 
-Seq::~Seq() {
-    delete s1;
-    delete s2;
+void Seq::concat(Seq *other) {
+    stmts.insert(stmts.end(), other->stmts.begin(), other->stmts.end());
+    other->stmts.clear();
 }
 
-Statement *Seq::clone() {
-    return new Seq(*this);
+std::string Seq::toString() {
+    std::string str;
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        if (it != stmts.begin())
+            str += "\n";
+        str += (*it)->toString();
+    }
+    return str;
 }
 
-std::string Seq::toString() {
-    return s1->toString() + "\n" + s2->toString();
+// A return ends the scope: statements after it are not evaluated.
+void Seq::evaluate(Env *env) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->evaluate(env);
+        if (env->hasReturned())
+            return;
+    }
 }
 
-Env Seq::evaluate(Env env) {
-    return s2->evaluate(s1->evaluate(env));
+void Seq::declare(Scope *scope) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->declare(scope);
+    }
 }
 
+void Seq::resolve(Scope *scope) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->resolve(scope);
+    }
+}
 
-Assign::Assign (std::string name, Expr *lhs) {
-    id = name;
-    e = lhs->clone();
+void Seq::compile(Compiler *c) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->compile(c);
+    }
+}
+
+// Nothing after a return is reachable
+void Seq::emitIR(IRGen *g) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->emitIR(g);
+        if (g->isTerminated())
+            return;
+    }
+}
+
+bool Seq::jit(Jit *j) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        if (!(*it)->jit(j))
+            return false;
+        if (j->hasReturned())
+            return true;
+    }
+    return true;
 }
 
-Assign::Assign (const Assign &other) {
-    id = other.id;
-    e = other.e->clone();
+// Only a body of one statement
+bool Seq::kernel(Kernel *k) {
+    return stmts.size() == 1 && stmts[0]->kernel(k);
 }
 
-Assign::~Assign() {
-    delete e;
+void Seq::fold(Folder *f) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->fold(f);
+    }
 }
 
-Statement *Assign::clone() {
-    return new Assign(*this);
+// Any return ends the body, wherever it is in the block
+void Seq::markTail(NodeArena *arena) {
+    for (std::vector<Statement*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+        (*it)->markTail(arena);
+    }
+}
+
+
+Assign::Assign (Symbol name, Expr *lhs, int l) {
+    id = name;
+    slot = 0;
+    e = lhs;
+    line = l;
 }
 
 std::string Assign::toString() {
-    return id + " = " + e->toString() + ";";
+    return id.getName() + " = " + e->toString() + ";";
 }
 
-Env Assign::evaluate(Env env) {
-    Value *res = e->evaluate(env);
-    if (env.count(id) > 0) {
+void Assign::evaluate(Env *env) {
+    StatsLine at(line);
+    Value res = e->evaluate(env);
+    if (!env->get(slot).isNull()) {
         throw "Variable already exists";
     } else {
-        env.insert({id, res});
+        env->set(slot, res);
     }
-    return env;
 }
 
+void Assign::declare(Scope *scope) {
+    slot = scope->declare(id);
+}
+
+void Assign::resolve(Scope *scope) {
+    e = e->resolve(scope);
+}
+
+void Assign::compile(Compiler *c) {
+    e->compile(c);
+    c->emit(c->stackLocals() ? Opcode::StoreSlot : Opcode::Store, slot, -1);
+}
 
-Return::Return (Expr *any) {
-    e = any->clone();
+void Assign::emitIR(IRGen *g) {
+    g->bind(slot, e->emitIR(g), true);
 }
 
-Return::Return (const Return &other) {
-    e = other.e->clone();
+bool Assign::jit(Jit *j) {
+    return j->store(slot, e->jit(j));
 }
 
-Return::~Return() {
-    delete e;
+void Assign::fold(Folder *f) {
+    e = f->fold(e);
+    if (f->atTopLevel())
+        f->bind(slot, e);
 }
 
-Statement *Return::clone() {
-    return new Return(*this);
+
+Return::Return (Expr *any, int l) {
+    e = any;
+    line = l;
 }
 
 std::string Return::toString() {
     return "return " + e->toString() + ";";
 }
 
-Env Return::evaluate(Env env) {
-    Value *res = e->evaluate(env);
-    env.insert({"return", res});
-    return env;
+void Return::evaluate(Env *env) {
+    StatsLine at(line);
+    env->set(0, e->evaluate(env));
+}
+
+void Return::resolve(Scope *scope) {
+    e = e->resolve(scope);
+}
+
+void Return::compile(Compiler *c) {
+    e->compile(c);
+    c->emit(Opcode::Return, -1);
+}
+
+// At the top level, a return binds slot 0 and ends the program
+void Return::emitIR(IRGen *g) {
+    std::string v = e->emitIR(g);
+    if (g->isTerminated())
+        return;
+
+    if (g->atTopLevel()) {
+        g->bind(0, v, false);
+        g->finish();
+    } else {
+        g->ret(v);
+    }
+}
+
+bool Return::jit(Jit *j) {
+    return j->ret(e->jit(j));
+}
+
+bool Return::kernel(Kernel *k) {
+    return e->kernel(k);
+}
+
+void Return::fold(Folder *f) {
+    e = f->fold(e);
+}
+
+void Return::markTail(NodeArena *arena) {
+    e = e->markTail(arena);
 }
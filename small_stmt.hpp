@@ -2,68 +2,132 @@
 #define SMALL_STMTS_HPP
 
 #include <string>
+#include <vector>
 
 #include "small_lang_forwards.h"
 #include "small_env.hpp"
+#include "small_symbol.hpp"
 
 class Statement {
     public:
         virtual ~Statement() {}
 
-        virtual Statement *clone() = 0;
-
         virtual std::string toString() = 0;
 
-        virtual Env evaluate(Env env) = 0;
+        virtual void evaluate(Env *env) = 0;
+
+        // Resolution runs in two steps so that every name a scope assigns is
+        // known before any expression in it is resolved: declare() allocates
+        // slots for the names bound here, resolve() then binds identifiers.
+        virtual void declare(Scope *) {}
+
+        virtual void resolve(Scope *) = 0;
+
+        virtual void compile(Compiler *) = 0;
+
+        virtual void emitIR(IRGen *) = 0;
+
+        // Folds constants in the statement's expressions, in place.
+        virtual void fold(Folder *) {}
+
+        // Marks the calls that end a function body; see Expr::markTail.
+        virtual void markTail(NodeArena *) {}
+
+        // Emits machine code for the statement, or returns false if it has
+        // none; see Jit.
+        virtual bool jit(Jit *) {
+            return false;
+        }
+
+        // Adds the statement to a lambda's Kernel, or returns false if it
+        // has none; see Expr::kernel.
+        virtual bool kernel(Kernel *) {
+            return false;
+        }
 };
 
+// A block of statements, run in order. Kept flat rather than as a chain of
+// pairs so that long programs neither nest deeply nor recurse to evaluate.
 class Seq : public Statement {
-    Statement *s1, *s2;
+    std::vector<Statement*> stmts;
     public:
-    Seq (Statement*, Statement*);
-
-    Seq (const Seq&);
+    Seq (Statement*);
 
-    virtual ~Seq();
+    void append(Statement*);
 
-    virtual Statement *clone();
+    // Moves every statement of other onto the end of this one.
+    void concat(Seq *other);
 
     virtual std::string toString();
 
-    virtual Env evaluate(Env env);
+    virtual void evaluate(Env *env);
+
+    virtual void declare(Scope *);
+
+    virtual void resolve(Scope *);
+
+    virtual void compile(Compiler *);
+
+    virtual void emitIR(IRGen *);
+
+    virtual bool jit(Jit *);
+
+    virtual bool kernel(Kernel *);
+
+    virtual void fold(Folder *);
+
+    virtual void markTail(NodeArena *);
 };
 
 class Assign : public Statement {
-    std::string id;
+    Symbol id;
+    int slot;
     Expr *e;
+    // Where it is in the source, for --stats
+    int line;
     public:
-    Assign (std::string, Expr*);
+    Assign (Symbol, Expr*, int line);
 
-    Assign (const Assign&);
+    virtual std::string toString();
 
-    virtual ~Assign();
+    virtual void evaluate(Env *env);
 
-    virtual Statement *clone();
+    virtual void declare(Scope *);
 
-    virtual std::string toString();
+    virtual void resolve(Scope *);
+
+    virtual void compile(Compiler *);
+
+    virtual void emitIR(IRGen *);
 
-    virtual Env evaluate(Env env);
+    virtual bool jit(Jit *);
+
+    virtual void fold(Folder *);
 };
 
 class Return : public Statement {
     Expr *e;
+    int line;
     public:
-    Return (Expr*);
+    Return (Expr*, int line);
+
+    virtual std::string toString();
 
-    Return (const Return&);
+    virtual void evaluate(Env *env);
 
-    virtual ~Return();
+    virtual void resolve(Scope *);
 
-    virtual Statement *clone();
+    virtual void compile(Compiler *);
 
-    virtual std::string toString();
+    virtual void emitIR(IRGen *);
+
+    virtual bool jit(Jit *);
+
+    virtual bool kernel(Kernel *);
+
+    virtual void fold(Folder *);
 
-    virtual Env evaluate(Env env);
+    virtual void markTail(NodeArena *);
 };
 
 #endif
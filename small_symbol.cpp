@@ -0,0 +1,62 @@
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "small_symbol.hpp"
+
+// Names are kept in a deque so they never move, and the index is keyed on
+// views of them, so looking up a name that's already interned allocates
+// nothing. Files may be lexed on several threads at once, so the table is
+// locked: shared to look a name up, exclusive to add one.
+class SymbolTable {
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, int32_t> ids;
+    std::shared_mutex lock;
+
+    public:
+    SymbolTable () {
+        intern("return", 6);
+    }
+
+    int32_t intern(const char *name, size_t len) {
+        std::string_view key(name, len);
+        {
+            std::shared_lock<std::shared_mutex> read(lock);
+            std::unordered_map<std::string_view, int32_t>::iterator it = ids.find(key);
+            if (it != ids.end())
+                return it->second;
+        }
+
+        // Another thread may have added it since
+        std::unique_lock<std::shared_mutex> write(lock);
+        std::unordered_map<std::string_view, int32_t>::iterator it = ids.find(key);
+        if (it != ids.end())
+            return it->second;
+
+        int32_t id = names.size();
+        names.emplace_back(name, len);
+        ids.insert({std::string_view(names.back()), id});
+        return id;
+    }
+
+    const std::string &name(int32_t id) {
+        std::shared_lock<std::shared_mutex> read(lock);
+        return names[id];
+    }
+};
+
+static SymbolTable &table() {
+    static SymbolTable t;
+    return t;
+}
+
+Symbol Symbol::intern(const char *name, size_t len) {
+    return Symbol(table().intern(name, len));
+}
+
+const std::string &Symbol::getName() const {
+    return table().name(id);
+}
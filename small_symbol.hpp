@@ -0,0 +1,60 @@
+#ifndef SMALL_SYMBOL_HPP
+#define SMALL_SYMBOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// An interned identifier. The lexer maps every name to a dense integer once,
+// so comparing and hashing names afterwards never touches their characters.
+// Trivially copyable, so it can sit in the parser's value union.
+class Symbol {
+    int32_t id;
+
+    public:
+    Symbol () = default;
+
+    explicit constexpr Symbol (int32_t i) : id(i) {}
+
+    // The symbol for name, adding it to the table if it's new.
+    static Symbol intern(const char *name, size_t len);
+
+    static Symbol intern(const std::string &name) {
+        return intern(name.data(), name.size());
+    }
+
+    int32_t getId() const {
+        return id;
+    }
+
+    const std::string &getName() const;
+
+    bool operator==(Symbol other) const {
+        return id == other.id;
+    }
+
+    bool operator!=(Symbol other) const {
+        return id != other.id;
+    }
+
+    bool operator<(Symbol other) const {
+        return id < other.id;
+    }
+};
+
+// The name under which a scope's return value is stored. "return" is a
+// keyword, so it can never clash with a user identifier; it is the first
+// symbol in the table.
+constexpr Symbol ReturnId(0);
+
+namespace std {
+    template <>
+    struct hash<Symbol> {
+        size_t operator()(Symbol s) const {
+            return (size_t)s.getId();
+        }
+    };
+}
+
+#endif
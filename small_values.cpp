@@ -0,0 +1,90 @@
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "small_values.hpp"
+#include "small_expr.hpp"
+#include "small_env.hpp"
+#include "small_jit.hpp"
+
+std::string Value::typeName() {
+    switch (getTag()) {
+        case Tag::Int: return "int";
+        case Tag::Float: return "float";
+        case Tag::Bool: return "bool";
+        case Tag::Char: return "char";
+        case Tag::TailCall: return "tail call";
+        case Tag::Object: break;
+    }
+    if (isNull())
+        return "unbound";
+    switch (asObject()->getKind()) {
+        case ObjKind::String: return "string";
+        case ObjKind::List: return "list";
+        case ObjKind::Tuple: return "tuple";
+        case ObjKind::Closure: return "function";
+        case ObjKind::Builtin: return "function";
+    }
+    return "unknown";
+}
+
+std::string Value::toString() {
+    switch (getTag()) {
+        case Tag::Int: return std::to_string(asInt());
+        case Tag::Float: return std::to_string(asFloat());
+        case Tag::Bool: return asBool() ? "true" : "false";
+        // TODO: Print 'c', '\xNN', '\'' depending!
+        case Tag::Char: return std::string(1, asChar());
+        case Tag::TailCall: return "<tail call>";
+        case Tag::Object: break;
+    }
+    if (isNull())
+        return "<unbound>";
+    return asObject()->toString();
+}
+
+
+std::string VList::toString() {
+    std::vector<Value> value = getValue();
+    std::stringstream str;
+    str << "[";
+    for (std::vector<Value>::iterator it = value.begin(); it != value.end(); ++it) {
+        str << it->toString();
+        if (it + 1 != value.end())
+            str << ", ";
+    }
+    str << "]";
+    return str.str();
+}
+
+
+std::string VTuple::toString() {
+    std::stringstream str;
+    str << "(";
+    for (std::vector<Value>::iterator it = value.begin(); it != value.end(); ++it) {
+        str << it->toString();
+        if (it + 1 != value.end())
+            str << ", ";
+    }
+    str << ")";
+    return str.str();
+}
+
+
+VClos::~VClos() {
+    delete jit.code;
+}
+
+std::string VClos::toString() {
+    return lambda->toString();
+}
+
+void VTuple::trace(Heap &heap) {
+    for (std::vector<Value>::iterator it = value.begin(); it != value.end(); ++it) {
+        heap.mark(*it);
+    }
+}
+
+void VClos::trace(Heap &heap) {
+    heap.mark(env);
+}
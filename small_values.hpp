@@ -1,279 +1,349 @@
 #ifndef SMALL_VALUES_H
 #define SMALL_VALUES_H
 
+#include <cstdint>
+#include <cstring>
 #include <string>
-#include <sstream>
+#include <string_view>
 #include <vector>
 
-#include "small_expr.hpp"
+#include "small_lang_forwards.h"
+#include "small_heap.hpp"
 
-class Value {
-    public:
-        virtual ~Value() {}
-
-        virtual Value *clone() = 0;
-
-        virtual std::string toString() = 0;
+// The kinds of value that live on the heap. Everything else is an immediate.
+enum class ObjKind {
+    String
+    ,List
+    ,Tuple
+    ,Closure
+    ,Builtin
 };
 
-class VInt : public Value {
-    int value;
+// Base of all heap-allocated values. The kind is stored explicitly so type
+// checks are a load and compare instead of a dynamic_cast.
+class Object : public HeapObject {
+    ObjKind kind;
 
     public:
-    VInt (int v) {
-        value = v;
+    Object (ObjKind k) {
+        kind = k;
     }
 
-    VInt (const VInt &other) {
-        value = other.value;
-    }
-
-    virtual ~VInt() {}
+    virtual ~Object() {}
 
-    virtual Value *clone() {
-        return new VInt(*this);
+    ObjKind getKind() {
+        return kind;
     }
 
-    virtual std::string toString() {
-        return std::to_string(value);
-    }
+    virtual std::string toString() = 0;
+};
 
-    int getValue() {
-        return value;
-    }
+enum class Tag {
+    Object = 0
+    ,Int
+    ,Float
+    ,Bool
+    ,Char
+    // Marks a frame whose body ended in a tail call; never a user value
+    ,TailCall = 7
 };
 
-class VFloat : public Value {
-    float value;
+// A value in one 64-bit word. The low three bits are the tag; ints, floats,
+// bools and chars keep their payload in the high 32 bits and never touch the
+// allocator. Tag 0 is an Object pointer, which is always 8-byte aligned, so
+// the pointer is stored as-is. The all-zero word is the null value, used for
+// slots that have not been bound yet.
+class Value {
+    uint64_t bits;
 
-    public:
-    VFloat (float v) {
-        value = v;
+    static const uint64_t TagMask = 7;
+
+    static Value immediate(Tag t, uint32_t payload) {
+        Value v;
+        v.bits = ((uint64_t)payload << 32) | (uint64_t)t;
+        return v;
     }
 
-    VFloat (const VFloat &other) {
-        value = other.value;
+    uint32_t payload() {
+        return (uint32_t)(bits >> 32);
     }
 
-    virtual ~VFloat() {}
+    public:
+    Value () {
+        bits = 0;
+    }
 
-    virtual Value *clone() {
-        return new VFloat(*this);
+    static Value fromInt(int32_t i) {
+        return immediate(Tag::Int, (uint32_t)i);
     }
 
-    virtual std::string toString() {
-        return std::to_string(value);
+    static Value fromFloat(float f) {
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        return immediate(Tag::Float, u);
     }
 
-    float getValue() {
-        return value;
+    static Value fromBool(bool b) {
+        return immediate(Tag::Bool, b ? 1 : 0);
     }
-};
 
-class VBool : public Value {
-    bool value;
+    static Value fromChar(char c) {
+        return immediate(Tag::Char, (uint8_t)c);
+    }
 
-    public:
-    VBool (bool b) {
-        value = b;
+    static Value tailCall() {
+        return immediate(Tag::TailCall, 0);
     }
 
-    VBool (const VBool &other) {
-        value = other.value;
+    static Value fromObject(Object *o) {
+        Value v;
+        v.bits = (uint64_t)(uintptr_t)o;
+        return v;
     }
 
-    virtual ~VBool() {}
+    // The inverse of getBits(), for code that passes values around as words
+    static Value fromBits(uint64_t bits) {
+        Value v;
+        v.bits = bits;
+        return v;
+    }
 
-    virtual Value *clone() {
-        return new VBool(*this);
+    Tag getTag() {
+        return (Tag)(bits & TagMask);
     }
 
-    virtual std::string toString() {
-        return value ? "true" : "false";
+    uint64_t getBits() {
+        return bits;
     }
 
-    bool getValue() {
-        return value;
+    bool isNull() { return bits == 0; }
+    bool isInt() { return getTag() == Tag::Int; }
+    bool isFloat() { return getTag() == Tag::Float; }
+    bool isBool() { return getTag() == Tag::Bool; }
+    bool isChar() { return getTag() == Tag::Char; }
+    bool isTailCall() { return getTag() == Tag::TailCall; }
+    bool isNumber() { return isInt() || isFloat(); }
+    bool isObject() { return getTag() == Tag::Object && bits != 0; }
+
+    bool is(ObjKind k) {
+        return isObject() && asObject()->getKind() == k;
     }
-};
 
-class VChar : public Value {
-    char value;
+    int32_t asInt() {
+        return (int32_t)payload();
+    }
 
-    public:
-    VChar (char c) {
-        value = c;
+    float asFloat() {
+        uint32_t u = payload();
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
     }
 
-    VChar (const VChar &other) {
-        value = other.value;
+    // Ints widen to float, for mixed arithmetic
+    float toFloat() {
+        return isInt() ? (float)asInt() : asFloat();
     }
 
-    virtual ~VChar() {}
+    bool asBool() {
+        return payload() != 0;
+    }
 
-    virtual Value *clone() {
-        return new VChar(*this);
+    char asChar() {
+        return (char)payload();
     }
 
-    // TODO: Print 'c', '\xNN', '\'' depending!
-    virtual std::string toString() {
-        return std::string(1, value);
+    Object *asObject() {
+        return (Object*)(uintptr_t)bits;
     }
 
-    char getValue() {
-        return value;
+    // Unchecked downcast; test with is() first.
+    template <typename T>
+    T *as() {
+        return static_cast<T*>(asObject());
     }
+
+    std::string typeName();
+
+    std::string toString();
 };
 
-class VString : public Value {
+class VString : public Object {
     std::string value;
 
     public:
-    VString (std::string v) {
+    VString (std::string v) : Object(ObjKind::String) {
         value = v;
     }
 
-    VString (const char* str) {
+    VString (const char* str) : Object(ObjKind::String) {
         value = std::string(str);
     }
 
-    VString (const VString &other) {
+    VString (std::string_view v) : Object(ObjKind::String) {
+        value = std::string(v);
+    }
+
+    VString (const VString &other) : Object(ObjKind::String) {
         value = other.value;
     }
 
     virtual ~VString() {}
 
-    virtual Value *clone() {
-        return new VString(*this);
-    }
-
     virtual std::string toString() {
         return value;
     }
 
-    string getValue() {
+    std::string getValue() {
         return value;
     }
+
+    virtual size_t footprint() {
+        return sizeof(VString) + value.capacity();
+    }
 };
 
-class VList : public Value {
-    std::vector<Value*> value;
+// A persistent vector: its values are the leaves of a tree of ListNodes
+// (see small_list.hpp), which lists share. Copying a list, or joining,
+// appending to or slicing one, takes O(log n) and leaves it as it was.
+class VList : public Object {
+    // NULL when empty
+    ListNode *root;
     public:
-    VList () {}
-
-    VList (std::vector<Value*> l) {
-        value = std::vector<Value*>(l);
+    VList () : Object(ObjKind::List) {
+        root = NULL;
     }
 
-    VList (Value *e) {
-        value.push_back(e);
-    }
+    VList (std::vector<Value> l);
 
-    VList (const VList &other) {
-        value = other.value;
+    VList (Value e);
+
+    VList (ListNode *r) : Object(ObjKind::List) {
+        root = r;
     }
 
-    virtual ~VList() {
-        delete &value;
+    VList (const VList &other) : Object(ObjKind::List) {
+        root = other.root;
     }
 
-    virtual Value *clone() {
-        return new VList(*this);
+    virtual ~VList() {}
+
+    virtual std::string toString();
+
+    virtual void trace(Heap &);
+
+    // The nodes are heap objects of their own
+    virtual size_t footprint() {
+        return sizeof(VList);
     }
 
-    virtual std::string toString() {
-        std::stringstream str;
-        str << "[";
-        for (std::vector<Value*>::iterator it = value.begin(); it != value.end(); ++it) {
-            str << (*it)->toString();
-            if (++it != value.end())
-                str << ", ";
-            it--;
-        }
-        str << "]";
-        return str.str();
-    }
-
-    std::vector<Value*> getValue() {
-        return value;
+    size_t size();
+
+    ListNode *getRoot() {
+        return root;
     }
+
+    // The value at i, for i < size().
+    Value get(size_t i);
+
+    // Every value, in order, copied out.
+    std::vector<Value> getValue();
+
+    // Each makes a new list on the heap.
+    static VList *concat(VList *, VList *);
+
+    static VList *append(VList *, Value);
+
+    // Values from through to - 1, for from <= to <= size().
+    VList *slice(size_t from, size_t to);
 };
 
-class VTuple : public Value {
-    std::vector<Value*> value;
+class VTuple : public Object {
+    std::vector<Value> value;
     int size;
     public:
-    VTuple() { size = 0; }
+    VTuple() : Object(ObjKind::Tuple) { size = 0; }
 
-    VTuple (std::vector<Value*> l) {
-        value = std::vector<Value*>(l);
+    VTuple (std::vector<Value> l) : Object(ObjKind::Tuple) {
+        value = l;
         size = l.size();
     }
 
-    VTuple (const VTuple &other) {
+    VTuple (const VTuple &other) : Object(ObjKind::Tuple) {
         value = other.value;
         size = other.size;
     }
 
-    virtual ~VTuple() {
-        delete &value;
-    }
+    virtual ~VTuple() {}
+
+    virtual std::string toString();
 
-    virtual Value *clone() {
-        return new VTuple(*this);
+    virtual void trace(Heap &);
+
+    virtual size_t footprint() {
+        return sizeof(VTuple) + value.capacity() * sizeof(Value);
     }
 
-    virtual std::string toString() {
-        std::stringstream str;
-        str << "(";
-        for (std::vector<Value*>::iterator it = value.begin(); it != value.end(); ++it) {
-            str << (*it)->toString();
-            if (it + 1 != value.end())
-                str << ", ";
-        }
-        str << ")";
-        return str.str();
-    }
-
-    std::vector<Value*> getValue() {
+    std::vector<Value> getValue() {
         return value;
     }
 };
 
-class VClos : public Value {
+// How hot a closure is, and its machine code once it has some; see Jit.
+struct JitState {
+    uint32_t calls;
+    uint32_t deopts;
+    uint8_t compiles;
+    JitCode *code;
+};
+
+// The lambda is shared with the AST that owns it, never copied.
+class VClos : public Object {
     ELambda *lambda;
-    Env env;
+    Env *env;
+    JitState jit;
     public:
-    VClos (Expr *l, Env e) {
-        lambda = l->clone();
+    VClos (ELambda *l, Env *e) : Object(ObjKind::Closure) {
+        lambda = l;
         env = e;
+        jit = JitState();
     }
 
-    VClos (const VClos &other) {
-        lambda = other.lambda->clone();
-        env = other.env;
-    }
+    virtual ~VClos();
 
-    virtual ~VClos() {
-        delete lambda;
-        delete env;
-    }
+    virtual std::string toString();
 
-    virtual Value *clone() {
-        return new VClos(*this);
-    }
+    virtual void trace(Heap &);
 
-    virtual std::string toString() {
-        return lambda->toString();
+    virtual size_t footprint() {
+        return sizeof(VClos);
     }
 
     ELambda *getLambda() {
         return lambda;
     }
 
-    Env getEnv() {
+    Env *getEnv() {
         return env;
     }
+
+    JitState &getJit() {
+        return jit;
+    }
 };
 
+inline void Heap::shade(Value v) {
+    if (marking && v.isObject())
+        mark(v.asObject());
+}
+
+inline void Heap::push(Value v) {
+    if (v.isObject())
+        roots.push_back(v.asObject());
+}
+
+inline void Roots::push(Value v) {
+    Heap::instance.push(v);
+}
+
 #endif
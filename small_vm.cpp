@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "small_vm.hpp"
+#include "small_expr.hpp"
+#include "small_ops.hpp"
+#include "small_builtins.hpp"
+
+// Builtins are shared by every program, and live as long as it does
+Proto::~Proto() {
+    for (std::vector<Value>::iterator it = constants.begin(); it != constants.end(); ++it) {
+        if (it->isObject() && !it->is(ObjKind::Builtin))
+            delete it->asObject();
+    }
+}
+
+
+VM::VM () {
+    stack.resize(1024);
+    height = 0;
+    current = NULL;
+    Heap::instance.addRootSet(this);
+}
+
+VM::~VM() {
+    Heap::instance.removeRootSet(this);
+}
+
+void VM::markRoots(Heap &heap) {
+    for (size_t i = 0; i < height; ++i) {
+        heap.mark(stack[i]);
+    }
+    for (std::vector<CallFrame>::iterator it = frames.begin(); it != frames.end(); ++it) {
+        heap.mark(it->env);
+    }
+    heap.mark(current);
+}
+
+void VM::reserve(size_t used, int needed) {
+    if (used + needed > stack.size())
+        stack.resize((used + needed) * 2);
+}
+
+void VM::run(Proto *proto, Env *env) {
+    Value res = execute(proto, env);
+    sync(stack.data(), NULL);
+    if (!res.isNull())
+        env->set(0, res);
+}
+
+// Runs proto in env until it returns, and gives back the returned value
+// (or null if a top-level program ran off its end).
+Value VM::execute(Proto *top, Env *top_env) {
+    frames.clear();
+    reserve(0, top->max_stack);
+
+    Proto *proto = top;
+    Env *env = top_env;
+    const int32_t *pc = proto->code.data();
+    Value *fp = stack.data();
+    Value *sp = stack.data();
+
+    while (true) {
+        switch ((Opcode)*pc++) {
+            case Opcode::Const:
+                *sp++ = proto->constants[*pc++];
+                break;
+
+            case Opcode::LoadLocal: {
+                Value v = env->get(pc[0]);
+                if (v.isNull())
+                    throw "Variable used before assignment: " + Symbol(pc[1]).getName();
+                *sp++ = v;
+                pc += 2;
+                break;
+            }
+
+            case Opcode::Load: {
+                Value v = env->lookup(pc[0], pc[1]);
+                if (v.isNull())
+                    throw "Variable used before assignment: " + Symbol(pc[2]).getName();
+                *sp++ = v;
+                pc += 3;
+                break;
+            }
+
+            case Opcode::LoadUnbound:
+                throw "Unbound variable: " + Symbol(pc[0]).getName();
+
+            case Opcode::Store: {
+                Value v = *--sp;
+                if (!env->get(pc[0]).isNull())
+                    throw "Variable already exists";
+                env->set(pc[0], v);
+                pc++;
+                break;
+            }
+
+            case Opcode::LoadSlot: {
+                Value v = fp[pc[0]];
+                if (v.isNull())
+                    throw "Variable used before assignment: " + Symbol(pc[1]).getName();
+                *sp++ = v;
+                pc += 2;
+                break;
+            }
+
+            case Opcode::StoreSlot: {
+                Value v = *--sp;
+                if (!fp[pc[0]].isNull())
+                    throw "Variable already exists";
+                fp[pc[0]] = v;
+                pc++;
+                break;
+            }
+
+            case Opcode::MakeList:
+            case Opcode::MakeTuple: {
+                int n = *pc;
+                sync(sp, env);
+                std::vector<Value> items(sp - n, sp);
+                sp -= n;
+                if ((Opcode)pc[-1] == Opcode::MakeList)
+                    *sp++ = Value::fromObject(Heap::instance.make<VList>(items));
+                else
+                    *sp++ = Value::fromObject(Heap::instance.make<VTuple>(items));
+                pc++;
+                break;
+            }
+
+            case Opcode::Closure:
+                sync(sp, env);
+                *sp++ = Value::fromObject(Heap::instance.make<VClos>(proto->lambdas[*pc++], env));
+                break;
+
+            case Opcode::Call:
+            case Opcode::TailCall: {
+                int argc = *pc++;
+                Value *args = sp - argc;
+                Value f = args[-1];
+
+                // A builtin's result takes the place of it and its
+                // arguments, in a tail call too, and a Return follows
+                if (f.is(ObjKind::Builtin)) {
+                    VBuiltin *builtin = f.as<VBuiltin>();
+                    if (builtin->getArity() != argc)
+                        throw "App: params and args length mismatch";
+                    sync(sp, env);
+                    Value res = builtin->apply(args);
+                    sp = args - 1;
+                    *sp++ = res;
+                    break;
+                }
+
+                if (!f.is(ObjKind::Closure))
+                    throw "App: LHS did not eval to function";
+
+                VClos *clos = f.as<VClos>();
+                Proto *callee = clos->getLambda()->getProto();
+
+                if (callee->param_slots.size() != (size_t)argc)
+                    throw "App: params and args length mismatch";
+
+                size_t base;
+                if ((Opcode)pc[-2] == Opcode::TailCall) {
+                    // Take over the current call's place on the stack; the
+                    // callee returns straight to our caller.
+                    base = fp - stack.data();
+                    std::copy(args - 1, sp, fp);
+                    args = fp + 1;
+                    sp = args + argc;
+                } else {
+                    base = args - 1 - stack.data();
+                    CallFrame saved = {proto, pc, env, base, (size_t)(fp - stack.data())};
+                    frames.push_back(saved);
+                }
+
+                if (callee->captured) {
+                    sync(sp, env);
+                    Env *frame = Heap::instance.make<Env>(clos->getEnv(), callee->frame_size);
+                    for (int i = 0; i < argc; ++i) {
+                        frame->set(callee->param_slots[i], args[i]);
+                    }
+                    reserve(base, callee->max_stack);
+                    fp = sp = stack.data() + base;
+                    env = frame;
+                } else {
+                    // The frame takes over the callee and argument slots. A
+                    // param's slot is never past its argument, so moving them
+                    // down in order doesn't clobber any still to be read.
+                    reserve(base, callee->frame_size + callee->max_stack);
+                    fp = stack.data() + base;
+                    for (int i = 0; i < argc; ++i) {
+                        fp[callee->param_slots[i]] = fp[i + 1];
+                    }
+                    fp[0] = Value();
+                    for (int i = callee->first_local; i < callee->frame_size; ++i) {
+                        fp[i] = Value();
+                    }
+                    sp = fp + callee->frame_size;
+                    env = clos->getEnv();
+                }
+
+                proto = callee;
+                pc = proto->code.data();
+                break;
+            }
+
+            case Opcode::Return: {
+                Value res = *--sp;
+                if (frames.empty())
+                    return res;
+
+                CallFrame &caller = frames.back();
+                proto = caller.proto;
+                pc = caller.pc;
+                env = caller.env;
+                fp = stack.data() + caller.locals;
+                sp = stack.data() + caller.base;
+                frames.pop_back();
+
+                *sp++ = res;
+                break;
+            }
+
+            case Opcode::End:
+                if (frames.empty())
+                    return Value();
+                throw "App: Function had no return statement";
+
+            case Opcode::Jump:
+                pc = proto->code.data() + pc[0];
+                break;
+
+            case Opcode::JumpIfFalse: {
+                Value c = *--sp;
+                if (!c.isBool())
+                    throw proto->strings[pc[1]];
+                if (c.asBool())
+                    pc += 2;
+                else
+                    pc = proto->code.data() + pc[0];
+                break;
+            }
+
+            case Opcode::ShortCircuit: {
+                Value l = sp[-1];
+                if (l.isBool() && l.asBool() == ((Op2)pc[0] == Op2::LOr))
+                    pc = proto->code.data() + pc[1];
+                else
+                    pc += 2;
+                break;
+            }
+
+            // Number operands are handled inline; everything else goes
+            // through the same evalOp2 the tree-walker uses.
+            case Opcode::Add:
+            case Opcode::Sub:
+            case Opcode::Mul:
+            case Opcode::Div:
+            case Opcode::Mod:
+            case Opcode::LAnd:
+            case Opcode::LOr:
+            case Opcode::Lt:
+            case Opcode::Lte:
+            case Opcode::Gt:
+            case Opcode::Gte:
+            case Opcode::Eq: {
+                Op2 op = (Op2)(pc[-1] - (int32_t)Opcode::Add);
+                Value l = sp[-2], r = sp[-1];
+                if (l.isInt() && r.isInt()) {
+                    if (intOp2(op, l.asInt(), r.asInt(), sp[-2])) {
+                        sp--;
+                        break;
+                    }
+                } else if (l.isNumber() && r.isNumber() && floatOp2(op, l.toFloat(), r.toFloat(), sp[-2])) {
+                    sp--;
+                    break;
+                }
+                sync(sp, env);
+                sp[-2] = evalOp2(op, l, r);
+                sp--;
+                break;
+            }
+
+            case Opcode::Neg:
+            case Opcode::LNot: {
+                Op1 op = (Op1)(pc[-1] - (int32_t)Opcode::Neg);
+                sp[-1] = evalOp1(op, sp[-1]);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SMALL_VM_HPP
+#define SMALL_VM_HPP
+
+#include <vector>
+
+#include "small_lang_forwards.h"
+#include "small_bytecode.hpp"
+#include "small_values.hpp"
+#include "small_env.hpp"
+
+// A stack machine for compiled Small. Calls push a CallFrame rather than
+// recursing in C++, and closures, frames and values are the same ones the
+// tree-walking evaluator uses, so either engine can run the other's output.
+//
+// A call whose frame can't be captured keeps its bindings on the VM stack,
+// below its operands, so it allocates nothing. A tail call reuses the
+// stack space and CallFrame of the call it replaces.
+//
+// The VM is a root set for the collector. The stack pointer and current env
+// live in locals while running, so they're written back to the VM before
+// anything that might allocate.
+class VM : public RootSet {
+    struct CallFrame {
+        Proto *proto;
+        const int32_t *pc;
+        Env *env;
+        // Stack height to restore when the call returns
+        size_t base;
+        // Where the caller's stack locals start
+        size_t locals;
+    };
+
+    std::vector<Value> stack;
+    std::vector<CallFrame> frames;
+
+    // The live part of the stack and the current env, as of the last sync
+    size_t height;
+    Env *current;
+
+    void sync(Value *sp, Env *env) {
+        height = sp - stack.data();
+        current = env;
+    }
+
+    void reserve(size_t used, int needed);
+
+    Value execute(Proto *, Env *);
+
+    public:
+    VM ();
+
+    ~VM();
+
+    virtual void markRoots(Heap &);
+
+    // Runs a top-level program in env.
+    void run(Proto *, Env *env);
+};
+
+#endif
@@ -1,9 +1,9 @@
 # Test files are in the 'examples/' directory
 tests = Dir['examples/*']
-# The executable:
-parser = "./small_parser.exe"
+# The executable, running each test on both the tree-walker and the VM:
+parser = "./small_parser.exe --compare"
 # Failure states
-failure = { 2 => "Parsing failed" }
+failure = { 2 => "Parsing failed", 4 => "Engines disagree" }
 
 tests.sort.each do |test|
     output = `#{parser} #{test}`